@@ -33,6 +33,7 @@ uniform mat4 model;
 uniform int width;
 uniform int length;
 uniform float radius;
+uniform vec2 origin;
 
 layout (binding = 0) uniform samplerBuffer heights;
 
@@ -88,7 +89,7 @@ void main() {
         float dz = z - floor(z);
 
         float h = 0.0f;
-        int index = int(floor(x + int(z) * (width + 1)));
+        int index = int(floor((x - origin.x) + int(z - origin.y) * (width + 1)));
         if(dx + dz > 1.0f) {
             // lower tri
             h = get_height_lower(vec2(x, z), index);
@@ -0,0 +1,90 @@
+#Vertex
+
+#version 450 core
+
+uniform int grid;
+uniform int size;
+uniform int level;
+uniform int spacing;
+uniform ivec2 origin;
+uniform ivec4 rect;
+uniform bool stitch;
+
+uniform mat4 projection;
+uniform mat4 view;
+uniform mat4 model;
+
+layout (binding = 7) uniform sampler2DArray heights;
+
+out VS {
+	vec3 normal;
+	vec3 position;
+} dest;
+
+float get_height(ivec2 sample_index) {
+	const ivec2 texel = ((sample_index % size) + size) % size;
+	return texelFetch(heights, ivec3(texel, level), 0).r;
+}
+
+void main() {
+	const ivec2 quad = rect.xy + ivec2(gl_InstanceID % rect.z, gl_InstanceID / rect.z);
+	const ivec2 vertex = quad + ivec2(gl_VertexID & 1, gl_VertexID >> 1);
+	const ivec2 sample_index = origin + vertex;
+
+	float height = get_height(sample_index);
+
+	// odd vertices on the outer border sit halfway along an edge of the coarser level around this one
+	if (stitch) {
+		if ((vertex.x == 0 || vertex.x == grid) && (vertex.y & 1) == 1) {
+			height = (get_height(sample_index - ivec2(0, 1)) + get_height(sample_index + ivec2(0, 1))) * 0.5;
+		}
+		if ((vertex.y == 0 || vertex.y == grid) && (vertex.x & 1) == 1) {
+			height = (get_height(sample_index - ivec2(1, 0)) + get_height(sample_index + ivec2(1, 0))) * 0.5;
+		}
+	}
+
+	const float left = get_height(sample_index - ivec2(1, 0));
+	const float right = get_height(sample_index + ivec2(1, 0));
+	const float back = get_height(sample_index - ivec2(0, 1));
+	const float front = get_height(sample_index + ivec2(0, 1));
+
+	const float x = float(sample_index.x * spacing);
+	const float z = float(sample_index.y * spacing);
+
+	gl_Position = projection * view * model * vec4(x, height, z, 1.0);
+
+	dest.normal = vec3(left - right, 2.0 * spacing, back - front);
+	dest.position = vec3(x, height, z);
+}
+
+#End
+
+#Fragment
+
+#version 450 core
+
+layout (location = 0) out vec3 f_color;
+
+in VS {
+	vec3 normal;
+	vec3 position;
+} source;
+
+// blend maps are per page and aren't sampled here, the terrain is drawn in its unpainted color
+void main() {
+	vec3 color = vec3(.8, .8, .8);
+
+	vec3 light_color = vec3(.6, .6, .6);
+
+	vec3 normal = normalize(source.normal);
+	vec3 light_position = vec3(0, 50, 0);
+	vec3 light_direction = normalize(light_position - source.position);
+
+	float diff = clamp(dot(normal, light_direction), 0, 1);
+	vec3 diffuse = diff * light_color;
+	vec3 ambient = vec3(.5, .5, .5);
+
+	f_color = (ambient + diffuse) * color;
+}
+
+#End
@@ -2,8 +2,6 @@
 
 #version 450 core
 
-const int vertex_indices[6] = {2, 0, 1, 2, 3, 1};
-
 layout (location = 0) in vec2 vertex;
 layout (location = 1) in vec2 uv;
 
@@ -11,6 +9,13 @@ uniform int width;
 uniform int length;
 uniform float space;
 uniform vec4 quad;
+uniform vec2 origin;
+uniform ivec4 tiles;
+
+uniform vec3 camera;
+uniform vec2 morph;
+uniform int edges;
+uniform float skirt;
 
 uniform vec3 test_light_position;
 
@@ -30,34 +35,56 @@ out VS {
 	vec2 position_alpha;
 } dest;
 
-float get_height(const int vertex) {
-	const int index = gl_InstanceID + (gl_InstanceID / width);
+float get_height(const ivec2 v) {
+	return texelFetch(heights, v.x + v.y * (width + 1)).r;
+}
 
-	switch(vertex_indices[vertex]) {
-		case 0 :	return texelFetch(heights, index).r;break;
-		case 1 :	return texelFetch(heights, index + 1).r;	break;
-		case 2 :	return texelFetch(heights, index + (width + 1)).r;	break;
-		case 3 :	return texelFetch(heights, index + 1 + (width + 1)).r;	break;
-	}
+vec3 get_normal(const ivec2 v) {
+	return texelFetch(normals, v.x + v.y * (width + 1)).xyz;
+}
+
+// The parent grid has every other vertex, the rest lie on its tile edges or on the diagonal of its tiles
+float get_parent_height(const ivec2 v) {
+	if ((v.x & 1) == 1 && (v.y & 1) == 1)	return (get_height(v + ivec2(1, -1)) + get_height(v + ivec2(-1, 1))) * 0.5;
+	if ((v.x & 1) == 1)						return (get_height(v - ivec2(1, 0)) + get_height(v + ivec2(1, 0))) * 0.5;
+	if ((v.y & 1) == 1)						return (get_height(v - ivec2(0, 1)) + get_height(v + ivec2(0, 1))) * 0.5;
+	return get_height(v);
 }
 
-vec3 get_normal(const int vertex) {
-	const int index = gl_InstanceID + (gl_InstanceID / width);
+vec3 get_parent_normal(const ivec2 v) {
+	if ((v.x & 1) == 1 && (v.y & 1) == 1)	return get_normal(v + ivec2(1, -1)) + get_normal(v + ivec2(-1, 1));
+	if ((v.x & 1) == 1)						return get_normal(v - ivec2(1, 0)) + get_normal(v + ivec2(1, 0));
+	if ((v.y & 1) == 1)						return get_normal(v - ivec2(0, 1)) + get_normal(v + ivec2(0, 1));
+	return get_normal(v);
+}
 
-	switch(vertex_indices[vertex]) {
-		case 0 :	return texelFetch(normals, index).xyz;	break;
-		case 1 :	return texelFetch(normals, index + 1).xyz;	break;
-		case 2 :	return texelFetch(normals, index + (width + 1)).xyz;	break;
-		case 3 :	return texelFetch(normals, index + 1 + (width + 1)).xyz;	break;
+// Skirts are quads hanging from the rectangle's border, tiles.z along each z edge then tiles.w along each x edge
+ivec2 get_skirt_vertex() {
+	const int along = int(vertex.x);
+	if (gl_InstanceID < 2 * tiles.z) {
+		return tiles.xy + ivec2(gl_InstanceID % tiles.z + along, (gl_InstanceID / tiles.z) * tiles.w);
 	}
+
+	const int id = gl_InstanceID - 2 * tiles.z;
+	return tiles.xy + ivec2((id / tiles.w) * tiles.z, id % tiles.w + along);
 }
 
 void main() {
-	const float height = get_height(gl_VertexID);
-	const vec3 normal = get_normal(gl_VertexID);
-	const vec2 position = vec2(gl_InstanceID % width, gl_InstanceID / width);
-	const float x = (vertex.x + position.x) * space + quad.x;
-	const float z = (vertex.y + position.y) * space + quad.y;
+	const ivec2 grid_vertex = skirt > 0.0 ? get_skirt_vertex() : tiles.xy + ivec2(gl_InstanceID % tiles.z, gl_InstanceID / tiles.z) + ivec2(vertex);
+	const float x = grid_vertex.x * space + quad.x;
+	const float z = grid_vertex.y * space + quad.y;
+
+	// vertices slide onto the parent grid between morph.x and morph.y from the camera
+	// edges next to a coarser node are fully morphed so their vertices lie on its edge
+	const vec2 ground = (model * vec4(x, 0.0, z, 1.0)).xz;
+	float k = clamp((distance(ground, camera.xz) - morph.x) / max(morph.y - morph.x, 1e-6), 0.0, 1.0);
+	if (((edges & 1) != 0 && grid_vertex.x == 0) || ((edges & 2) != 0 && grid_vertex.x == width) ||
+		((edges & 4) != 0 && grid_vertex.y == 0) || ((edges & 8) != 0 && grid_vertex.y == length)) {
+		k = 1.0;
+	}
+
+	const float height = mix(get_height(grid_vertex), get_parent_height(grid_vertex), k) - (skirt > 0.0 ? vertex.y * skirt : 0.0);
+	const vec3 normal = mix(normalize(get_normal(grid_vertex)), normalize(get_parent_normal(grid_vertex)), k);
 
 	gl_Position = projection * view * model * vec4(x, height, z, 1.0);
 
@@ -66,7 +93,7 @@ void main() {
 	dest.normal = normal;
 
 	dest.position = vec3(x, height, z);
-	dest.position_alpha = vec2(x / width, z / length);
+	dest.position_alpha = vec2((x - origin.x) / width, (z - origin.y) / length);
 }
 
 #End
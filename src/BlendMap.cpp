@@ -0,0 +1,268 @@
+#include "BlendMap.h"
+
+#include <algorithm>
+#include <limits>
+#include <cstring>
+#include <cmath>
+
+BlendMap::BlendMap(int format) :
+	_format		( format ),
+	_tiles		( ),
+	_views		( )
+{}
+
+static size_t texel_offset(int x, int z) {
+	return (x % BLEND_TILE_SIZE) + (z % BLEND_TILE_SIZE) * BLEND_TILE_SIZE;
+}
+
+glm::vec4 BlendMap::get(int x, int z) const {
+	const auto data = tile(tile_index(x, z));
+	if (!data) {
+		return glm::vec4(0, 0, 0, 0);
+	}
+
+	return decode(data + texel_offset(x, z) * texel_size(_format), _format);
+}
+
+// weights are clamped to 0..1 and scaled back down when they sum past 1, the back texture gets whatever is left
+void BlendMap::set(int x, int z, glm::vec4 weights) {
+	if (_format != BLEND_FORMAT_FLOAT) {
+		weights = glm::clamp(weights, 0.0f, 1.0f);
+
+		const float sum = weights.x + weights.y + weights.z + weights.w;
+		if (sum > 1.0f) {
+			weights /= sum;
+		}
+	}
+
+	encode(weights, write_tile(tile_index(x, z)) + texel_offset(x, z) * texel_size(_format), _format);
+}
+
+const uint8_t* BlendMap::tile(int index) const {
+	if (_tiles[index]) {
+		return _tiles[index].get();
+	}
+
+	return _views[index];
+}
+
+uint8_t* BlendMap::write_tile(int index) {
+	if (!_tiles[index] || _tiles[index].use_count() > 1) {
+		const auto source = tile(index);
+
+		std::shared_ptr<uint8_t[]> texels(new uint8_t[tile_bytes()]());
+		if (source) {
+			std::memcpy(texels.get(), source, tile_bytes());
+		}
+
+		_tiles[index] = std::move(texels);
+		_views[index] = nullptr;
+	}
+
+	return _tiles[index].get();
+}
+
+void BlendMap::view_tile(int index, const uint8_t* tile) {
+	_tiles[index].reset();
+	_views[index] = tile;
+}
+
+void BlendMap::release_tile(int index) {
+	_tiles[index].reset();
+	_views[index] = nullptr;
+}
+
+// releases the tile once it has been painted back to all zero weights
+bool BlendMap::trim_tile(int index) {
+	const auto data = tile(index);
+	if (!data || std::any_of(data, data + tile_bytes(), [](uint8_t byte) { return byte != 0; })) {
+		return false;
+	}
+
+	release_tile(index);
+	return true;
+}
+
+void BlendMap::clear() {
+	for (int i = 0; i < BLEND_TILE_COUNT; ++i) {
+		release_tile(i);
+	}
+}
+
+void BlendMap::read_tile(int index, const uint8_t* data, int format) {
+	auto texels = write_tile(index);
+	if (format == _format) {
+		std::memcpy(texels, data, tile_bytes());
+		return;
+	}
+
+	for (int i = 0; i < BLEND_TILE_TEXELS; ++i) {
+		encode(decode(data + i * texel_size(format), format), texels + i * texel_size(_format), _format);
+	}
+}
+
+// unpainted tiles are copied as zero weights
+void BlendMap::copy_tile(int index, uint8_t* data, int format) const {
+	const auto texels = tile(index);
+	if (!texels) {
+		std::memset(data, 0, texel_size(format) * BLEND_TILE_TEXELS);
+		return;
+	}
+
+	if (format == _format) {
+		std::memcpy(data, texels, tile_bytes());
+		return;
+	}
+
+	for (int i = 0; i < BLEND_TILE_TEXELS; ++i) {
+		encode(decode(texels + i * texel_size(_format), _format), data + i * texel_size(format), format);
+	}
+}
+
+bool BlendMap::has_views() const {
+	return std::any_of(_views.begin(), _views.end(), [](const uint8_t* tile) { return tile != nullptr; });
+}
+
+// copies every viewed tile so the mapping can be closed
+void BlendMap::detach() {
+	for (int i = 0; i < BLEND_TILE_COUNT; ++i) {
+		if (_views[i]) {
+			write_tile(i);
+		}
+	}
+}
+
+int BlendMap::format() const {
+	return _format;
+}
+
+size_t BlendMap::tile_count() const {
+	size_t count = 0;
+	for (int i = 0; i < BLEND_TILE_COUNT; ++i) {
+		count += tile(i) ? 1 : 0;
+	}
+
+	return count;
+}
+
+size_t BlendMap::tile_bytes() const {
+	return texel_size(_format) * BLEND_TILE_TEXELS;
+}
+
+// mapped views are backed by the file and not counted
+size_t BlendMap::resident_bytes() const {
+	size_t bytes = 0;
+	for (const auto& tile : _tiles) {
+		bytes += tile ? tile_bytes() : 0;
+	}
+
+	return bytes;
+}
+
+void BlendMap::read_dense(const glm::vec4* data) {
+	clear();
+
+	for (int i = 0; i < BLEND_TILE_COUNT; ++i) {
+		const auto rect = tile_rect(i);
+
+		bool painted = false;
+		for (int z = rect.y; z < rect.y + rect.w && !painted; ++z) {
+			const auto row = data + rect.x + static_cast<size_t>(z) * BLEND_MAP_SIZE;
+			painted = std::any_of(row, row + rect.z, [](const glm::vec4& texel) { return texel != glm::vec4(0, 0, 0, 0); });
+		}
+
+		if (!painted) {
+			continue;
+		}
+
+		auto texels = write_tile(i);
+		for (int z = 0; z < rect.w; ++z) {
+			const auto row = data + rect.x + static_cast<size_t>(rect.y + z) * BLEND_MAP_SIZE;
+			for (int x = 0; x < rect.z; ++x) {
+				encode(row[x], texels + (x + z * BLEND_TILE_SIZE) * texel_size(_format), _format);
+			}
+		}
+	}
+}
+
+void BlendMap::write_dense(glm::vec4* data) const {
+	for (int i = 0; i < BLEND_TILE_COUNT; ++i) {
+		const auto rect = tile_rect(i);
+		const auto texels = tile(i);
+
+		for (int z = 0; z < rect.w; ++z) {
+			const auto row = data + rect.x + static_cast<size_t>(rect.y + z) * BLEND_MAP_SIZE;
+			for (int x = 0; x < rect.z; ++x) {
+				row[x] = texels ? decode(texels + (x + z * BLEND_TILE_SIZE) * texel_size(_format), _format) : glm::vec4(0, 0, 0, 0);
+			}
+		}
+	}
+}
+
+glm::ivec4 BlendMap::tile_rect(int index) {
+	const int x = (index % BLEND_TILES) * BLEND_TILE_SIZE;
+	const int z = (index / BLEND_TILES) * BLEND_TILE_SIZE;
+
+	return glm::ivec4(x, z, std::min(BLEND_TILE_SIZE, BLEND_MAP_SIZE - x), std::min(BLEND_TILE_SIZE, BLEND_MAP_SIZE - z));
+}
+
+int BlendMap::tile_index(int x, int z) {
+	return (x / BLEND_TILE_SIZE) + (z / BLEND_TILE_SIZE) * BLEND_TILES;
+}
+
+size_t BlendMap::texel_size(int format) {
+	switch (format) {
+	case BLEND_FORMAT_RGBA16:	return sizeof(uint16_t) * 4;
+	case BLEND_FORMAT_RGBA8:	return sizeof(uint8_t) * 4;
+	default:					return sizeof(glm::vec4);
+	}
+}
+
+template <typename T>
+static glm::vec4 dequantize(const uint8_t* texel) {
+	T q[4];
+	std::memcpy(q, texel, sizeof(q));
+
+	return glm::vec4(q[0], q[1], q[2], q[3]) / static_cast<float>(std::numeric_limits<T>::max());
+}
+
+// rounding can push the sum of saturated weights a step or two past 1, the largest weights give them back
+template <typename T>
+static void quantize(glm::vec4 weights, uint8_t* texel) {
+	constexpr int steps = std::numeric_limits<T>::max();
+
+	int q[4];
+	int sum = 0;
+	for (int c = 0; c < 4; ++c) {
+		q[c] = static_cast<int>(std::lround(glm::clamp(weights[c], 0.0f, 1.0f) * steps));
+		sum += q[c];
+	}
+
+	const bool normalized = weights.x + weights.y + weights.z + weights.w <= 1.0f + 1e-5f;
+	for (; normalized && sum > steps; --sum) {
+		--*std::max_element(q, q + 4);
+	}
+
+	const T values[4] = { static_cast<T>(q[0]), static_cast<T>(q[1]), static_cast<T>(q[2]), static_cast<T>(q[3]) };
+	std::memcpy(texel, values, sizeof(values));
+}
+
+glm::vec4 BlendMap::decode(const uint8_t* texel, int format) {
+	switch (format) {
+	case BLEND_FORMAT_RGBA16:	return dequantize<uint16_t>(texel);
+	case BLEND_FORMAT_RGBA8:	return dequantize<uint8_t>(texel);
+	}
+
+	glm::vec4 weights;
+	std::memcpy(&weights, texel, sizeof(glm::vec4));
+	return weights;
+}
+
+void BlendMap::encode(glm::vec4 weights, uint8_t* texel, int format) {
+	switch (format) {
+	case BLEND_FORMAT_RGBA16:	quantize<uint16_t>(weights, texel); return;
+	case BLEND_FORMAT_RGBA8:	quantize<uint8_t>(weights, texel); return;
+	}
+
+	std::memcpy(texel, &weights, sizeof(glm::vec4));
+}
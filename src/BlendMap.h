@@ -0,0 +1,76 @@
+#ifndef BLEND_MAP_H
+#define BLEND_MAP_H
+
+#include <glm/glm.hpp>
+
+#include <array>
+#include <memory>
+#include <cstdint>
+
+#define BLEND_MAP_SIZE 1028
+#define BLEND_TILE_SIZE 64
+#define BLEND_TILE_TEXELS (BLEND_TILE_SIZE * BLEND_TILE_SIZE)
+#define BLEND_TILES ((BLEND_MAP_SIZE + BLEND_TILE_SIZE - 1) / BLEND_TILE_SIZE)
+#define BLEND_TILE_COUNT (BLEND_TILES * BLEND_TILES)
+
+// texel storage, quantized formats are normalized unsigned integers
+#define BLEND_FORMAT_FLOAT 0
+#define BLEND_FORMAT_RGBA16 1
+#define BLEND_FORMAT_RGBA8 2
+
+/* Sparse blend map
+** The map is split into BLEND_TILE_SIZE tiles, unpainted tiles are implicit zero weights and hold no memory
+** Edge tiles are allocated whole, texels past BLEND_MAP_SIZE are never read
+
+** A tile is either owned or a read only view into a mapped terrain file, views are copied on first write
+** Copies of a blend map share their tiles, a shared tile is copied by whichever map writes it first
+
+** Float weights are stored as they are set, like the dense map always stored them
+** RGBA8 and RGBA16 weights are saturated and renormalized so they never sum past 1, then rounded so the stored sum stays within 1 as well
+*/
+
+class BlendMap {
+public:
+	BlendMap(int format = BLEND_FORMAT_FLOAT);
+
+	glm::vec4 get(int x, int z) const;
+	void set(int x, int z, glm::vec4 weights);
+
+	// tiles are BLEND_TILE_TEXELS texels of the map's format, nullptr -> unpainted
+	const uint8_t* tile(int index) const;
+	uint8_t* write_tile(int index);
+	void view_tile(int index, const uint8_t* tile);
+	void release_tile(int index);
+	bool trim_tile(int index);
+	void clear();
+
+	// converting copies between this map's format and another
+	void read_tile(int index, const uint8_t* data, int format);
+	void copy_tile(int index, uint8_t* data, int format) const;
+
+	bool has_views() const;
+	void detach();
+
+	int format() const;
+	size_t tile_count() const;
+	size_t tile_bytes() const;
+	size_t resident_bytes() const;
+
+	// dense maps are BLEND_MAP_SIZE * BLEND_MAP_SIZE row major, all zero tiles stay unallocated
+	void read_dense(const glm::vec4* data);
+	void write_dense(glm::vec4* data) const;
+
+	// x, z, width, length of the tile clipped to the map
+	static glm::ivec4 tile_rect(int index);
+	static int tile_index(int x, int z);
+
+	static size_t texel_size(int format);
+	static glm::vec4 decode(const uint8_t* texel, int format);
+	static void encode(glm::vec4 weights, uint8_t* texel, int format);
+private:
+	int															_format;
+	std::array<std::shared_ptr<uint8_t[]>, BLEND_TILE_COUNT>	_tiles;
+	std::array<const uint8_t*, BLEND_TILE_COUNT>				_views;
+};
+
+#endif
@@ -1,8 +1,10 @@
 #include "Clock.h"
 
-#include <Windows.h>
 #include <GLFW/glfw3.h>
 #include <ctime>
+#include <cmath>
+#include <chrono>
+#include <thread>
 
 Clock::Clock(const int fps) :
 	_limit(fps),
@@ -23,7 +25,7 @@ bool Clock::update(const double interval) {
 	if (_is_limit && (_time < _ms)) {
 		const double delay = _ms - _time;
 		if (delay > 0.0) {
-			Sleep(DWORD(delay));
+			std::this_thread::sleep_for(std::chrono::milliseconds(static_cast<long long>(delay)));
 			update_time();
 		}
 	}
@@ -95,7 +97,11 @@ std::string Clock::get_system_time() const {
 	time_t sys_time = time(NULL);
 	std::string str;
 	str.resize(26);
+#ifdef _WIN32
 	ctime_s(&str[0], str.size(), &sys_time);
+#else
+	ctime_r(&sys_time, &str[0]);
+#endif
 
 	str.resize(str.find('\n'));
 
@@ -5,7 +5,7 @@
 #include "Camera.h"
 #include "ShaderManager.h"
 
-#include "Terrain.h"
+#include "TerrainRender.h"
 
 #include "imgui/imgui.h"
 #include "imgui/imgui_impl_opengl3.h"
@@ -25,15 +25,22 @@ Editor::Editor(Core* core) :
 	TerrainShaders terrain_shaders(
 		_core->_shader_manager->get_program(1),
 		_core->_shader_manager->get_program(2),
-		nullptr
+		nullptr,
+		_core->_shader_manager->get_program(3)
 	);
 
 	GLuint vao;
 	glCreateVertexArrays(1, &vao);
 	glBindVertexArray(vao);
-	_terrain = std::make_unique<Terrain>(100, 100, 0, vao, terrain_shaders);
+	_terrain = std::make_unique<Terrain>(100, 100, 0);
+	auto mesh = std::make_unique<TerrainMesh>(_terrain.get(), terrain_shaders);
+	_terrain_mesh = mesh.get();
+	_terrain->set_renderer(std::move(mesh));
 	_terrain->get_transform().set_scale(glm::vec3(10.0f, 10.0f, 10.0f));
 	_terrain->load("Data\\terrain.txt");
+	_terrain->_save_callback = [](bool saved) {
+		std::cout << (saved ? "Terrain Saved \n" : "Terrain Save Failed \n");
+	};
 
 	glfwSetWindowUserPointer(_core->_window->get(), this);
 	glfwSetKeyCallback(_core->_window->get(), &Editor::key_callback);
@@ -140,6 +147,11 @@ void Editor::key_callback(GLFWwindow* window, int key, int scancode, int action,
 		editor->_core->_camera->set_mode(CAMERA_TOGGLE);
 	}
 
+	if (key == GLFW_KEY_2 && action == GLFW_PRESS) {
+		auto& mode = editor->_terrain_mesh->_mode;
+		mode = mode == TERRAIN_DRAW_CLIPMAP ? TERRAIN_DRAW_QUADTREE : TERRAIN_DRAW_CLIPMAP;
+	}
+
 	if(key == GLFW_KEY_Z && action == GLFW_PRESS) {
 		const auto radius = editor->_terrain->_brush_mesh->_radius;
 		if (radius > 1) {
@@ -152,7 +164,6 @@ void Editor::key_callback(GLFWwindow* window, int key, int scancode, int action,
 
 	if (key == GLFW_KEY_P && action == GLFW_PRESS) {
 		editor->_terrain->save("Data\\terrain.txt");
-		std::cout << "Terrain Saved \n";
 	}
 }
 
@@ -178,7 +189,7 @@ void Editor::update() {
 
 	_core->_camera->update();
 
-	//_terrain->update(_core->_camera->get_position());
+	_terrain->update(_core->_camera->get_position());
 	_terrain->_brush_mesh->update(_core->_camera->mouse_to_3d_vector(), _core->_camera->get_position());
 }
 
@@ -186,8 +197,9 @@ void Editor::draw() {
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 	glClearBufferfv(GL_COLOR, 0, CLEAR_COLOR);
 
-	_terrain->draw(_core->_camera->get_position());
-	_terrain->_brush_mesh->draw(glm::vec3(0, 0, 0));
+	const auto camera = _core->_camera.get();
+	_terrain_mesh->draw(camera->get_position(), TerrainFrustum(camera->get_projection() * camera->get_view() * _terrain->get_transform().get_model()));
+	_terrain_mesh->draw_brush();
 
 	ImGui::Render();
 	ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
@@ -231,6 +243,10 @@ BrushWindow::BrushWindow(Editor* editor) :
 void BrushWindow::update() {
 	ImGui::Begin("Brush");
 	ImGui::SliderFloat("Radius", &_editor->_terrain->_brush_mesh->_radius, 1.0f, 100.0f);
+
+	if (_editor->_terrain->saving()) {
+		ImGui::ProgressBar(_editor->_terrain->save_progress(), ImVec2(-1, 0), "Saving");
+	}
 	
 	if (ImGui::Checkbox("Terrain", &_terrain))		_texture = false;
 
@@ -247,15 +263,27 @@ void BrushWindow::update() {
 	if(ImGui::Checkbox("Texture", &_texture))		_terrain = false;
 	if(ImGui::TreeNodeEx("Texture", ImGuiTreeNodeFlags_OpenOnDoubleClick | ImGuiTreeNodeFlags_DefaultOpen)) {
 
-		//ImGui::Image((void*)(intptr_t)_editor->_terrain->_mesh->_tile_textures.at(0), ImVec2(64, 64));
-		if (ImGui::ImageButton((void*)(intptr_t)_editor->_terrain->_mesh->_tile_textures.at(0), ImVec2(64, 64))) _texture_index = 0;
+		//ImGui::Image((void*)(intptr_t)_editor->_terrain_mesh->_tile_textures.at(0), ImVec2(64, 64));
+		if (ImGui::ImageButton((void*)(intptr_t)_editor->_terrain_mesh->_tile_textures.at(0), ImVec2(64, 64))) _texture_index = 0;
 		ImGui::SameLine();
-		if (ImGui::ImageButton((void*)(intptr_t)_editor->_terrain->_mesh->_tile_textures.at(1), ImVec2(64, 64))) _texture_index = 1;
+		if (ImGui::ImageButton((void*)(intptr_t)_editor->_terrain_mesh->_tile_textures.at(1), ImVec2(64, 64))) _texture_index = 1;
 		ImGui::SameLine();
-		if (ImGui::ImageButton((void*)(intptr_t)_editor->_terrain->_mesh->_tile_textures.at(2), ImVec2(64, 64))) _texture_index = 2;
+		if (ImGui::ImageButton((void*)(intptr_t)_editor->_terrain_mesh->_tile_textures.at(2), ImVec2(64, 64))) _texture_index = 2;
 		ImGui::SameLine();
-		if (ImGui::ImageButton((void*)(intptr_t)_editor->_terrain->_mesh->_tile_textures.at(3), ImVec2(64, 64))) _texture_index = 3;
+		if (ImGui::ImageButton((void*)(intptr_t)_editor->_terrain_mesh->_tile_textures.at(3), ImVec2(64, 64))) _texture_index = 3;
+
+		ImGui::TreePop();
+	}
+
+	const auto& stats = _editor->_terrain->_node_stats;
+	if (ImGui::TreeNodeEx("Nodes", ImGuiTreeNodeFlags_OpenOnDoubleClick)) {
+		ImGui::Text("%zu nodes, %zu resident, %.1f MB", stats._nodes, stats._resident, stats._resident_bytes / (1024.0 * 1024.0));
+		ImGui::Text("%llu hits, %llu misses, %llu evictions", (unsigned long long)stats._hits, (unsigned long long)stats._misses, (unsigned long long)stats._evictions);
+		ImGui::Text("%llu rebuilt after edits", (unsigned long long)stats._rebuilds);
+		ImGui::Text("%zu culled", stats._culled);
 
+		const auto& buffers = _editor->_terrain_mesh->_buffer_stats;
+		ImGui::Text("%zu node buffers, %.1f MB, %.1f KB uploaded", buffers._buffers, buffers._bytes / (1024.0 * 1024.0), buffers._uploaded / 1024.0);
 		ImGui::TreePop();
 	}
 
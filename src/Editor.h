@@ -4,7 +4,7 @@
 #include "State.h"
 #include "Core.h"
 
-#include "Terrain.h"
+#include "TerrainRender.h"
 
 #include <memory>
 
@@ -58,6 +58,7 @@ public:
 	Core*						_core;
 	BrushWindow					_brush_window;
 	std::unique_ptr<Terrain>	_terrain;
+	TerrainMesh*				_terrain_mesh;
 
 private:
 	static void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods);
@@ -2,6 +2,7 @@
 
 #include <iostream>
 #include <charconv>
+#include <limits>
 
 #define SECTION_CHAR '#'
 #define COMMENT_CHAR '-'
@@ -6,7 +6,7 @@
 #include <GLFW/glfw3.h>
 
 #include "Window.h"
-#include "camera.h"
+#include "Camera.h"
 #include "Clock.h"
 #include "ShaderManager.h"
 
@@ -22,11 +22,14 @@ Game::Game(Core* core) :
 	TerrainShaders terrain_shaders(
 		_core->_shader_manager->get_program(1),
 		_core->_shader_manager->get_program(2),
-		nullptr
+		nullptr,
+		_core->_shader_manager->get_program(3)
 	);
 
-	GLuint vao = 0;
-	_terrain = std::make_unique<Terrain>(100, 100, 3, vao, terrain_shaders);
+	_terrain = std::make_unique<Terrain>(100, 100, 3);
+	auto mesh = std::make_unique<TerrainMesh>(_terrain.get(), terrain_shaders);
+	_terrain_mesh = mesh.get();
+	_terrain->set_renderer(std::move(mesh));
 	_terrain->get_transform().set_scale(glm::vec3(1.0f, 1.0f, 1.0f));
 	_terrain->load("Data\\terrain.txt");
 
@@ -70,6 +73,8 @@ void Game::update() {
 	_core->_window->set_title(std::to_string(_core->_clock->get_fms()));
 	_core->_camera->update();
 
+	_terrain->update(_core->_camera->get_position());
+
 	auto& pos = _core->_camera->get_position();
 	auto scale = _terrain->get_transform().get_scale();
 	//pos.y = _terrain->exact_height(pos.x / scale.x, pos.z / scale.z) + 5.0f;
@@ -79,7 +84,8 @@ void Game::draw() {
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 	glClearBufferfv(GL_COLOR, 0, CLEAR_COLOR);
 
-	_terrain->draw(_core->_camera->get_position());
+	const auto camera = _core->_camera.get();
+	_terrain_mesh->draw(camera->get_position(), TerrainFrustum(camera->get_projection() * camera->get_view() * _terrain->get_transform().get_model()));
 
 	glfwSwapBuffers(_core->_window->get());
 
@@ -4,7 +4,7 @@
 #include "State.h"
 #include "Core.h"
 
-#include "Terrain.h"
+#include "TerrainRender.h"
 
 class Game : public State {
 public:
@@ -18,6 +18,7 @@ private:
 	Core* _core;
 
 	std::unique_ptr<Terrain> _terrain;
+	TerrainMesh* _terrain_mesh;
 };
 
 #endif
\ No newline at end of file
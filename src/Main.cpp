@@ -19,10 +19,16 @@
 
 #include <iostream>
 
+#ifdef _WIN32
+#include <Windows.h>
+#endif
+
 int main() {
 
+#ifdef _WIN32
 	HWND console_window = GetConsoleWindow();
 	SetWindowPos(console_window, 0, -800, 300, 800, 500, 0);
+#endif
 
 	if(!glfwInit()) {
 		assert(0);
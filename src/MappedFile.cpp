@@ -0,0 +1,93 @@
+#include "MappedFile.h"
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+MappedFile::MappedFile(const std::string& path) :
+	_file		( INVALID_HANDLE_VALUE ),
+	_mapping	( nullptr ),
+	_data		( nullptr ),
+	_size		( 0 )
+{
+	_file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (_file == INVALID_HANDLE_VALUE) {
+		return;
+	}
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(_file, &size) || size.QuadPart == 0) {
+		return;
+	}
+
+	_mapping = CreateFileMappingA(_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!_mapping) {
+		return;
+	}
+
+	_data = static_cast<const char*>(MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0));
+	_size = _data ? static_cast<size_t>(size.QuadPart) : 0;
+}
+
+MappedFile::~MappedFile() {
+	if (_data) {
+		UnmapViewOfFile(_data);
+	}
+	if (_mapping) {
+		CloseHandle(_mapping);
+	}
+	if (_file != INVALID_HANDLE_VALUE) {
+		CloseHandle(_file);
+	}
+}
+
+#else
+
+MappedFile::MappedFile(const std::string& path) :
+	_file		( open(path.c_str(), O_RDONLY) ),
+	_data		( nullptr ),
+	_size		( 0 )
+{
+	struct stat info;
+	if (_file < 0 || fstat(_file, &info) != 0 || info.st_size == 0) {
+		return;
+	}
+
+	void* data = mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, _file, 0);
+	if (data == MAP_FAILED) {
+		return;
+	}
+
+	_data = static_cast<const char*>(data);
+	_size = static_cast<size_t>(info.st_size);
+}
+
+MappedFile::~MappedFile() {
+	if (_data) {
+		munmap(const_cast<char*>(_data), _size);
+	}
+	if (_file >= 0) {
+		close(_file);
+	}
+}
+
+#endif
+
+bool MappedFile::is_open() const {
+	return _data != nullptr;
+}
+
+const char* MappedFile::data() const {
+	return _data;
+}
+
+size_t MappedFile::size() const {
+	return _size;
+}
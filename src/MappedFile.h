@@ -0,0 +1,30 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <string>
+
+// Read only view of a whole file, the os pages the contents in as they are touched
+class MappedFile {
+public:
+	MappedFile(const std::string& path);
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	bool is_open() const;
+
+	const char* data() const;
+	size_t size() const;
+private:
+#ifdef _WIN32
+	void*		_file;
+	void*		_mapping;
+#else
+	int			_file;
+#endif
+	const char*	_data;
+	size_t		_size;
+};
+
+#endif
@@ -0,0 +1,89 @@
+#include "Parallel.h"
+
+WorkerPool& WorkerPool::get() {
+	static WorkerPool pool;
+	return pool;
+}
+
+WorkerPool::WorkerPool() :
+	_stop			( false )
+{
+	const size_t threads = std::max(std::thread::hardware_concurrency(), 1u) - 1;
+
+	_threads.reserve(threads);
+	for (size_t i = 0; i < threads; ++i) {
+		_threads.emplace_back(&WorkerPool::work, this);
+	}
+}
+
+WorkerPool::~WorkerPool() {
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_stop = true;
+	}
+	_wake.notify_all();
+
+	for (auto& thread : _threads) {
+		thread.join();
+	}
+}
+
+size_t WorkerPool::threads() const {
+	return _threads.size();
+}
+
+void WorkerPool::run(size_t count, const std::function<void(size_t)>& func) {
+	auto job = std::make_shared<Job>();
+	job->_func = &func;
+	job->_count = count;
+	job->_next = 0;
+	job->_done = 0;
+
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_jobs.push_back(job);
+	}
+	_wake.notify_all();
+
+	help(*job);
+
+	// items other threads picked up may still be running
+	std::unique_lock<std::mutex> lock(_mutex);
+	_finished.wait(lock, [&]() { return job->_done == count; });
+}
+
+// Takes items until the job has none left, the job leaves the queue once they are all handed out
+void WorkerPool::help(Job& job) {
+	for (size_t i = job._next++; i < job._count; i = job._next++) {
+		(*job._func)(i);
+
+		if (++job._done == job._count) {
+			std::lock_guard<std::mutex> lock(_mutex);
+			_finished.notify_all();
+		}
+	}
+
+	std::lock_guard<std::mutex> lock(_mutex);
+	const auto it = std::find_if(_jobs.begin(), _jobs.end(), [&](const std::shared_ptr<Job>& queued) { return queued.get() == &job; });
+	if (it != _jobs.end()) {
+		_jobs.erase(it);
+	}
+}
+
+void WorkerPool::work() {
+	std::unique_lock<std::mutex> lock(_mutex);
+
+	while (true) {
+		_wake.wait(lock, [&]() { return _stop || !_jobs.empty(); });
+
+		if (_stop) {
+			return;
+		}
+
+		// the shared_ptr keeps the job alive until this thread is done with it
+		auto job = _jobs.front();
+		lock.unlock();
+		help(*job);
+		lock.lock();
+	}
+}
@@ -0,0 +1,66 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <deque>
+#include <vector>
+#include <algorithm>
+
+/* Shared worker pool
+** One thread per core besides the caller, started on first use
+** The caller of run always works on its own job too, so jobs started from inside a job (bands of a child node, nodes of a load batch)
+** finish even when every worker is busy
+*/
+
+class WorkerPool {
+public:
+	static WorkerPool& get();
+
+	~WorkerPool();
+
+	WorkerPool(const WorkerPool&) = delete;
+	WorkerPool& operator=(const WorkerPool&) = delete;
+
+	// calls func(i) for i in [0, count), blocks until every call has returned
+	void run(size_t count, const std::function<void(size_t)>& func);
+	size_t threads() const;
+private:
+	struct Job {
+		const std::function<void(size_t)>*	_func;
+		size_t								_count;
+		std::atomic<size_t>					_next;
+		std::atomic<size_t>					_done;
+	};
+
+	WorkerPool();
+
+	void work();
+	void help(Job& job);
+
+	std::mutex							_mutex;
+	std::condition_variable				_wake;
+	std::condition_variable				_finished;
+	std::deque<std::shared_ptr<Job>>	_jobs;
+	std::vector<std::thread>			_threads;
+	bool								_stop;
+};
+
+// Runs func(i) for i in [0, count) across the available cores, blocks until every call has returned
+template <typename Func>
+void parallel_for(size_t count, Func func) {
+	if (count <= 1 || WorkerPool::get().threads() == 0) {
+		for (size_t i = 0; i < count; ++i) {
+			func(i);
+		}
+		return;
+	}
+
+	WorkerPool::get().run(count, [&](size_t i) { func(i); });
+}
+
+#endif
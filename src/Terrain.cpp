@@ -1,59 +1,50 @@
 #include "Terrain.h"
 
-#include <GL/gl3w.h>
-
 #include <cstdint>
 #include <fstream>
+#include <filesystem>
+#include <limits>
+#include <algorithm>
+#include <unordered_set>
+#include <atomic>
 
-#include <SOIL/SOIL2.h>
 #include <iostream>
 
+#include <glm/gtc/constants.hpp>
+
 #include "PerlinNoise.hpp"
+#include "TerrainKernels.h"
+#include "Parallel.h"
 
 #define _USE_MATH_DEFINES
 #include <math.h>
 
-constexpr size_t TILE_VERTICES_SIZE = 12;
+// normal rows are generated in bands of about this many vertices, smaller grids stay on one thread
+constexpr int NORMAL_BAND_VERTICES = 64 * 1024;
 
-constexpr GLfloat TILE_VERTICES[] = {
-	0.0f, 1.0f, 0.0f, 0.0f, 1.0f, 0.0f,
-	0.0f, 1.0f, 1.0f, 1.0f, 1.0f, 0.0f
-};
+// lowest lod range in node sizes, a node selected at the next level then never touches one two levels up
+constexpr float LOD_RANGE_MIN = 1.5f;
 
-constexpr GLfloat TILE_UVS[] = {
-	0.0f, 1.0f, 0.0f, 0.0f, 1.0f, 0.0f,
-	0.0f, 1.0f, 1.0f, 1.0f, 1.0f, 0.0f
-};
+// last grid version handed out, nodes are built on the worker pool and the loader's thread
+static std::atomic<uint64_t> grid_versions(0);
 
 //-----------------------------------------------------------BRUSH MESH---------------------------------------------------------------------------------------------------------
 
-BrushMesh::BrushMesh(Program* program, Terrain* root) :
-	_program		( program ),
-	_root			( root ),
-	_radius			( 1.0f )
+BrushMesh::BrushMesh(Terrain* root) :
+	_radius			( 1.0f ),
+	_root			( root )
 {}
 
-void BrushMesh::draw(glm::vec3 position) {
-	glUseProgram(_program->_id);
-
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_BUFFER, _root->_mesh->_height_texture);
-
-	glUniformMatrix4fv(glGetUniformLocation(_program->_id, "model"), 1, GL_FALSE, &_root->_transform.get_model()[0][0]);
-	glUniform1i(glGetUniformLocation(_program->_id, "width"), _root->_width);
-	glUniform1i(glGetUniformLocation(_program->_id, "length"), _root->_length);
-	glUniform3fv(glGetUniformLocation(_program->_id, "position"), 1, &_position[0]);
-	glUniform1f(glGetUniformLocation(_program->_id, "radius"), _radius);
-
-	glBindBuffer(GL_ARRAY_BUFFER, _root->_mesh->_height_buffer);
-	glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(GLfloat) * _root->_node._heights.size(), &_root->_node._heights[0]);
-
-	glDrawArrays(GL_POINTS, 0, 1);
-}
-
+// The brush sits where the mouse ray hits the terrain, or where it crosses 0 height when it misses
 void BrushMesh::update(glm::vec3 mouse_vector, glm::vec3 offset) {
-	float height = _root->find_height(mouse_vector, offset);
+	TerrainHit hit;
+	if (_root->raycast(offset, mouse_vector, &hit)) {
+		const auto scale = _root->_transform.get_scale();
+		_position = glm::vec3(hit._position.x / scale.x, hit._position.y, hit._position.z / scale.z);
+		return;
+	}
 
+	const float height = 0.0f;
 	const float y = abs((offset.y - height) / mouse_vector.y);
 	const float x = (y * mouse_vector.x + offset.x) / _root->_transform.get_scale().x;
 	const float z = (y * mouse_vector.z + offset.z) / _root->_transform.get_scale().z;
@@ -82,6 +73,11 @@ std::vector<std::array<int, 2>> BrushMesh::tiles_within_radius() {
 	return tiles;
 }
 
+std::vector<TerrainPage*> BrushMesh::pages_within_radius() {
+	return _root->pages_within(glm::vec2(_position.x - _radius, _position.z - _radius),
+							   glm::vec2(_position.x + _radius, _position.z + _radius));
+}
+
 // flags F_RAISE, F_SET, F_AVERAGE
 void BrushMesh::raise_height(float val, int flag) {
 	const auto tiles = tiles_within_radius();
@@ -89,8 +85,8 @@ void BrushMesh::raise_height(float val, int flag) {
 	if (flag == F_AVERAGE) {
 		float avg = 0.0f;
 		for (auto& t : tiles) {
-			if (t[0] >= 0 && t[1] >= 0 && t[0] < _root->_width && t[1] < _root->_length) {
-				auto tile_heights = _root->_node.get_tile_height(t[0] + t[1] * _root->_width);
+			if (auto page = _root->page_at(t[0], t[1])) {
+				auto tile_heights = page->_node.get_tile_height((t[0] - page->_origin.x) + (t[1] - page->_origin.y) * _root->_width);
 				avg += tile_heights._v0;
 			}
 		}
@@ -118,14 +114,45 @@ void BrushMesh::raise_height(float val, int flag) {
 			_root->recalc_normals(tile[0], tile[1]);
 		}
 	}
+
+	if (tiles.empty()) {
+		return;
+	}
+
+	glm::ivec2 min = { tiles[0][0], tiles[0][1] };
+	glm::ivec2 max = min;
+	for (auto& tile : tiles) {
+		min = glm::min(min, glm::ivec2(tile[0], tile[1]));
+		max = glm::max(max, glm::ivec2(tile[0], tile[1]));
+	}
+
+	// child grids are derived from the root heights, the ones over the edit are rebuilt on the next draw
+	// grids a vertex past the edit read the edited heights as their halo, including those of neighbouring pages
+	const auto rect = glm::vec4(min.x - 1, min.y - 1, max.x + 1, max.y + 1);
+	for (auto page : _root->pages_within(glm::vec2(rect.x, rect.y), glm::vec2(rect.z, rect.w))) {
+		page->_node.release_within(rect);
+	}
+
+	if (_root->_renderer) {
+		_root->_renderer->update_heights(min.x, min.y, max.x - min.x + 1, max.y - min.y + 1);
+	}
 }
 
 void BrushMesh::paint_blend_map(int texture, float weight, int flag) {
-	const int start_x = glm::mix(0, BLEND_MAP_SIZE - 1, (_position.x - _radius) / (float)_root->_width);
-	const int start_z = glm::mix(0, BLEND_MAP_SIZE - 1, (_position.z - _radius) / (float)_root->_length);
+	for (auto page : pages_within_radius()) {
+		paint_blend_map(page, texture, weight, flag);
+	}
+}
+
+void BrushMesh::paint_blend_map(TerrainPage* page, int texture, float weight, int flag) {
+	auto& blend_map = page->_blend_map;
+	const auto position = glm::vec2(_position.x - page->_origin.x, _position.z - page->_origin.y);
 
-	const int position_t_coord_x = glm::mix(0, BLEND_MAP_SIZE - 1, _position.x / (float)_root->_width);
-	const int position_t_coord_z = glm::mix(0, BLEND_MAP_SIZE - 1, _position.z / (float)_root->_length);
+	const int start_x = glm::mix(0, BLEND_MAP_SIZE - 1, (position.x - _radius) / (float)_root->_width);
+	const int start_z = glm::mix(0, BLEND_MAP_SIZE - 1, (position.y - _radius) / (float)_root->_length);
+
+	const int position_t_coord_x = glm::mix(0, BLEND_MAP_SIZE - 1, position.x / (float)_root->_width);
+	const int position_t_coord_z = glm::mix(0, BLEND_MAP_SIZE - 1, position.y / (float)_root->_length);
 	const int radius_t_coord = glm::mix(0, BLEND_MAP_SIZE - 1, _radius / (float)_root->_width);
 
 	glm::vec2 distance;
@@ -160,179 +187,164 @@ void BrushMesh::paint_blend_map(int texture, float weight, int flag) {
 					default:			blend = glm::vec4(0, 0, 0, 0);								break;
 					}
 
-					_root->_blend_map[z][x] += blend;
-
+					blend_map.set(x, z, blend_map.get(x, z) + blend);
 				}
-				if (flag == BLEND_CLEAR) {
-					_root->_blend_map[z][x] = glm::vec4(0, 0, 0, 0);
+				// clearing never allocates, unpainted tiles are already clear
+				if (flag == BLEND_CLEAR && blend_map.tile(BlendMap::tile_index(x, z))) {
+					blend_map.set(x, z, glm::vec4(0, 0, 0, 0));
 				}
-
-				glm::clamp(_root->_blend_map[z][x], 0.0f, 1.0f);
 			}
 		}
 	}
 
-	glBindTexture(GL_TEXTURE_2D, _root->_blend_texture);
-	glPixelStorei(GL_UNPACK_ROW_LENGTH, BLEND_MAP_SIZE);
-	glPixelStorei(GL_UNPACK_SKIP_PIXELS, start_x);
-	glPixelStorei(GL_UNPACK_SKIP_ROWS, start_z);
-	glTexSubImage2D(GL_TEXTURE_2D, 0, start_x, start_z, x - start_x, z - start_z, GL_RGBA, GL_FLOAT, &_root->_blend_map[0][0][0]);
-}
-
-//-----------------------------------------------------------Grass MESH---------------------------------------------------------------------------------------------------------
-
-GrassMesh::GrassMesh(Program* program) :
-	_program ( program )
-{
-	create_buffers();
-}
-
-void GrassMesh::create_buffers() {
-	glCreateBuffers(1, &_vertex_buffer);
-	glBindBuffer(GL_ARRAY_BUFFER, _vertex_buffer);
-	glNamedBufferStorage(_vertex_buffer, sizeof(GLfloat) * TILE_VERTICES_SIZE, TILE_VERTICES, 0);
-	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, (void*)0);
-}
+	// brushes overlapping a page edge only upload the part inside the page
+	const int upload_x = std::max(start_x, 0);
+	const int upload_z = std::max(start_z, 0);
+	const int upload_width = std::min(start_x + 2 * radius_t_coord, BLEND_MAP_SIZE) - upload_x;
+	const int upload_length = std::min(start_z + 2 * radius_t_coord, BLEND_MAP_SIZE) - upload_z;
+	if (upload_width <= 0 || upload_length <= 0) {
+		return;
+	}
 
-void GrassMesh::draw(glm::vec3 position) {
-	glUseProgram(_program->_id);
+	page->mark_blend(upload_x, upload_z, upload_width, upload_length);
 
-	glBindBuffer(GL_ARRAY_BUFFER, _vertex_buffer);
+	if (flag == BLEND_CLEAR) {
+		for (int z = upload_z / BLEND_TILE_SIZE; z <= (upload_z + upload_length - 1) / BLEND_TILE_SIZE; ++z) {
+			for (int x = upload_x / BLEND_TILE_SIZE; x <= (upload_x + upload_width - 1) / BLEND_TILE_SIZE; ++x) {
+				blend_map.trim_tile(x + z * BLEND_TILES);
+			}
+		}
+	}
 
-	glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, TILE_VERTICES_SIZE / 2, 1);
+	if (_root->_renderer) {
+		_root->_renderer->upload_blend_region(page, upload_x, upload_z, upload_width, upload_length);
+	}
 }
 
-//-----------------------------------------------------------TERRAIN MESH---------------------------------------------------------------------------------------------------------
+//-----------------------------------------------------------------TERRAIN FRUSTUM------------------------------------------------------------------------------------------------------
 
-TerrainMesh::TerrainMesh(Program* program) :
-	_program		( program )
+// Planes from the rows of the matrix, left right bottom top near far, pointing inward
+TerrainFrustum::TerrainFrustum(const glm::mat4& view_projection) :
+	_enabled				( true )
 {
-	create_buffers();
-	create_tile_textures();
-}
-
-void TerrainMesh::create_buffers() {
-	glCreateBuffers(1, &_vertex_buffer);
-	glBindBuffer(GL_ARRAY_BUFFER, _vertex_buffer);
-	glNamedBufferStorage(_vertex_buffer, sizeof(GLfloat) * TILE_VERTICES_SIZE, TILE_VERTICES, 0);
-	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, (void*)0);
-
-	glCreateBuffers(1, &_uv_buffer);
-	glBindBuffer(GL_ARRAY_BUFFER, _uv_buffer);
-	glNamedBufferStorage(_uv_buffer, sizeof(GLfloat) * TILE_VERTICES_SIZE, TILE_UVS, 0);
-	glEnableVertexAttribArray(1);
-	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, (void*)0);
-}
-
-void TerrainMesh::create_tile_textures() {
-	const auto create_texture = [](GLuint* texture, int active_texture, const char* file) {
-		glActiveTexture(active_texture);
-
-		*texture = SOIL_load_OGL_texture(file, SOIL_LOAD_AUTO, SOIL_CREATE_NEW_ID, 0);
-		if (*texture == 0) {
-			std::cout << "SOIL FAILED TO LOAD TILE TEXTURE" << '\n';
-		}
-
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-
-		glBindTexture(GL_TEXTURE_2D, *texture);
+	const auto row = [&](int i) {
+		return glm::vec4(view_projection[0][i], view_projection[1][i], view_projection[2][i], view_projection[3][i]);
 	};
 
-	create_texture(&_tile_textures[0], GL_TEXTURE3, "Data\\t1.png");
-	create_texture(&_tile_textures[1], GL_TEXTURE4, "Data\\t2.png");
-	create_texture(&_tile_textures[2], GL_TEXTURE5, "Data\\t3.png");
-	create_texture(&_tile_textures[3], GL_TEXTURE6, "Data\\t4.png");
+	for (int i = 0; i < 3; ++i) {
+		_planes[i * 2] = row(3) + row(i);
+		_planes[i * 2 + 1] = row(3) - row(i);
+	}
 }
 
-void TerrainMesh::draw(TerrainNode* node) {
-	glUseProgram(_program->_id);
-
-	glBindBuffer(GL_ARRAY_BUFFER, _vertex_buffer);
-	glBindBuffer(GL_ARRAY_BUFFER, _uv_buffer);
-
-	glUniform1i(glGetUniformLocation(_program->_id, "width"), node->_root->_width);
-	glUniform1i(glGetUniformLocation(_program->_id, "length"), node->_root->_length);
-	glUniform1f(glGetUniformLocation(_program->_id, "space"), node->_space);
-	glUniform4f(glGetUniformLocation(_program->_id, "quad"), node->_quad.x, node->_quad.y, node->_quad.z, node->_quad.w);
-	glUniformMatrix4fv(glGetUniformLocation(_program->_id, "model"), 1, GL_FALSE, &node->_root->_transform.get_model()[0][0]);
-
-	glUniform3fv(glGetUniformLocation(_program->_id, "test_light_position"), 1, &node->_root->_brush_mesh->_position[0]);
-
-	glBindBuffer(GL_ARRAY_BUFFER, _height_buffer);
-	glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(GLfloat) * node->_heights.size(), &node->_heights[0]);
+// A box is outside when its corner furthest along a plane's normal is behind it
+bool TerrainFrustum::contains(glm::vec3 min, glm::vec3 max) const {
+	if (!_enabled) {
+		return true;
+	}
 
-	glBindBuffer(GL_ARRAY_BUFFER, _normal_buffer);
-	glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(glm::vec3) * node->_normals.size(), &node->_normals[0]);
+	for (const auto& plane : _planes) {
+		const auto corner = glm::vec3(plane.x >= 0.0f ? max.x : min.x, plane.y >= 0.0f ? max.y : min.y, plane.z >= 0.0f ? max.z : min.z);
+		if (glm::dot(glm::vec3(plane), corner) + plane.w < 0.0f) {
+			return false;
+		}
+	}
 
-	glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, TILE_VERTICES_SIZE / 2, node->_root->_width * node->_root->_length);
+	return true;
 }
 
 //-----------------------------------------------------------------TERRAIN Node---------------------------------------------------------------------------------------------------------
 
-TerrainNode::TerrainNode(Terrain* root, TerrainNode* parent, float space, glm::vec4 quad) :
+TerrainNode::TerrainNode(Terrain* root, TerrainNode* parent, float space, glm::vec4 quad, int index) :
 	_root					( root ),
 	_parent					( parent ),
+	_index					( index ),
 	_space					( space ),
-	_quad					( quad )
+	_quad					( quad ),
+	_last_used				( 0 ),
+	_version				( ++grid_versions ),
+	_stale					( false )
 {}
 
-void TerrainNode::subdivide(glm::vec2 position, int depth) {
-	if(depth == _root->_depth) {
-		return;
+// Returns false when the node is outside its level's range, its parent draws its quarter instead
+// nodes within half the range are refined, that half is the range of the children's level
+// Nodes outside the frustum return true with nothing drawn, their parent must not draw their quarter either
+bool TerrainNode::select(TerrainPage* page, glm::vec2 camera, const TerrainFrustum& frustum, int depth, std::vector<TerrainDrawNode>* nodes) {
+	const float range = _root->lod_range(this);
+	const float distance = this->distance(camera);
+	if (_parent && distance > range) {
+		return false;
 	}
 
-	if (!has_children()) {
-		create_children();
+	const auto bounds = this->bounds();
+	if (!frustum.contains(glm::vec3(_quad.x, bounds.x, _quad.y), glm::vec3(_quad.x + _quad.z, bounds.y, _quad.y + _quad.w))) {
+		++_root->_node_stats._culled;
+		return true;
 	}
 
-	for (auto& child : _children) {
-		if (child->within_range(position)) {
-			child->subdivide(position, depth + 1);
-		}
+	auto draw = TerrainDrawNode{ page, this, 0, glm::vec2(std::numeric_limits<float>::max()), 0 };
+	if (_parent) {
+		draw._morph = glm::vec2(range * glm::clamp(_root->_page_settings._lod_morph, 0.55f, 0.95f), range);
+		draw._edges = coarser_edges(camera, range);
 	}
-}
 
-void TerrainNode::subdivide(int depth) {
-	if (depth == _root->_depth) {
-		return;
+	if (depth == _root->_depth || distance > range * 0.5f) {
+		draw._quadrants = 0xF;
+		nodes->push_back(draw);
+		return true;
 	}
 
 	if (!has_children()) {
 		create_children();
 	}
 
-	for (auto& child : _children) {
-		child->subdivide(depth + 1);
+	for (size_t i = 0; i < _children.size(); ++i) {
+		if (!_children[i]->select(page, camera, frustum, depth + 1, nodes)) {
+			draw._quadrants |= 1 << i;
+		}
 	}
-}
 
-void TerrainNode::draw(glm::vec2 position, int depth) {
-	if(depth == _root->_depth || !has_children()) {
-		_root->_mesh->draw(this);
-		return;
+	if (draw._quadrants) {
+		nodes->push_back(draw);
 	}
 
-	for(auto& child : _children) {
-		if (child->within_range(position)) {
-			child->draw(position, depth + 1);
+	return true;
+}
+
+// The node of the same size across each edge is selected when it is within range, its ancestors are closer so they were refined
+// across a page edge it also needs the page to be ready, outside the world there is nothing to meet
+int TerrainNode::coarser_edges(glm::vec2 camera, float range) const {
+	const glm::vec2 offsets[4] = { { -_quad.z, 0.0f }, { _quad.z, 0.0f }, { 0.0f, -_quad.w }, { 0.0f, _quad.w } };
+	const auto world = glm::vec2(_root->_world.x * _root->_width, _root->_world.y * _root->_length);
+
+	int edges = 0;
+	for (int i = 0; i < 4; ++i) {
+		const auto quad = glm::vec4(glm::vec2(_quad) + offsets[i], _quad.z, _quad.w);
+		if (quad.x < 0.0f || quad.y < 0.0f || quad.x >= world.x || quad.y >= world.y) {
+			continue;
 		}
-		else {
-			_root->_mesh->draw(child.get());
+
+		const auto coord = glm::ivec2(static_cast<int>(quad.x) / _root->_width, static_cast<int>(quad.y) / _root->_length);
+		const auto page = _root->find_page(coord);
+		if (!page || page->_stage != PAGE_READY || distance(camera, quad) > range) {
+			edges |= 1 << i;
 		}
 	}
+
+	return edges;
 }
 
-void TerrainNode::draw(int depth) {
-	if (depth == _root->_depth || !has_children()) {
-		_root->_mesh->draw(this);
+void TerrainNode::subdivide(int depth) {
+	if (depth == _root->_depth) {
 		return;
 	}
 
+	if (!has_children()) {
+		create_children();
+	}
+
 	for (auto& child : _children) {
-		child->draw(depth + 1);
+		child->subdivide(depth + 1);
 	}
 }
 
@@ -355,12 +367,121 @@ void TerrainNode::create_children() {
 
 	for (size_t i = 0; i < 4; ++i) {
 		_children[i] = std::make_unique<TerrainNode>(
-			_root, this, _space / 2.0f, quads[i]
+			_root, this, _space / 2.0f, quads[i], static_cast<int>(i)
 		);
+	}
+}
+
+// Builds this node's grid from its parent's quadrant, the parent is rebuilt first if it was released
+void TerrainNode::materialize() {
+	if (resident() || !_parent) {
+		return;
+	}
+
+	_parent->materialize();
+
+	generate_heights(_root->_sub_indices[_index]);
+	generate_normals();
+	_stale = false;
+}
+
+// Materializes a set of nodes across the worker pool
+// ancestors that were released are rebuilt first, one depth at a time so siblings never rebuild the same parent
+void materialize_nodes(const std::vector<TerrainNode*>& nodes) {
+	std::vector<std::vector<TerrainNode*>> depths;
+	std::unordered_set<TerrainNode*> queued;
+
+	for (auto node : nodes) {
+		for (auto current = node; current->_parent && !current->resident() && queued.insert(current).second; current = current->_parent) {
+			size_t depth = 0;
+			for (auto parent = current->_parent; parent; parent = parent->_parent) {
+				++depth;
+			}
+
+			if (depths.size() < depth) {
+				depths.resize(depth);
+			}
+			depths[depth - 1].push_back(current);
+		}
+	}
+
+	for (auto& level : depths) {
+		parallel_for(level.size(), [&](size_t i) {
+			level[i]->materialize();
+		});
+	}
+}
+
+// The root node owns the shared heightfield and is never released
+void TerrainNode::release() {
+	if (!_parent) {
+		return;
+	}
+
+	TerrainHeights().swap(_heights);
+	TerrainNormals().swap(_normals);
+	TerrainFaceNormals().swap(_face_normals);
+	_stale = false;
+	changed();
+}
+
+void TerrainNode::release_children() {
+	if (!has_children()) {
+		return;
+	}
+
+	for (auto& child : _children) {
+		child->release_children();
+		child->release();
+	}
+}
+
+// Releases the children whose grid or halo touches rect, min x, min z, max x, max z in world vertices
+void TerrainNode::release_within(glm::vec4 rect) {
+	if (!has_children()) {
+		return;
+	}
+
+	for (auto& child : _children) {
+		const auto& quad = child->_quad;
+		const float halo = child->_space;
+		if (quad.x - halo > rect.z || quad.y - halo > rect.w || quad.x + quad.z + halo < rect.x || quad.y + quad.w + halo < rect.y) {
+			continue;
+		}
+
+		child->release_within(rect);
+
+		const bool stale = child->_stale || child->resident();
+		child->release();
+		child->_stale = stale;
+	}
+}
+
+bool TerrainNode::resident() const {
+	return !_heights.empty();
+}
+
+void TerrainNode::changed() {
+	_version = ++grid_versions;
+}
+
+size_t TerrainNode::grid_bytes() const {
+	return _pyramid.bytes()
+		 + sizeof(float) * _heights.capacity()
+		 + sizeof(glm::vec3) * _normals.capacity()
+		 + sizeof(std::array<glm::vec3, 2>) * _face_normals.capacity();
+}
+
+size_t TerrainNode::resident_bytes() const {
+	size_t bytes = grid_bytes();
 
-		_children[i]->generate_heights(_root->_sub_indices[i]);
-		_children[i]->generate_normals();
+	if (_children[0]) {
+		for (const auto& child : _children) {
+			bytes += child->resident_bytes();
+		}
 	}
+
+	return bytes;
 }
 
 TerrainTile TerrainNode::get_tile(size_t index) const {
@@ -398,91 +519,12 @@ TerrainTile::Height TerrainNode::get_tile_height(size_t index) const {
 	return height;
 }
 
+// 2x upsampling of the parent quadrant starting at vertex index, see TerrainKernels
 void TerrainNode::generate_heights(int index) {
-	_heights.clear();
-	_heights.resize(_parent->_heights.size());
-
-	auto valid = [&](const size_t& i) {
-		if(i < 0 || i > _parent->_heights.size() - 1) {
-			return false;
-		}
-		return true;
-	};
-			
-	auto avg = [&](const size_t& i , const size_t& i2) {
-		std::vector<size_t> indices = { i, i2};
-		int divisor = 0;
-		GLfloat value = 0.0f;
-		for (const auto& i : indices) {
-			if (valid(i)) {
-				value += _parent->_heights.at(i);
-				++divisor;
-			}
-		}
-			
-		return value / (GLfloat)divisor;
-	};
-			
-	auto avg2 = [&](const int& i, const int& i2, const int& i3, const int& i4) {
-		std::vector<int> indices = {i, i2, i3, i4};
-		int divisor = 0;
-		GLfloat value = 0.0f;
-		for(const auto& i : indices) {
-			if (valid(i)) {
-				value += _parent->_heights.at(i);
-				++divisor;
-			}
-		}
-			
-		return value / (GLfloat)divisor;
-	};
+	assert(_parent && _parent->resident());
 
-	size_t in_i = index;
-	size_t out_i = 0;
-	int count = 0;
-		
-	bool even = true;
-	while (out_i < (_heights.size())) {
-		if (even) {
-			_heights.at(out_i) = _parent->_heights.at(in_i);
-			++count;
-		
-			while (count < _root->_width) {
-				++out_i;
-				++in_i;
-				_heights.at(out_i) = avg(in_i - 1, in_i);
-				++count;
-		
-				++out_i;
-				_heights.at(out_i) = _parent->_heights.at(in_i);
-				++count;
-			}
-		
-			++in_i;
-			in_i += _root->_width / 2;
-		}
-		else {
-			_heights.at(out_i) = avg(in_i - _root->_width - 1, in_i);
-			++count;
-		
-			while (count < _root->_width) {
-				++out_i;
-				++in_i;
-				_heights.at(out_i) = avg2(in_i, in_i - _root->_width - 1, in_i - 1, in_i - _root->_width - 2);
-				++count;
-		
-				++out_i;
-				_heights.at(out_i) = avg(in_i - _root->_width - 1, in_i);
-				++count;
-			}
-		
-			in_i -= _root->_width / 2;
-		}
-		
-		++out_i;
-		count = 0;
-		even = !even;
-	}
+	_heights.resize(_parent->_heights.size());
+	upsample_heights(_parent->_heights.data(), index, _root->_width, _root->_length, _heights.data());
 }
 
 std::array<glm::vec3, 2> TerrainNode::calc_face_normal(int index) const {
@@ -502,91 +544,180 @@ std::array<glm::vec3, 2> TerrainNode::calc_face_normal(int index) const {
 }
 
 glm::vec3 TerrainNode::get_face_normal(int index, int triangle) const {
-	if(index < 0 || index >= _face_normals.size() || triangle < 0 || triangle > 1) {
+	if(index < 0 || static_cast<size_t>(index) >= _face_normals.size() || triangle < 0 || triangle > 1) {
 		return glm::vec3(0, 0, 0);
 	}
 	return _face_normals[index][triangle];
 }
 
-// Need to re calculate edge normals between child nodes
-void TerrainNode::generate_normals() {
-	_face_normals.clear();
-	_face_normals.resize(_root->_width * _root->_length);
+// Vertex normals come straight from the heights, see TerrainKernels
+// the grid is copied with a one vertex halo so border vertices get the triangles of the node next to them
+// rows are split into bands across the worker pool, each band reads the face row above it again as its halo
+// face normals are only kept when the page settings ask for them
+// the loader generates normals off the render thread and passes false, its pages are stitched once they are installed
+void TerrainNode::generate_normals(bool neighbours) {
+	const int width = _root->_width;
+	const int length = _root->_length;
+	const int rows = std::max(NORMAL_BAND_VERTICES / (width + 1), 1);
+	const int bands = (length + rows) / rows;
+
+	// the spare grid is taken for the call, a node generated by a pool job while this one waits allocates its own
+	thread_local std::vector<float> spare;
+	std::vector<float> halo;
+	halo.swap(spare);
+
+	const size_t padded = static_cast<size_t>(width) + 3;
+	halo.resize(padded * (static_cast<size_t>(length) + 3));
+	for (int z = 0; z <= length; ++z) {
+		std::copy_n(_heights.data() + z * (width + 1), width + 1, halo.data() + (z + 1) * padded + 1);
+		halo[(z + 1) * padded] = halo_height(-1, z, neighbours);
+		halo[(z + 1) * padded + width + 2] = halo_height(width + 1, z, neighbours);
+	}
+	for (int x = -1; x <= width + 1; ++x) {
+		halo[x + 1] = halo_height(x, -1, neighbours);
+		halo[x + 1 + (length + 2) * padded] = halo_height(x, length + 1, neighbours);
+	}
+
+	_normals.resize((width + 1) * (length + 1));
+
+	if (!_root->_page_settings._face_normals) {
+		TerrainFaceNormals().swap(_face_normals);
+	}
+	else {
+		_face_normals.resize(width * length);
+	}
+
+	parallel_for(bands, [&](size_t band) {
+		const int begin = static_cast<int>(band) * rows;
+		const int end = std::min(begin + rows, length + 1);
+		generate_padded_normals(halo.data(), width, length, begin, end, _normals.data());
+
+		for (int i = begin * width; i < std::min(end, length) * width && !_face_normals.empty(); ++i) {
+			_face_normals[i] = calc_face_normal(i);
+		}
+	});
+
+	spare.swap(halo);
+	changed();
+}
+
+// Border vertices only, for when a neighbouring page arrives or changes
+void TerrainNode::generate_border_normals() {
+	const int width = _root->_width;
+	const int length = _root->_length;
+
+	for (int x = 0; x <= width; ++x) {
+		_normals[x] = vertex_normal(x, 0);
+		_normals[x + length * (width + 1)] = vertex_normal(x, length);
+	}
+	for (int z = 1; z < length; ++z) {
+		_normals[z * (width + 1)] = vertex_normal(0, z);
+		_normals[width + z * (width + 1)] = vertex_normal(width, z);
+	}
+	changed();
+}
+
+// Child grids are upsampled from the page's root grid, which is its bilinear interpolation, so the halo of any node
+// is a bilinear sample of the root grid holding it, the clamp keeps the halo flat where there is no neighbour
+float TerrainNode::halo_height(int x, int z, bool neighbours) const {
+	const int width = _root->_width;
+	const int length = _root->_length;
+	if (x >= 0 && z >= 0 && x <= width && z <= length) {
+		return _heights[x + z * (width + 1)];
+	}
 
-	for (size_t i = 0; i < _face_normals.size(); ++i) {
-		_face_normals[i] = calc_face_normal(i);
+	auto source = this;
+	while (source->_parent) {
+		source = source->_parent;
 	}
 
-	_normals.resize((_root->_width + 1) * (_root->_length + 1));
-	size_t n_index = 0;
-	for (size_t i = 0; i < _face_normals.size(); ++i) {
-		if (i != 0 && (i + 1) % _root->_width == 0) {
-			// right edge
-			_normals[n_index++] = generate_normal(i, 0);
-			_normals[n_index++] = generate_normal(i, 1);
+	auto position = glm::vec2(_quad.x + x * _space, _quad.y + z * _space);
+	const auto origin = glm::vec2(source->_quad.x, source->_quad.y);
+
+	// the world's edges are extended flat, vertices on its far edge belong to the last page, see read_heights
+	if (neighbours) {
+		const auto world = glm::ivec2(_root->_world.x * width, _root->_world.y * length);
+		position = glm::clamp(position, glm::vec2(0.0f), glm::vec2(world));
+
+		const bool outside = glm::any(glm::lessThan(position, origin)) || glm::any(glm::greaterThan(position, origin + glm::vec2(width, length)));
+		const auto coord = glm::min(glm::ivec2(position) / glm::ivec2(width, length), _root->_world - 1);
+		const auto page = outside ? _root->find_page(coord) : nullptr;
+		if (page && page->_node.resident()) {
+			source = &page->_node;
 		}
-		else if (i % _root->_width == 0) {
-			// left edge
-			_normals[n_index++] = generate_normal(i, 2);
+	}
+
+	const auto local = glm::clamp(position - glm::vec2(source->_quad.x, source->_quad.y), glm::vec2(0.0f), glm::vec2(width, length));
+	const int tile_x = std::min(static_cast<int>(local.x), width - 1);
+	const int tile_z = std::min(static_cast<int>(local.y), length - 1);
+	const auto tile = source->get_tile_height(tile_x + tile_z * width);
+	const float dx = local.x - tile_x;
+	const float dz = local.y - tile_z;
+
+	return glm::mix(glm::mix(tile._v0, tile._v1, dx), glm::mix(tile._v2, tile._v3, dx), dz);
+}
+
+// The same sums as generate_normals for one vertex, from the 3x3 heights around it
+glm::vec3 TerrainNode::vertex_normal(int x, int z) const {
+	float heights[9];
+	for (int j = 0; j < 3; ++j) {
+		for (int i = 0; i < 3; ++i) {
+			heights[i + j * 3] = halo_height(x + i - 1, z + j - 1);
 		}
-		else {
-			_normals[n_index++] = generate_normal(i, 0);
-		}
-	}
-}
-
-// edges: 0 -> non edge, 1 -> right edge -> 2 left edge
-// |---------| <--- right edge
-// |---------|
-// |---------|
-// ^ 
-// +----- left edge
-glm::vec3 TerrainNode::generate_normal(int index, int edge) const {
-	auto normal = glm::vec3(0, 0, 0);
-
-	switch (edge) {
-	case 0:
-		normal += get_face_normal(index, 0);
-		normal += get_face_normal(index - _root->_width, 0);
-		normal += get_face_normal(index - _root->_width, 1);
-		normal += get_face_normal(index - _root->_width - 1, 1);
-		normal += get_face_normal(index - 1, 0);
-		normal += get_face_normal(index - 1, 1);
-		break;
-	case 1:
-		normal += get_face_normal(index, 0);
-		normal += get_face_normal(index, 1);
-		normal += get_face_normal(index - _root->_width, 1);
-		break;
-	case 2:
-		normal += get_face_normal(index, 0);
-		normal += get_face_normal(index - _root->_width, 0);
-		normal += get_face_normal(index - _root->_width, 1);
-		break;
 	}
 
-	return normal;
+	return ::vertex_normal(heights, 2, 2, 1, 1);
 }
 
 bool TerrainNode::has_children() {
 	const bool r = _children[0] != nullptr;
+#ifndef NDEBUG
 	for(const auto& child : _children) {
 		assert((child != nullptr) == r);
 	}
+#endif
 
 	return r;
 }
 
-bool TerrainNode::within_range(glm::vec2 p) {
-	glm::vec4 q = { _quad.x * _root->_transform.get_scale().x, _quad.y * _root->_transform.get_scale().z,
-					_quad.z * _root->_transform.get_scale().x, _quad.w * _root->_transform.get_scale().z
-	};
+// The root grid tiles under the node's square
+glm::vec2 TerrainNode::bounds() {
+	auto root = this;
+	while (root->_parent) {
+		root = root->_parent;
+	}
+
+	const int min_x = static_cast<int>(floor(_quad.x - root->_quad.x));
+	const int min_z = static_cast<int>(floor(_quad.y - root->_quad.y));
+	const int max_x = static_cast<int>(ceil(_quad.x + _quad.z - root->_quad.x));
+	const int max_z = static_cast<int>(ceil(_quad.y + _quad.w - root->_quad.y));
 
-	return !(p.x < q.x - q.z || p.x > q.x + q.z + q.z
-		  || p.y < q.y - q.w || p.y > q.y + q.w + q.w);
+	return root->pyramid().bounds(min_x, min_z, max_x, max_z);
 }
 
-TerrainNode* TerrainNode::find_node(float* x, float *z) {
+// Pages that didn't come through load_pages or the loader build theirs on first use
+TerrainPyramid& TerrainNode::pyramid() {
+	if (_pyramid.empty() && !_parent && !_heights.empty()) {
+		_pyramid.build(_heights.data(), _root->_width, _root->_length);
+	}
+
+	return _pyramid;
+}
+
+// World distance on the ground from p to the node's square, or a square of world vertices
+float TerrainNode::distance(glm::vec2 p) const {
+	return distance(p, _quad);
+}
+
+float TerrainNode::distance(glm::vec2 p, glm::vec4 quad) const {
+	const auto scale = _root->_transform.get_scale();
+	const auto min = glm::vec2(quad.x * scale.x, quad.y * scale.z);
+	const auto max = min + glm::vec2(quad.z * scale.x, quad.w * scale.z);
+
+	return glm::length(p - glm::clamp(p, min, max));
+}
+
+TerrainNode* TerrainNode::find_node(float* /*x*/, float* /*z*/) {
 	return nullptr;
 }
 
@@ -622,232 +753,1030 @@ TerrainNode* TerrainNode::find_node(float* x, float *z) {
 //	return nullptr;
 //}
 
-//-----------------------------------------------------------------TERRAIN--------------------------------------------------------------------------------------------------------------
+//-----------------------------------------------------------------TERRAIN PAGE---------------------------------------------------------------------------------------------------------
 
-Terrain::Terrain(int width, int length, int depth, GLuint vao, TerrainShaders shaders) :
-	_mesh					( std::make_unique<TerrainMesh>(shaders._terrain) ),
-	_brush_mesh				( std::make_unique<BrushMesh>(shaders._brush, this) ),
-	_width					( width ),
-	_length					( length ),
-	_depth					( depth ),
-	_vao					( vao ),
-	_node					( this, nullptr, 1.0f, glm::vec4(0, 0, width, length) ),
-	_sub_indices			( {0, _width / 2, (_width * _length) / 2 + (_length / 2), (_width * _length / 2) + (_length / 2) + (_width / 2) } )
-{
-	assert(width >= 0 && length >= 0);
-	assert(float(width) / 2.0 == width / 2);
+uint64_t page_key(glm::ivec2 coord) {
+	return (static_cast<uint64_t>(static_cast<uint32_t>(coord.x)) << 32) | static_cast<uint32_t>(coord.y);
 }
 
-void Terrain::create_height_buffer() {
-	glCreateBuffers(1, &_mesh->_height_buffer);
-	glBindBuffer(GL_ARRAY_BUFFER, _mesh->_height_buffer);
-	glNamedBufferStorage(_mesh->_height_buffer, sizeof(GLfloat) * _node._heights.size(), &_node._heights[0], GL_DYNAMIC_STORAGE_BIT);
-
-	glCreateTextures(GL_TEXTURE_BUFFER, 1, &_mesh->_height_texture);
-	glTextureBuffer(_mesh->_height_texture, GL_R32F, _mesh->_height_buffer);
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_BUFFER, _mesh->_height_texture);
+TerrainPage::TerrainPage(Terrain* root, glm::ivec2 coord) :
+	_coord					( coord ),
+	_origin					( coord.x * root->_width, coord.y * root->_length ),
+	_node					( root, nullptr, 1.0f, glm::vec4(_origin.x, _origin.y, root->_width, root->_length) ),
+	_blend_map				( root->_page_settings._blend_format ),
+	_dirty					( false ),
+	_dirty_heights			( ),
+	_dirty_tiles			( ),
+	_last_used				( 0 ),
+	_snapshot				( nullptr ),
+	_saving					( false ),
+	_stage					( PAGE_READY ),
+	_load_id				( 0 )
+{
+	clear_dirty();
 }
 
-void Terrain::create_normal_buffer() {
-	glCreateBuffers(1, &_mesh->_normal_buffer);
-	glBindBuffer(GL_ARRAY_BUFFER, _mesh->_normal_buffer);
-	glNamedBufferStorage(_mesh->_normal_buffer, sizeof(glm::vec3) * _node._normals.size(), &_node._normals[0], GL_DYNAMIC_STORAGE_BIT);
-
-	glCreateTextures(GL_TEXTURE_BUFFER, 1, &_mesh->_normal_texture);
-	glTextureBuffer(_mesh->_normal_texture, GL_RGB32F, _mesh->_normal_buffer);
-	glActiveTexture(GL_TEXTURE1);
-	glBindTexture(GL_TEXTURE_BUFFER, _mesh->_normal_texture);
+size_t TerrainPage::resident_bytes() const {
+	return _node.resident_bytes() + _blend_map.resident_bytes();
 }
 
-void Terrain::create_blend_texture() {
-	glGenTextures(1, &_blend_texture);
-	glActiveTexture(GL_TEXTURE2);
-	glBindTexture(GL_TEXTURE_2D, _blend_texture);
-
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+void TerrainPage::mark_heights(int x, int z) {
+	_dirty_heights = glm::ivec4(std::min(_dirty_heights.x, x), std::min(_dirty_heights.y, z), std::max(_dirty_heights.z, x), std::max(_dirty_heights.w, z));
+	_dirty = true;
+}
 
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, BLEND_MAP_SIZE, BLEND_MAP_SIZE, 0, GL_RGBA, GL_FLOAT, &_blend_map[0][0][0]);
-	glGenerateMipmap(GL_TEXTURE_2D);
+void TerrainPage::mark_blend(int x, int z, int width, int length) {
+	for (int tile_z = z / BLEND_TILE_SIZE; tile_z <= (z + length - 1) / BLEND_TILE_SIZE; ++tile_z) {
+		for (int tile_x = x / BLEND_TILE_SIZE; tile_x <= (x + width - 1) / BLEND_TILE_SIZE; ++tile_x) {
+			_dirty_tiles.set(tile_x + tile_z * BLEND_TILES);
+		}
+	}
+	_dirty = true;
 }
 
-void Terrain::update(glm::vec3 camera_position) {
-	_node.subdivide(glm::vec2(camera_position.x, camera_position.z));
+bool TerrainPage::heights_dirty() const {
+	return _dirty_heights.x <= _dirty_heights.z;
 }
 
-void Terrain::draw(glm::vec3 camera_position) {
-	_node.draw(glm::vec2(camera_position.x, camera_position.z));
+void TerrainPage::clear_dirty() {
+	_dirty = false;
+	_dirty_heights = glm::ivec4(std::numeric_limits<int>::max(), std::numeric_limits<int>::max(), -1, -1);
+	_dirty_tiles.reset();
 }
 
-Transform& Terrain::get_transform() {
-	return _transform;
+//-----------------------------------------------------------------TERRAIN--------------------------------------------------------------------------------------------------------------
+
+// Headless until a renderer is attached
+Terrain::Terrain(int width, int length, int depth, TerrainPageSettings page_settings) :
+	_width					( width ),
+	_length					( length ),
+	_depth					( depth ),
+	_sub_indices			( {0, _width / 2, (_width * _length) / 2 + (_length / 2), (_width * _length / 2) + (_length / 2) + (_width / 2) } ),
+	_world					( 1, 1 ),
+	_page_settings			( page_settings ),
+	_frame					( 0 ),
+	_pending_format			( TERRAIN_FORMAT_RAW ),
+	_evict_failed			( false ),
+	_loader					( std::make_unique<TerrainLoader>(this) ),
+	_brush_mesh				( std::make_unique<BrushMesh>(this) )
+{
+	assert(width >= 0 && length >= 0);
+	assert(float(width) / 2.0 == width / 2);
 }
 
-void Terrain::raise_height(int x, int z, float val, int flag) {
-	int index = x + z * _width;
-	int v_index = x + z * _width + z;
+Terrain::~Terrain() {
+	wait_save();
+	_loader.reset();
+	clear_pages();
+}
 
-	if (index >= (_width * _length) && index <= (_width * _length) + _width) {
-		index -= index % (_width * _length) + 1;
+// Resident pages move over to the new renderer, nullptr runs the terrain headless
+void Terrain::set_renderer(std::unique_ptr<TerrainRenderer> renderer) {
+	for (auto& page : _pages) {
+		if (_renderer) {
+			_renderer->release_page(page.second.get());
+		}
 	}
 
-	if (x < 0 || z < 0 || x > _width || v_index >= _node._heights.size()) {
+	_renderer = std::move(renderer);
+	if (!_renderer) {
 		return;
 	}
 
-	switch(flag) {
-	case F_RAISE:
-		_node._heights[v_index] += val;
-		break;
-	case F_SET_CURRENT:
-	case F_SET:
-	case F_AVERAGE:
-		_node._heights[v_index] = val;
-		break;
-	default:
-		break;
+	_renderer->resize(_width, _length);
+	for (auto& page : _pages) {
+		_renderer->create_page(page.second.get());
 	}
 }
 
-void Terrain::recalc_normals(int x, int z) {
-	int index = x + z * _width;
-	int v_index = x + z * _width + z;
+// Requests the pages around the camera and evicts the least recently used pages once over budget
+// Pages are drawn as soon as their heights arrive and refined once their normals have followed, see select_nodes
+void Terrain::update(glm::vec3 camera_position) {
+	++_frame;
 
-	if (index >= (_width * _length) && index <= (_width * _length) + _width) {
-		index -= index % (_width * _length) + 1;
+	if (_save && _save->done()) {
+		finish_save();
 	}
 
-	if (x < 0 || z < 0 || x > _width || v_index >= _node._heights.size()) {
-		return;
+	const auto scale = _transform.get_scale();
+	const auto center = glm::ivec2(
+		static_cast<int>(floor(camera_position.x / scale.x / _width)),
+		static_cast<int>(floor(camera_position.z / scale.z / _length))
+	);
+
+	const auto radius = _page_settings._radius;
+	std::vector<glm::ivec2> coords;
+	for (int z = std::max(center.y - radius, 0); z <= std::min(center.y + radius, _world.y - 1); ++z) {
+		for (int x = std::max(center.x - radius, 0); x <= std::min(center.x + radius, _world.x - 1); ++x) {
+			coords.push_back(glm::ivec2(x, z));
+		}
 	}
 
-	_node._face_normals[index] = _node.calc_face_normal(index);
-	if (index - 1 > 0) {
-		_node._face_normals[index - 1] = _node.calc_face_normal(index - 1);
-	}
-	if (index - _width > 0) {
-		_node._face_normals[index - _width] = _node.calc_face_normal(index - _width);
-	}
-	if (index - _width - 1 > 0) {
-		_node._face_normals[index - _width - 1] = _node.calc_face_normal(index - _width - 1);
+	std::vector<glm::ivec2> missing;
+	for (const auto& coord : coords) {
+		if (!find_page(coord)) {
+			missing.push_back(coord);
+		}
 	}
 
-	if (index != 0 && (index + 1) % _width == 0) {
-		_node._normals[v_index] = _node.generate_normal(index, 1);
+	if (!missing.empty()) {
+		_loader->request(missing);
 	}
-	else if (index % _width == 0) {
-		_node._normals[v_index] = _node.generate_normal(index, 2);
-	}
-	else {
-		_node._normals[v_index] = _node.generate_normal(index, 0);
-	}
-}
 
-float Terrain::find_height(glm::vec3 position, glm::vec3 offset) {
-	float height = offset.y;
-
-	while(above_terrain(position, offset, height) && height > 0) {
-		height -= 1.0f;
-	}
+	receive_pages();
 
-	height += 1.0f;
-	while (above_terrain(position, offset, height) && height > 0) {
-		height -= 0.01f;
+	for (const auto& coord : coords) {
+		if (auto page = find_page(coord)) {
+			page->_last_used = _frame;
+		}
 	}
 
-	if (height < 0.0f) height = 0.0f;
-
-	return height;
+	evict_pages();
 }
 
-bool Terrain::above_terrain(glm::vec3 position, glm::vec3 offset, float height) {
-	const float y = abs((offset.y - height) / position.y);
-	const float x = (y * position.x + offset.x) / _transform.get_scale().x;
-	const float z = (y * position.z + offset.z) / _transform.get_scale().z;
+Transform& Terrain::get_transform() {
+	return _transform;
+}
 
-	if(height > exact_height(x, z)) {
-		return true;
+TerrainPage* Terrain::find_page(glm::ivec2 coord) {
+	const auto page = _pages.find(page_key(coord));
+	if (page == _pages.end()) {
+		return nullptr;
 	}
 
-	return false;
+	return page->second.get();
 }
 
-float Terrain::exact_height(float x, float z) {
-	//auto node = _node.find_node(&x, &z);
-	auto node = &_node;
+TerrainPage* Terrain::page_at(int x, int z) {
+	if (x < 0 || z < 0) {
+		return nullptr;
+	}
 
+	return find_page(glm::ivec2(x / _width, z / _length));
+}
+
+// The cached page is tested with a range check and corners are read straight from the vertex rows, batches then skip the divisions and floor
+bool Terrain::tile_at(float x, float z, TerrainPage*& page, float* dx, float* dz, TerrainTile::Height* tile) {
 	int x_index = static_cast<int>(x);
 	int z_index = static_cast<int>(z);
 	if (x_index < 0 || z_index < 0) {
+		return false;
+	}
+
+	if (!page || x_index < page->_origin.x || x_index >= page->_origin.x + _width || z_index < page->_origin.y || z_index >= page->_origin.y + _length) {
+		page = find_page(glm::ivec2(x_index / _width, z_index / _length));
+		if (!page) {
+			return false;
+		}
+	}
+
+	x -= page->_origin.x;
+	z -= page->_origin.y;
+	x_index -= page->_origin.x;
+	z_index -= page->_origin.y;
+
+	const size_t row = static_cast<size_t>(_width) + 1;
+	const float* heights = page->_node._heights.data() + x_index + z_index * row;
+	*tile = { heights[0], heights[1], heights[row], heights[row + 1] };
+
+	// x - origin is exact so the index is the floor of x, except for points just below 0 which truncate up to it
+	*dx = x - (x < 0.0f ? floor(x) : static_cast<float>(x_index));
+	*dz = z - (z < 0.0f ? floor(z) : static_cast<float>(z_index));
+	return true;
+}
+
+// Vertices on the far edge of the world belong to the last page
+void Terrain::read_heights(int x, int z, int step, int width, int length, float* out) {
+	const auto page_coord = [](int v, int size, int pages) {
+		return v == size * pages ? pages - 1 : (v < 0 ? -1 : v / size);
+	};
+
+	for (int j = 0; j < length; ++j) {
+		const int vertex_z = z + j * step;
+		const int page_z = page_coord(vertex_z, _length, _world.y);
+
+		TerrainPage* page = nullptr;
+		int page_x = -1;
+		for (int i = 0; i < width; ++i) {
+			const int vertex_x = x + i * step;
+			const int next_x = page_coord(vertex_x, _width, _world.x);
+			if (next_x != page_x || !page) {
+				page_x = next_x;
+				page = (page_x < 0 || page_z < 0) ? nullptr : find_page(glm::ivec2(page_x, page_z));
+			}
+
+			const size_t index = (vertex_x - page_x * _width) + (vertex_z - page_z * _length) * (_width + 1);
+			out[i + j * width] = (page && index < page->_node._heights.size()) ? page->_node._heights[index] : 0.0f;
+		}
+	}
+}
+
+std::vector<TerrainPage*> Terrain::pages_within(glm::vec2 min, glm::vec2 max) {
+	std::vector<TerrainPage*> pages;
+
+	const int min_x = std::max(static_cast<int>(floor(min.x / _width)), 0);
+	const int min_z = std::max(static_cast<int>(floor(min.y / _length)), 0);
+	const int max_x = std::min(static_cast<int>(floor(max.x / _width)), _world.x - 1);
+	const int max_z = std::min(static_cast<int>(floor(max.y / _length)), _world.y - 1);
+
+	for (int z = min_z; z <= max_z; ++z) {
+		for (int x = min_x; x <= max_x; ++x) {
+			if (auto page = find_page(glm::ivec2(x, z))) {
+				pages.push_back(page);
+			}
+		}
+	}
+
+	return pages;
+}
+
+TerrainPage* Terrain::load_page(glm::ivec2 coord) {
+	load_pages({ coord });
+	return find_page(coord);
+}
+
+// Missing pages are read from the source in one batch so packed sources can decode them in parallel
+void Terrain::load_pages(const std::vector<glm::ivec2>& coords) {
+	std::vector<std::unique_ptr<TerrainPage>> pages;
+	std::vector<TerrainPage*> reads;
+	for (const auto& coord : coords) {
+		if (!find_page(coord)) {
+			pages.push_back(std::make_unique<TerrainPage>(this, coord));
+			reads.push_back(pages.back().get());
+		}
+	}
+
+	if (pages.empty()) {
+		return;
+	}
+
+	std::vector<bool> found(reads.size(), false);
+	if (_source) {
+		std::lock_guard<std::mutex> lock(_source_mutex);
+		found = _source->read_pages(reads);
+	}
+
+	parallel_for(pages.size(), [&](size_t i) {
+		if (!found[i]) {
+			pages[i]->_node._heights.assign((_width + 1) * (_length + 1), 0.0f);
+		}
+
+		pages[i]->_node._pyramid.build(pages[i]->_node._heights.data(), _width, _length);
+		pages[i]->_node.generate_normals();
+	});
+
+	for (auto& page : pages) {
+		if (_renderer) {
+			_renderer->create_page(page.get());
+			_renderer->upload_page(page.get(), std::numeric_limits<size_t>::max());
+		}
+
+		_pages[page_key(page->_coord)] = std::move(page);
+	}
+
+	for (auto page : reads) {
+		stitch_page(page);
+	}
+}
+
+// Takes what the loader has finished since the last frame, blend tiles are uploaded within _upload_budget
+void Terrain::receive_pages() {
+	for (auto& page : _loader->take_pages()) {
+		const auto key = page_key(page->_coord);
+		if (_pages.count(key)) {
+			continue;
+		}
+
+		if (_renderer) {
+			_renderer->create_page(page.get());
+		}
+		_pages[key] = std::move(page);
+	}
+
+	for (auto& normals : _loader->take_normals()) {
+		const auto page = find_page(normals._coord);
+		if (!page || page->_load_id != normals._load_id || page->_stage != PAGE_LOADING) {
+			continue;
+		}
+
+		page->_node._normals = std::move(normals._normals);
+		page->_node._face_normals = std::move(normals._face_normals);
+		page->_node.changed();
+		page->_stage = PAGE_READY;
+		stitch_page(page);
+	}
+
+	size_t budget = _renderer ? _page_settings._upload_budget : 0;
+	for (auto& page : _pages) {
+		if (budget == 0) {
+			break;
+		}
+
+		budget -= std::min(budget, _renderer->upload_page(page.second.get(), budget));
+	}
+}
+
+// Pages edited before their normals arrive generate them here, the loader's result is dropped
+void Terrain::finish_page(TerrainPage* page) {
+	if (page->_stage == PAGE_READY) {
+		return;
+	}
+
+	page->_node.generate_normals();
+	page->_stage = PAGE_READY;
+	stitch_page(page);
+}
+
+// Border normals of the page and its ready neighbours are generated again with each other's heights as their halo
+// the neighbours' children along the page were built without it and are rebuilt on their next draw
+void Terrain::stitch_page(TerrainPage* page) {
+	const auto rect = glm::vec4(page->_origin.x, page->_origin.y, page->_origin.x + _width, page->_origin.y + _length);
+
+	for (int z = -1; z <= 1; ++z) {
+		for (int x = -1; x <= 1; ++x) {
+			const auto neighbour = find_page(page->_coord + glm::ivec2(x, z));
+			if (!neighbour || neighbour->_stage != PAGE_READY) {
+				continue;
+			}
+
+			neighbour->_node.generate_border_normals();
+			if (neighbour != page) {
+				neighbour->_node.release_within(rect);
+			}
+		}
+	}
+}
+
+// Pages used this frame are never evicted, neither are dirty pages or the snapshot pages of a running save
+// when only dirty pages are left over the budget a SAVE_EVICT journals them on the save's worker, they are evicted once it has finished
+// sources without a journal could only be rewritten in place, their dirty pages stay resident until the next save
+void Terrain::evict_pages() {
+	size_t bytes = resident_bytes();
+	if (bytes <= _page_settings._budget) {
+		return;
+	}
+
+	bool journal = false;
+	if (_source) {
+		std::lock_guard<std::mutex> lock(_source_mutex);
+		journal = _source->has_journal();
+	}
+
+	while (bytes > _page_settings._budget) {
+		auto lru = _pages.end();
+		bool dirty = false;
+		for (auto it = _pages.begin(); it != _pages.end(); ++it) {
+			const auto& page = it->second;
+			if (page->_last_used == _frame || page->_saving) {
+				continue;
+			}
+
+			if (page->_dirty) {
+				dirty = true;
+				continue;
+			}
+
+			if (lru == _pages.end() || page->_last_used < lru->second->_last_used) {
+				lru = it;
+			}
+		}
+
+		if (lru == _pages.end()) {
+			if (dirty && journal && !_save && !_evict_failed) {
+				_save = std::make_unique<TerrainSaveJob>(this, _source->path(), TERRAIN_FORMAT_RAW, SAVE_EVICT);
+			}
+			return;
+		}
+
+		const auto page = lru->second.get();
+		bytes -= page->resident_bytes();
+		if (_renderer) {
+			_renderer->release_page(page);
+		}
+		_pages.erase(lru);
+	}
+}
+
+// Loading pages are drawn whole at their root level until their normals arrive
+void Terrain::select_nodes(glm::vec3 camera_position, const TerrainFrustum& frustum, std::vector<TerrainDrawNode>* nodes) {
+	const auto camera = glm::vec2(camera_position.x, camera_position.z);
+	_node_stats._culled = 0;
+
+	for (auto& page : _pages) {
+		auto& node = page.second->_node;
+		if (page.second->_stage == PAGE_READY) {
+			node.select(page.second.get(), camera, frustum, 0, nodes);
+		}
+		else if (!frustum.contains(glm::vec3(node._quad.x, node.bounds().x, node._quad.y),
+								   glm::vec3(node._quad.x + node._quad.z, node.bounds().y, node._quad.y + node._quad.w))) {
+			++_node_stats._culled;
+		}
+		else {
+			nodes->push_back(TerrainDrawNode{ page.second.get(), &page.second->_node, 0xF, glm::vec2(std::numeric_limits<float>::max()), 0 });
+		}
+	}
+}
+
+// A multiple of the node's size, a node selected at the next level reaches at most range / 2 + its diagonal from the camera
+// so it never meets a node two levels up while range / 2 > its diagonal, edges facing the coarser level are stitched by
+// coarser_edges and the renderer's skirts cover the coarser side while it morphs
+float Terrain::lod_range(TerrainNode* node) {
+	const auto scale = _transform.get_scale();
+	const float size = std::max(node->_quad.z * scale.x, node->_quad.w * scale.z);
+
+	return std::max(_page_settings._lod_range, LOD_RANGE_MIN) * size;
+}
+
+void Terrain::use_nodes(const std::vector<TerrainNode*>& nodes) {
+	for (auto node : nodes) {
+		node->_last_used = _frame;
+
+		if (node->_parent) {
+			if (node->resident()) {
+				++_node_stats._hits;
+			}
+			else if (node->_stale) {
+				++_node_stats._rebuilds;
+			}
+			else {
+				++_node_stats._misses;
+			}
+		}
+	}
+
+	materialize_nodes(nodes);
+	evict_nodes();
+}
+
+// Collects the resident children below node, children with nothing resident below them that weren't drawn this frame are freed
+// returns true when nothing below node is resident or drawn
+static bool collect_nodes(TerrainNode* node, uint64_t frame, std::vector<TerrainNode*>* resident, size_t* count) {
+	if (!node->has_children()) {
+		return true;
+	}
+
+	bool empty = true;
+	for (auto& child : node->_children) {
+		if (child->resident()) {
+			resident->push_back(child.get());
+		}
+
+		const bool child_empty = collect_nodes(child.get(), frame, resident, count);
+		empty = empty && child_empty && !child->resident() && child->_last_used != frame;
+	}
+
+	if (empty) {
+		node->_children = TerrainChildren();
+	}
+	else {
+		*count += node->_children.size();
+	}
+
+	return empty;
+}
+
+// Child grids are released least recently drawn first once over _node_budget, nodes drawn this frame are kept
+void Terrain::evict_nodes() {
+	std::vector<TerrainNode*> resident;
+	size_t count = 0;
+	for (auto& page : _pages) {
+		collect_nodes(&page.second->_node, _frame, &resident, &count);
+	}
+
+	size_t bytes = 0;
+	for (auto node : resident) {
+		bytes += node->grid_bytes();
+	}
+
+	size_t evicted = 0;
+	if (bytes > _page_settings._node_budget) {
+		std::sort(resident.begin(), resident.end(), [](const TerrainNode* a, const TerrainNode* b) {
+			return a->_last_used < b->_last_used;
+		});
+
+		for (auto node : resident) {
+			if (bytes <= _page_settings._node_budget || node->_last_used == _frame) {
+				break;
+			}
+
+			bytes -= node->grid_bytes();
+			node->release();
+			++evicted;
+		}
+	}
+
+	_node_stats._nodes = count;
+	_node_stats._resident = resident.size() - evicted;
+	_node_stats._evictions += evicted;
+	_node_stats._resident_bytes = bytes;
+}
+
+void Terrain::clear_pages() {
+	for (auto& page : _pages) {
+		if (_renderer) {
+			_renderer->release_page(page.second.get());
+		}
+	}
+
+	_pages.clear();
+}
+
+size_t Terrain::resident_bytes() const {
+	size_t bytes = 0;
+	for (const auto& page : _pages) {
+		bytes += page.second->resident_bytes();
+	}
+
+	return bytes;
+}
+
+// Pages share their border vertices, a vertex on a page edge is applied to every resident page holding it
+template <typename Func>
+static void for_each_vertex_page(Terrain* terrain, int x, int z, Func func) {
+	if (x < 0 || z < 0) {
+		return;
+	}
+
+	const int page_x = x / terrain->_width;
+	const int page_z = z / terrain->_length;
+	const int first_x = (x % terrain->_width == 0 && page_x > 0) ? page_x - 1 : page_x;
+	const int first_z = (z % terrain->_length == 0 && page_z > 0) ? page_z - 1 : page_z;
+
+	for (int pz = first_z; pz <= page_z; ++pz) {
+		for (int px = first_x; px <= page_x; ++px) {
+			if (auto page = terrain->find_page(glm::ivec2(px, pz))) {
+				func(page, x - page->_origin.x, z - page->_origin.y);
+			}
+		}
+	}
+}
+
+void Terrain::raise_height(int x, int z, float val, int flag) {
+	for_each_vertex_page(this, x, z, [&](TerrainPage* page, int x, int z) {
+		auto& heights = page->_node._heights;
+		const size_t v_index = x + z * _width + z;
+
+		if (x > _width || v_index >= heights.size()) {
+			return;
+		}
+
+		finish_page(page);
+
+		if (_save) {
+			_save->freeze(page);
+		}
+
+		switch (flag) {
+		case F_RAISE:
+			heights[v_index] += val;
+			break;
+		case F_SET_CURRENT:
+		case F_SET:
+		case F_AVERAGE:
+			heights[v_index] = val;
+			break;
+		default:
+			break;
+		}
+
+		page->mark_heights(x, z);
+
+		page->_node._pyramid.update(heights.data(), x, z);
+	});
+}
+
+// A height change at vertex x, z moves the normals of its neighbours as well, in every page holding them
+// so a vertex next to a page edge also updates the border normals of the page across it
+void Terrain::recalc_normals(int x, int z) {
+	for (int n_z = z - 1; n_z <= z + 1; ++n_z) {
+		for (int n_x = x - 1; n_x <= x + 1; ++n_x) {
+			for_each_vertex_page(this, n_x, n_z, [&](TerrainPage* page, int x, int z) {
+				auto& node = page->_node;
+				if (x > _width || z > _length || node._heights.empty()) {
+					return;
+				}
+
+				finish_page(page);
+				node._normals[x + z * (_width + 1)] = node.vertex_normal(x, z);
+			});
+		}
+	}
+
+	for_each_vertex_page(this, x, z, [&](TerrainPage* page, int x, int z) {
+		auto& node = page->_node;
+		const size_t v_index = x + z * _width + z;
+
+		if (x > _width || v_index >= node._heights.size() || node._face_normals.empty()) {
+			return;
+		}
+
+		for (int f_z = std::max(z - 1, 0); f_z <= std::min(z, _length - 1); ++f_z) {
+			for (int f_x = std::max(x - 1, 0); f_x <= std::min(x, _width - 1); ++f_x) {
+				node._face_normals[f_x + f_z * _width] = node.calc_face_normal(f_x + f_z * _width);
+			}
+		}
+	});
+}
+
+// A ray in a page's grid space, inverse is 1 / direction for the slab tests
+struct TerrainRay {
+	glm::vec3	_origin;
+	glm::vec3	_direction;
+	glm::vec3	_inverse;
+};
+
+// Entry and exit distances of the ray through the box, axes the ray runs parallel to only check the origin
+static bool intersect_box(const TerrainRay& ray, glm::vec3 min, glm::vec3 max, float* enter, float* exit) {
+	*enter = 0.0f;
+	*exit = std::numeric_limits<float>::max();
+
+	for (int i = 0; i < 3; ++i) {
+		if (ray._direction[i] == 0.0f) {
+			if (ray._origin[i] < min[i] || ray._origin[i] > max[i]) {
+				return false;
+			}
+			continue;
+		}
+
+		const float lower = (min[i] - ray._origin[i]) * ray._inverse[i];
+		const float upper = (max[i] - ray._origin[i]) * ray._inverse[i];
+		*enter = std::max(*enter, std::min(lower, upper));
+		*exit = std::min(*exit, std::max(lower, upper));
+	}
+
+	return *enter <= *exit;
+}
+
+// Moller-Trumbore, edges are widened slightly so rays through a shared edge can't slip between its triangles
+static bool intersect_triangle(const TerrainRay& ray, glm::vec3 a, glm::vec3 b, glm::vec3 c, float* t) {
+	constexpr float EDGE = 1e-6f;
+
+	const auto e1 = b - a;
+	const auto e2 = c - a;
+	const auto p = glm::cross(ray._direction, e2);
+	const float det = glm::dot(e1, p);
+	if (det == 0.0f) {
+		return false;
+	}
+
+	const float inverse = 1.0f / det;
+	const auto s = ray._origin - a;
+	const float u = glm::dot(s, p) * inverse;
+	if (u < -EDGE || u > 1.0f + EDGE) {
+		return false;
+	}
+
+	const auto q = glm::cross(s, e1);
+	const float v = glm::dot(ray._direction, q) * inverse;
+	if (v < -EDGE || u + v > 1.0f + EDGE) {
+		return false;
+	}
+
+	*t = glm::dot(e2, q) * inverse;
+	return *t >= 0.0f;
+}
+
+// Amanatides-Woo through the page's tiles between enter and exit, a cell of the pyramid the ray passes over or under is
+// crossed in one step, the walk goes down a level when the ray meets a cell's height range and back up one after each step
+// tiles are split along the same diagonal as exact_height, the first triangle hit is the nearest
+static bool raycast_page(TerrainNode& node, const TerrainRay& ray, float enter, float exit, TerrainHit* hit) {
+	const auto& pyramid = node._pyramid;
+	const auto size = pyramid.size(0);
+	const int top = pyramid.levels() - 1;
+	const auto& o = ray._origin;
+	const auto& d = ray._direction;
+
+	const auto start = o + d * enter;
+	auto tile = glm::clamp(glm::ivec2(static_cast<int>(floor(start.x)), static_cast<int>(floor(start.z))), glm::ivec2(0), size - 1);
+
+	float t = enter;
+	int level = top;
+	while (true) {
+		const auto cell = glm::ivec2(tile.x >> level, tile.y >> level);
+		const auto low = cell * (1 << level);
+		const auto high = glm::min((cell + 1) * (1 << level), size);
+
+		const float exit_x = d.x > 0.0f ? (high.x - o.x) * ray._inverse.x : (d.x < 0.0f ? (low.x - o.x) * ray._inverse.x : std::numeric_limits<float>::max());
+		const float exit_z = d.z > 0.0f ? (high.y - o.z) * ray._inverse.z : (d.z < 0.0f ? (low.y - o.z) * ray._inverse.z : std::numeric_limits<float>::max());
+		const float out = std::min(std::min(exit_x, exit_z), exit);
+
+		const auto range = pyramid.cell(level, cell.x, cell.y);
+		const float y0 = o.y + d.y * t;
+		const float y1 = o.y + d.y * out;
+		if (std::max(y0, y1) >= range.x && std::min(y0, y1) <= range.y) {
+			if (level > 0) {
+				--level;
+				continue;
+			}
+
+			const auto heights = node.get_tile_height(tile.x + tile.y * size.x);
+			const auto v0 = glm::vec3(tile.x, heights._v0, tile.y);
+			const auto v1 = glm::vec3(tile.x + 1, heights._v1, tile.y);
+			const auto v2 = glm::vec3(tile.x, heights._v2, tile.y + 1);
+			const auto v3 = glm::vec3(tile.x + 1, heights._v3, tile.y + 1);
+
+			float first, second;
+			const bool upper = intersect_triangle(ray, v2, v0, v1, &first);
+			const bool lower = intersect_triangle(ray, v2, v3, v1, &second);
+			if (upper || lower) {
+				const bool use_upper = upper && (!lower || first <= second);
+				hit->_distance = use_upper ? first : second;
+				hit->_position = o + d * hit->_distance;
+				hit->_normal = use_upper ? glm::cross(v0 - v1, v2 - v1) : glm::cross(v3 - v2, v1 - v2);
+				hit->_tile = tile;
+				return true;
+			}
+		}
+
+		if (out >= exit) {
+			return false;
+		}
+
+		// leave through the side the ray reaches first, the other axis is where the ray is at that point
+		if (exit_x <= exit_z) {
+			tile.x = d.x > 0.0f ? high.x : low.x - 1;
+			tile.y = glm::clamp(static_cast<int>(floor(o.z + d.z * out)), low.y, high.y - 1);
+		}
+		else {
+			tile.y = d.z > 0.0f ? high.y : low.y - 1;
+			tile.x = glm::clamp(static_cast<int>(floor(o.x + d.x * out)), low.x, high.x - 1);
+		}
+
+		if (tile.x < 0 || tile.y < 0 || tile.x >= size.x || tile.y >= size.y) {
+			return false;
+		}
+
+		t = out;
+		level = std::min(level + 1, top);
+	}
+}
+
+// Pages are tried in the order the ray enters them, their squares don't overlap so the first hit is the nearest
+// the walk runs in the grid's space, the hit is scaled back to the world
+bool Terrain::raycast(glm::vec3 origin, glm::vec3 direction, TerrainHit* hit) {
+	const auto scale = _transform.get_scale();
+	const TerrainRay ray = { origin / scale, direction / scale, 1.0f / (direction / scale) };
+
+	std::vector<std::pair<glm::vec2, TerrainPage*>> pages;
+	for (auto& entry : _pages) {
+		const auto page = entry.second.get();
+		const auto& pyramid = page->_node.pyramid();
+		if (pyramid.empty()) {
+			continue;
+		}
+
+		const auto range = pyramid.cell(pyramid.levels() - 1, 0, 0);
+		const auto min = glm::vec3(page->_origin.x, range.x, page->_origin.y);
+		const auto max = glm::vec3(page->_origin.x + _width, range.y, page->_origin.y + _length);
+
+		float enter, exit;
+		if (intersect_box(ray, min, max, &enter, &exit)) {
+			pages.push_back({ glm::vec2(enter, exit), page });
+		}
+	}
+
+	std::sort(pages.begin(), pages.end(), [](const auto& a, const auto& b) {
+		return a.first.x < b.first.x;
+	});
+
+	for (const auto& page : pages) {
+		const auto offset = glm::vec3(page.second->_origin.x, 0.0f, page.second->_origin.y);
+		const TerrainRay local = { ray._origin - offset, ray._direction, ray._inverse };
+		if (!raycast_page(page.second->_node, local, page.first.x, page.first.y, hit)) {
+			continue;
+		}
+
+		hit->_position = (hit->_position + offset) * scale;
+		hit->_normal = glm::normalize(hit->_normal / scale);
+		hit->_tile += page.second->_origin;
+		return true;
+	}
+
+	return false;
+}
+
+// The height where the mouse ray meets the terrain, 0 when it misses
+float Terrain::find_height(glm::vec3 position, glm::vec3 offset) {
+	TerrainHit hit;
+	if (!raycast(offset, position, &hit)) {
 		return 0.0f;
 	}
 
-	int index = x_index + z_index * _width;
-	if(index >= (_width * _length)) {
+	return std::max(hit._position.y, 0.0f);
+}
+
+bool Terrain::above_terrain(glm::vec3 position, glm::vec3 offset, float height) {
+	const float y = abs((offset.y - height) / position.y);
+	const float x = (y * position.x + offset.x) / _transform.get_scale().x;
+	const float z = (y * position.z + offset.z) / _transform.get_scale().z;
+
+	if(height > exact_height(x, z)) {
+		return true;
+	}
+
+	return false;
+}
+
+float Terrain::exact_height(float x, float z) {
+	TerrainPage* page = nullptr;
+	TerrainTile::Height tile;
+	float dx, dz;
+	if (!tile_at(x, z, page, &dx, &dz, &tile)) {
 		return 0.0f;
 	}
-	auto tile = node->get_tile_height(x_index + z_index * _width);
 
-	glm::vec3 a, b, c;
-	float dx = x - floor(x);
-	float dz = z - floor(z);
+	float height;
+	tile_heights(&dx, &dz, &tile._v0, &tile._v1, &tile._v2, &tile._v3, 1, _transform.get_scale(), &height, nullptr);
+	return height;
+}
+
+// Points are gathered a block at a time into tile offsets and corners for tile_heights
+void Terrain::exact_heights(const glm::vec2* positions, size_t count, float* heights, glm::vec3* normals) {
+	constexpr size_t BLOCK = 256;
+	float dx[BLOCK], dz[BLOCK], v0[BLOCK], v1[BLOCK], v2[BLOCK], v3[BLOCK];
+	bool valid[BLOCK];
+
+	const auto scale = _transform.get_scale();
+	TerrainPage* page = nullptr;
+
+	for (size_t begin = 0; begin < count; begin += BLOCK) {
+		const size_t size = std::min(BLOCK, count - begin);
+		for (size_t i = 0; i < size; ++i) {
+			TerrainTile::Height tile;
+			valid[i] = tile_at(positions[begin + i].x, positions[begin + i].y, page, dx + i, dz + i, &tile);
+			if (!valid[i]) {
+				dx[i] = dz[i] = 0.0f;
+				tile = { 0.0f, 0.0f, 0.0f, 0.0f };
+			}
+
+			v0[i] = tile._v0;
+			v1[i] = tile._v1;
+			v2[i] = tile._v2;
+			v3[i] = tile._v3;
+		}
+
+		tile_heights(dx, dz, v0, v1, v2, v3, size, scale, heights + begin, normals ? normals + begin : nullptr);
 
-	if(dx + dz > 1.0f) {
-		a = glm::vec3(0, tile._v2, 1);
-		b = glm::vec3(1, tile._v3, 1);
-		c = glm::vec3(1, tile._v1, 0);
+		for (size_t i = 0; i < size; ++i) {
+			if (!valid[i]) {
+				heights[begin + i] = 0.0f;
+				if (normals) {
+					normals[begin + i] = glm::vec3(0, 1, 0);
+				}
+			}
+		}
 	}
-	else {
-		a = glm::vec3(0, tile._v2, 1);
-		b = glm::vec3(0, tile._v0, 0);
-		c = glm::vec3(1, tile._v1, 0);
+}
+
+// Saving over the current source appends the dirty regions of each page to its journal, sources without one rewrite dirty pages
+// The journal is compacted into a new base file once it grows past TerrainPageSettings::_compact_bytes and the size of the base file
+// Saving to another file writes every page to "file.tmp", which replaces file once it is complete so a crash mid-save leaves the old file intact
+// A save requested while another is running starts once it has finished
+void Terrain::save(std::string file, int format) {
+	if (_save) {
+		_pending_save = file;
+		_pending_format = format;
+		return;
 	}
 
-	auto n = glm::cross(a - c, b - c);
+	// sources without a journal would be rewritten in place, they are copied and swapped in instead
+	int mode = SAVE_COPY;
+	if (_source && _source->path() == file) {
+		std::lock_guard<std::mutex> lock(_source_mutex);
+		mode = _source->has_journal() ? SAVE_JOURNAL : SAVE_COPY;
+	}
 
-	float h = a.y - ((dx - a.x) * n.x + (dz - a.z) * n.z) / n.y;
+	_save = std::make_unique<TerrainSaveJob>(this, file, format, mode);
+}
 
-	return h * _transform.get_scale().y;
+bool Terrain::saving() const {
+	return _save != nullptr;
 }
 
-void Terrain::save(std::string file) {
-	std::ofstream terrain_file(file.c_str(), std::ios::trunc | std::ios::binary);
+float Terrain::save_progress() const {
+	return _save ? _save->progress() : 1.0f;
+}
 
-	terrain_file.write(reinterpret_cast<const char*>(&_width), 4);
-	terrain_file.write(reinterpret_cast<const char*>(&_length), 4);
-	terrain_file.write(reinterpret_cast<const char*>(&_node._heights[0]), sizeof(GLfloat) * _node._heights.size());
-	terrain_file.write(reinterpret_cast<const char*>(&_blend_map[0][0][0]), sizeof(GLfloat) * 4 * BLEND_MAP_SIZE * BLEND_MAP_SIZE);
+void Terrain::wait_save() {
+	while (_save) {
+		finish_save();
+	}
+}
+
+// render thread, swaps in the file the save wrote and hands edits in a failed snapshot back to the live pages
+void Terrain::finish_save() {
+	_save->wait();
+	auto job = std::move(_save);
+
+	bool saved = job->_saved;
+	if (job->_replace && !replace_source(job->_file, job->_temp) && job->_mode == SAVE_COPY) {
+		saved = false;
+	}
+
+	if (!saved) {
+		std::cout << (job->_mode == SAVE_EVICT ? "FAILED TO JOURNAL EVICTED PAGES " : "FAILED TO SAVE TERRAIN ") << job->_file << '\n';
+	}
+
+	// evictions journal again after any save that worked
+	if (job->_mode == SAVE_EVICT || saved) {
+		_evict_failed = !saved;
+	}
+
+	for (auto& entry : job->_pages) {
+		const auto page = entry.first;
+		const auto snapshot = entry.second.get();
 
-	terrain_file.close();
+		page->_snapshot = nullptr;
+		page->_saving = false;
+
+		if (saved || !snapshot->_dirty) {
+			continue;
+		}
+
+		if (snapshot->heights_dirty()) {
+			page->mark_heights(snapshot->_dirty_heights.x, snapshot->_dirty_heights.y);
+			page->mark_heights(snapshot->_dirty_heights.z, snapshot->_dirty_heights.w);
+		}
+
+		page->_dirty_tiles |= snapshot->_dirty_tiles;
+		page->_dirty = true;
+	}
+
+	const bool evict = job->_mode == SAVE_EVICT;
+	job.reset();
+
+	if (_save_callback && !evict) {
+		_save_callback(saved);
+	}
+
+	if (!_pending_save.empty()) {
+		const auto file = std::move(_pending_save);
+		_pending_save.clear();
+		save(file, _pending_format);
+	}
 }
 
-void Terrain::load(std::string file) {
-	std::ifstream terrain_file(file.c_str(), std::ios::binary);
+// Renames temp over file and reopens the source, on failure the previous source is reopened
+bool Terrain::replace_source(const std::string& file, const std::string& temp) {
+	const std::string previous = _source ? _source->path() : std::string();
 
-	if (terrain_file.is_open()) {
-		terrain_file.read(reinterpret_cast<char*>(&_width), 4);
-		terrain_file.read(reinterpret_cast<char*>(&_length), 4);
-		_node._heights.resize((_width + 1) * (_length + 1));
-		terrain_file.read(reinterpret_cast<char*>(&_node._heights[0]), sizeof(GLfloat) * _node._heights.size());
-		terrain_file.read(reinterpret_cast<char*>(&_blend_map[0][0][0]), sizeof(GLfloat) * 4U * BLEND_MAP_SIZE * BLEND_MAP_SIZE);
+	// views into the old source are copied before it closes, the file can't be replaced while it's mapped
+	// pages the loader read from it are dropped and requested again
+	_loader->cancel();
+	for (auto& page : _pages) {
+		page.second->_blend_map.detach();
+	}
 
-		terrain_file.close();
+	std::lock_guard<std::mutex> lock(_source_mutex);
+	_source.reset();
+
+	std::string path = file;
+	if (temp != file) {
+		std::error_code error;
+		std::filesystem::rename(temp, file, error);
+		if (error) {
+			std::cout << "FAILED TO REPLACE TERRAIN FILE " << file << '\n';
+			std::filesystem::remove(temp, error);
+			path = previous;
+		}
+		else {
+			// a journal left over from the replaced file no longer matches it
+			std::filesystem::remove(file + TERRAIN_JOURNAL_EXTENSION, error);
+		}
 	}
-	else {
-		_node._heights.resize((_width + 1) * (_length + 1));
-		_node.generate_normals();
+
+	if (path.empty()) {
+		return false;
 	}
 
-	_node._quad = glm::vec4(0, 0, _width, _length);
-	_sub_indices = { 0, _width / 2, (_width * _length) / 2 + (_length / 2), (_width * _length / 2) + (_length / 2) + (_width / 2) };
+	_source = open_page_source(path);
+	_source->read_world(&_width, &_length, &_world);
 
-	_node.generate_normals();
+	// pages edited since the snapshot keep their own tiles, clean pages swap theirs back to views of the new file
+	for (auto& page : _pages) {
+		if (!page.second->_dirty) {
+			_source->map_blend(page.second.get());
+		}
+	}
 
-	_node.subdivide();
+	return path == file;
+}
 
-	create_height_buffer();
-	create_normal_buffer();
+// Only the world header is read here, the pages are requested by the next update and stream in over the following frames
+void Terrain::load(std::string file) {
+	wait_save();
+	_loader->cancel();
+	clear_pages();
+
+	{
+		std::lock_guard<std::mutex> lock(_source_mutex);
+		_source = open_page_source(file);
+		_source->read_world(&_width, &_length, &_world);
+	}
 
-	create_blend_texture();
-}
\ No newline at end of file
+	_sub_indices = { 0, _width / 2, (_width * _length) / 2 + (_length / 2), (_width * _length / 2) + (_length / 2) + (_width / 2) };
+
+	if (_renderer) {
+		_renderer->resize(_width, _length);
+	}
+}
@@ -1,16 +1,23 @@
 #ifndef TERRAIN_H
 #define TERRAIN_H
 
-#include <GL/gl3w.h>
-
 #include <glm/gtc/matrix_transform.hpp>
 
 #include <vector>
 #include <array>
 #include <memory>
+#include <unordered_map>
+#include <bitset>
+#include <mutex>
+#include <functional>
+#include <cstdint>
 
-#include "Program.h"
 #include "Transform.h"
+#include "TerrainSource.h"
+#include "BlendMap.h"
+#include "TerrainSave.h"
+#include "TerrainLoad.h"
+#include "TerrainPyramid.h"
 
 #define F_RAISE 0
 #define F_SET 1
@@ -25,74 +32,72 @@
 #define BLEND_ADD 0
 #define BLEND_CLEAR 1
 
-#define BLEND_MAP_SIZE 1028
+#define PAGE_BUDGET (256ull * 1024ull * 1024ull)
+#define PAGE_RADIUS 1
+#define PAGE_UPLOAD_BUDGET (4ull * 1024ull * 1024ull)
+#define NODE_BUDGET (128ull * 1024ull * 1024ull)
+
+// CDLOD, a node is refined while the camera is within LOD_RANGE of its sizes and morphs toward its parent from LOD_MORPH of that range
+#define LOD_RANGE 2.0f
+#define LOD_MORPH 0.7f
+
+// load stages, loading pages are drawn at their root lod with flat normals until their normals arrive
+#define PAGE_LOADING 0
+#define PAGE_READY 1
+
+// journaled saves are compacted into a new base file once the journal outgrows this or the base file
+#define JOURNAL_COMPACT_BYTES (64ull * 1024ull * 1024ull)
 
 class Terrain;
 struct TerrainNode;
+struct TerrainPage;
 
 /********************************************************************************************************************************************************/
 
-class BrushMesh {
+// The gpu side of a terrain, Terrain calls it as pages come and go and runs headless without one
+class TerrainRenderer {
 public:
-	BrushMesh(Program* program, Terrain* root);
+	virtual ~TerrainRenderer() = default;
 
-	void update(glm::vec3 mouse_vector, glm::vec3 offset);
-	void draw(glm::vec3 position);
+	// every page has the same grid size, called once the world has been read
+	virtual void resize(int width, int length) = 0;
 
-	std::vector<std::array<int, 2>> tiles_within_radius();
+	virtual void create_page(TerrainPage* page) = 0;
+	virtual void release_page(TerrainPage* page) = 0;
 
-	void paint_blend_map(int texture, float weight, int flag = BLEND_ADD);
-	void raise_height(float val, int flag);
+	// uploads until budget bytes have been sent, returns the bytes uploaded
+	virtual size_t upload_page(TerrainPage* page, size_t budget) = 0;
+	virtual void upload_blend_region(TerrainPage* page, int x, int z, int width, int length) = 0;
 
-	void update_blend_texture();
-
-	glm::vec3						_position;
-	float							_radius;
-
-	GLuint							_vertex_buffer;
-	Program*						_program;
-	Terrain*						_root;
+	// x, z, width, length are world vertices whose heights were edited, the normals one vertex around them moved with them
+	virtual void update_heights(int x, int z, int width, int length) = 0;
 };
 
 /********************************************************************************************************************************************************/
 
-class GrassMesh {
-	GrassMesh(Program* program);
-
-	void draw(glm::vec3 position);
-	void create_buffers();
-
-	GLuint							_vertex_buffer;
-	GLuint							_texture;
-	Program*						_program;
-};
+class BrushMesh {
+public:
+	BrushMesh(Terrain* root);
 
-/********************************************************************************************************************************************************/
+	void update(glm::vec3 mouse_vector, glm::vec3 offset);
 
-class TerrainMesh {
-public:
-	TerrainMesh(Program* program);
+	std::vector<std::array<int, 2>> tiles_within_radius();
+	std::vector<TerrainPage*> pages_within_radius();
 
-	void create_buffers();
-	void create_tile_textures();
-	void draw(TerrainNode* node);
-	
-	GLuint							_vertex_buffer;
-	GLuint							_uv_buffer;
-	GLuint							_normal_buffer;
-	GLuint							_height_buffer;
+	void paint_blend_map(int texture, float weight, int flag = BLEND_ADD);
+	void paint_blend_map(TerrainPage* page, int texture, float weight, int flag);
+	void raise_height(float val, int flag);
 
-	GLuint							_height_texture;
-	GLuint							_normal_texture;
-	std::array<GLuint, 4>			_tile_textures;
+	glm::vec3						_position;
+	float							_radius;
 
-	Program*					    _program;
+	Terrain*						_root;
 };
 
 /********************************************************************************************************************************************************/
 
 typedef std::array<std::unique_ptr<TerrainNode>, 4> TerrainChildren;
-typedef std::vector<GLfloat>						TerrainHeights;
+typedef std::vector<float>							TerrainHeights;
 typedef std::vector<glm::vec3>						TerrainNormals;
 typedef std::vector<std::array<glm::vec3, 2>>		TerrainFaceNormals;
 
@@ -112,27 +117,83 @@ struct TerrainTile {
 	Vertex _v0, _v1, _v2, _v3;
 };
 
+// World position and face normal of a ray hit, distance is in units of the ray's direction and tile is the world tile
+struct TerrainHit {
+	glm::vec3	_position;
+	glm::vec3	_normal;
+	float		_distance;
+	glm::ivec2	_tile;
+};
+
 /********************************************************************************************************************************************************/
 
+// The planes of a view projection matrix, pass projection * view * model to test boxes in terrain space
+// a default frustum holds everything
+struct TerrainFrustum {
+	TerrainFrustum() = default;
+	explicit TerrainFrustum(const glm::mat4& view_projection);
+
+	bool contains(glm::vec3 min, glm::vec3 max) const;
+
+	std::array<glm::vec4, 6>	_planes;
+	bool						_enabled = false;
+};
+
+// A node picked by Terrain::select_nodes
+// quadrants are the quarters of its grid it draws itself, the other quarters are drawn by its children
+// morph is the world distance where its vertices start moving onto the parent's grid and where they reach it
+// edges are the sides with a coarser neighbour, -x +x -z +z, their vertices are drawn fully morphed so they lie on the neighbour's edge
+struct TerrainDrawNode {
+	TerrainPage*	_page;
+	TerrainNode*	_node;
+	int				_quadrants;
+	glm::vec2		_morph;
+	int				_edges;
+};
+
 struct TerrainNode {
 public:
-	TerrainNode(Terrain* root, TerrainNode* parent, float space, glm::vec4 quad);
+	TerrainNode(Terrain* root, TerrainNode* parent, float space, glm::vec4 quad, int index = 0);
 
-	void subdivide(glm::vec2 position, int depth = 0);
+	bool select(TerrainPage* page, glm::vec2 camera, const TerrainFrustum& frustum, int depth, std::vector<TerrainDrawNode>* nodes);
+	int coarser_edges(glm::vec2 camera, float range) const;
 	void subdivide(int depth = 0);
-	void draw(glm::vec2 position, int depth = 0);
-	void draw(int depth = 0);
 	void create_children();
 	void generate_heights(int index);
-	void generate_normals();
+	void generate_normals(bool neighbours = true);
+	void generate_border_normals();
+
+	// Heights and normals with a one vertex halo, x, z may be one vertex outside the grid
+	// halo heights come from the neighbouring page's root grid, or the node's own page when neighbours is false or it isn't resident
+	float halo_height(int x, int z, bool neighbours = true) const;
+	glm::vec3 vertex_normal(int x, int z) const;
+
+	// Child nodes are views into their parent's grid, their heights are generated when they are first drawn
+	// and kept until Terrain::evict_nodes needs the memory
+	void materialize();
+	void release();
+	void release_children();
+	void release_within(glm::vec4 rect);
+	bool resident() const;
+	size_t grid_bytes() const;
+	size_t resident_bytes() const;
+
+	// Gives the grid a new version, versions are unique across every node so a renderer uploads a node again only when it moves
+	// edits to a root grid keep the version and are reported through TerrainRenderer::update_heights instead
+	void changed();
 
 	std::array<glm::vec3, 2> calc_face_normal(int index) const;
 	glm::vec3 get_face_normal(int index, int triangle) const;
-	glm::vec3 generate_normal(int index, int edge) const;
 
 	TerrainNode* find_node(float* x, float* z);
 
-	bool within_range(glm::vec2 p);
+	// Lowest and highest height the node's grid can have, read from its page's pyramid since every child grid interpolates the root grid
+	// so nodes are culled before their grids are built
+	glm::vec2 bounds();
+	TerrainPyramid& pyramid();
+
+	float distance(glm::vec2 p) const;
+	float distance(glm::vec2 p, glm::vec4 quad) const;
 	bool has_children();
 
 	TerrainTile get_tile(size_t index) const;
@@ -143,64 +204,176 @@ public:
 	TerrainNode*							_parent;
 	TerrainChildren							_children;
 
+	int										_index;
 	float									_space;
 	glm::vec4								_quad;
 	TerrainHeights							_heights;
 	TerrainNormals							_normals;
 	TerrainFaceNormals						_face_normals;
+	uint64_t								_last_used;		// frame this node was last drawn
+	uint64_t								_version;		// see changed
+	bool									_stale;			// released by release_within, rebuilt rather than missed
+	TerrainPyramid							_pyramid;		// root nodes only, built with the heights
 };
 
+void materialize_nodes(const std::vector<TerrainNode*>& nodes);
+
 /********************************************************************************************************************************************************/
 
-typedef std::array<std::array<glm::vec4, BLEND_MAP_SIZE>, BLEND_MAP_SIZE> BlendMap;
+// A fixed size piece of the world, each page is its own quadtree with the terrain's width and length
+// Neighbouring pages duplicate their shared border vertices
+struct TerrainPage {
+	TerrainPage(Terrain* root, glm::ivec2 coord);
 
-struct TerrainShaders {
-	TerrainShaders(Program* t, Program* b, Program* g) : _terrain ( t ), _brush ( b ), _grass ( g )	{}
-	Program* _terrain;
-	Program* _brush;
-	Program* _grass;
+	size_t resident_bytes() const;
+
+	// Edits since the page was last written, journaled saves only write the dirty regions
+	// x, z are page vertices for heights and blend map texels for the blend map
+	void mark_heights(int x, int z);
+	void mark_blend(int x, int z, int width, int length);
+	bool heights_dirty() const;
+	void clear_dirty();
+
+	glm::ivec2						_coord;
+	glm::ivec2						_origin;
+	TerrainNode						_node;
+	BlendMap						_blend_map;
+
+	bool							_dirty;
+	glm::ivec4						_dirty_heights;		// min x, min z, max x, max z
+	std::bitset<BLEND_TILE_COUNT>	_dirty_tiles;
+	uint64_t						_last_used;
+
+	// set while a background save holds a snapshot of the page, see TerrainSaveJob
+	TerrainPage*					_snapshot;
+	bool							_saving;
+
+	// see TerrainLoader
+	int								_stage;
+	uint64_t						_load_id;
+};
+
+uint64_t page_key(glm::ivec2 coord);
+
+typedef std::unordered_map<uint64_t, std::unique_ptr<TerrainPage>> TerrainPages;
+
+struct TerrainPageSettings {
+	size_t _budget = PAGE_BUDGET;				// bytes of resident page data before pages outside the view are evicted
+	int    _radius = PAGE_RADIUS;				// pages kept resident around the camera page
+	int    _blend_format = BLEND_FORMAT_FLOAT;	// blend map storage and upload, RGBA8 / RGBA16 cut memory and upload bandwidth by 4x / 2x
+	size_t _upload_budget = PAGE_UPLOAD_BUDGET;	// bytes of blend tiles uploaded per frame while pages stream in
+	bool   _face_normals = false;				// keep per triangle normals next to the vertex normals, nothing in the core needs them
+	size_t _node_budget = NODE_BUDGET;			// bytes of child grids before the least recently drawn are released
+	float  _lod_range = LOD_RANGE;				// node sizes from the camera a node is drawn at its own level, raised to what keeps neighbours within one level
+	float  _lod_morph = LOD_MORPH;				// part of the range before vertices start morphing toward the parent level
+	size_t _compact_bytes = JOURNAL_COMPACT_BYTES;	// journal bytes before a journaled save compacts it, the base file's size counts as well
+};
+
+// Child grid cache, hits and misses count drawn nodes, evictions count grids released over _node_budget
+// rebuilds count drawn nodes whose grid was released by an edit or a page load rather than evicted
+struct TerrainNodeStats {
+	size_t		_nodes = 0;				// child nodes allocated
+	size_t		_resident = 0;			// child nodes holding a grid
+	size_t		_resident_bytes = 0;
+	uint64_t	_hits = 0;
+	uint64_t	_misses = 0;
+	uint64_t	_rebuilds = 0;
+	uint64_t	_evictions = 0;
+	size_t		_culled = 0;			// nodes outside the view in the last selection
 };
 
 class Terrain {
 public:
-	Terrain(int width, int length, int depth, GLuint vao, TerrainShaders shaders);
+	Terrain(int width, int length, int depth, TerrainPageSettings page_settings = TerrainPageSettings());
+	~Terrain();
 
-	void draw(glm::vec3 camera_position);
-	void draw_stencil(glm::vec3 position);
+	// Terrain only holds the data, drawing is up to the renderer, see TerrainMesh
+	void set_renderer(std::unique_ptr<TerrainRenderer> renderer);
 	void update(glm::vec3 camera_position);
 
+	// First triangle of the resident pages the ray hits, position is the camera's mouse vector and offset the camera for find_height
+	bool raycast(glm::vec3 origin, glm::vec3 direction, TerrainHit* hit);
+
+	// Many rays at once, traced in packets of neighbouring rays across the worker pool, see TerrainTrace.cpp
+	// hits[i] is what raycast gives for ray i, rays that miss get a distance of -1, returns the number of hits
+	size_t raycast(const glm::vec3* origins, const glm::vec3* directions, size_t count, TerrainHit* hits);
 	float find_height(glm::vec3 position, glm::vec3 offset);
 	bool  above_terrain(glm::vec3 position, glm::vec3 offset, float height);
 	float exact_height(float x, float z);
 
+	// exact_height for count points in grid units, normals are the unit world normals of the triangles under them and may be null
+	// points outside the resident pages give 0 and an up normal
+	void exact_heights(const glm::vec2* positions, size_t count, float* heights, glm::vec3* normals = nullptr);
+
 	Transform& get_transform();
 
-	void save(std::string file);
+	// saves run in the background, _save_callback is called on the render thread once the save has finished
+	void save(std::string file, int format = TERRAIN_FORMAT_RAW);
+	bool saving() const;
+	float save_progress() const;
+	void wait_save();
+	void finish_save();
+	bool replace_source(const std::string& file, const std::string& temp);
 	void load(std::string file);
 
-	void create_height_buffer();
-	void create_blend_texture();
-	void create_normal_buffer();
-
 	void raise_height(int x, int z, float val, int flag);
 	void recalc_normals(int x, int z);
 
+	// x, z are world tile coordinates, only resident pages are returned
+	TerrainPage* find_page(glm::ivec2 coord);
+	TerrainPage* page_at(int x, int z);
+
+	// tile under the grid point x, z and the offsets inside it, page is the page of the last point and is tried first
+	bool tile_at(float x, float z, TerrainPage*& page, float* dx, float* dz, TerrainTile::Height* tile);
+	std::vector<TerrainPage*> pages_within(glm::vec2 min, glm::vec2 max);
+
+	// heights of the world vertices (x + i * step, z + j * step) for i < width, j < length into out, 0 outside resident pages
+	void read_heights(int x, int z, int step, int width, int length, float* out);
+
+	// load_page / load_pages block until the pages are ready, update streams them in through _loader
+	TerrainPage* load_page(glm::ivec2 coord);
+	void load_pages(const std::vector<glm::ivec2>& coords);
+	void receive_pages();
+	void finish_page(TerrainPage* page);
+	void stitch_page(TerrainPage* page);
+	void evict_pages();
+	void clear_pages();
+	size_t resident_bytes() const;
+
+	// CDLOD selection of every page around the camera, children are created as nodes need refining
+	// nodes outside the frustum are skipped along with everything below them
+	void select_nodes(glm::vec3 camera_position, const TerrainFrustum& frustum, std::vector<TerrainDrawNode>* nodes);
+	float lod_range(TerrainNode* node);
+
+	// the renderer hands over the nodes it is about to draw, their grids are built and the cache is trimmed to _node_budget
+	void use_nodes(const std::vector<TerrainNode*>& nodes);
+	void evict_nodes();
+
 	int								_width;
 	int								_length;
 	int								_depth;
 	std::array<int, 4>				_sub_indices;
-	GLuint							_height_map;
-	GLuint							_blend_buffer;
-	GLuint							_blend_texture;
-	BlendMap						_blend_map;
 
-	TerrainNode						_node;
+	glm::ivec2						_world;
+	TerrainPageSettings				_page_settings;
+	TerrainPages					_pages;
+	uint64_t						_frame;
+	TerrainNodeStats				_node_stats;
+	std::unique_ptr<TerrainPageSource> _source;
+	std::mutex						_source_mutex;
+
+	std::unique_ptr<TerrainSaveJob>	_save;
+	std::function<void(bool)>		_save_callback;
+	std::string						_pending_save;
+	int								_pending_format;
+	bool							_evict_failed;		// a SAVE_EVICT failed, dirty pages stay resident until a save succeeds
+
+	std::unique_ptr<TerrainLoader>	_loader;
+
 	Transform						_transform;
 
-	std::unique_ptr<TerrainMesh>	_mesh;
+	std::unique_ptr<TerrainRenderer> _renderer;		// nullptr -> headless
 	std::unique_ptr<BrushMesh>		_brush_mesh;
-
-	GLuint							_vao;
 };
 
 /********************************************************************************************************************************************************/
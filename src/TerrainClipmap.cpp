@@ -0,0 +1,172 @@
+#include "TerrainClipmap.h"
+
+#include <algorithm>
+
+// samples held for each level, the grid's vertices and one either side of them
+constexpr int WINDOW_SIZE = CLIPMAP_GRID + 3;
+
+// edits kept between draws, past this every level is read again instead
+constexpr size_t MAX_DIRTY_RECTS = 64;
+
+static int floor_div(int a, int b) {
+	return a >= 0 ? a / b : -((-a + b - 1) / b);
+}
+
+static int wrap(int a) {
+	return ((a % CLIPMAP_SIZE) + CLIPMAP_SIZE) % CLIPMAP_SIZE;
+}
+
+//-----------------------------------------------------------TERRAIN CLIPMAP---------------------------------------------------------------------------------------------------------
+
+TerrainClipmap::TerrainClipmap(Terrain* root, Program* program) :
+	_root				( root ),
+	_program			( program ),
+	_height_texture		( 0 )
+{
+	_valid.fill(false);
+
+	glCreateTextures(GL_TEXTURE_2D_ARRAY, 1, &_height_texture);
+	glTextureStorage3D(_height_texture, 1, GL_R32F, CLIPMAP_SIZE, CLIPMAP_SIZE, CLIPMAP_LEVELS);
+}
+
+TerrainClipmap::~TerrainClipmap() {
+	glDeleteTextures(1, &_height_texture);
+}
+
+// Only draw clears the rects, while the quadtree is drawn they pile up so past MAX_DIRTY_RECTS the levels are dropped instead
+void TerrainClipmap::invalidate(int x, int z, int width, int length) {
+	if (_dirty.size() >= MAX_DIRTY_RECTS) {
+		_valid.fill(false);
+		_dirty.clear();
+	}
+
+	if (std::find(_valid.begin(), _valid.end(), true) != _valid.end()) {
+		_dirty.push_back(glm::ivec4(x, z, width, length));
+	}
+}
+
+// Level l's grid starts on a multiple of 2^(l + 1) world vertices so the hole in the level around it is a whole number of that level's quads
+void TerrainClipmap::draw(glm::vec3 camera_position) {
+	const auto scale = _root->_transform.get_scale();
+	const auto camera = glm::ivec2(
+		static_cast<int>(floor(camera_position.x / scale.x)),
+		static_cast<int>(floor(camera_position.z / scale.z))
+	);
+
+	std::array<glm::ivec2, CLIPMAP_LEVELS> origins;
+	for (int level = 0; level < CLIPMAP_LEVELS; ++level) {
+		const int spacing = 1 << level;
+		const auto snapped = glm::ivec2(floor_div(camera.x, 2 * spacing), floor_div(camera.y, 2 * spacing)) * (2 * spacing);
+		origins[level] = snapped - (CLIPMAP_GRID / 2) * spacing;
+
+		update_level(level, origins[level] / spacing - 1);
+	}
+	_dirty.clear();
+
+	glUseProgram(_program->_id);
+
+	glActiveTexture(GL_TEXTURE7);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, _height_texture);
+
+	glUniformMatrix4fv(glGetUniformLocation(_program->_id, "model"), 1, GL_FALSE, &_root->_transform.get_model()[0][0]);
+	glUniform1i(glGetUniformLocation(_program->_id, "grid"), CLIPMAP_GRID);
+	glUniform1i(glGetUniformLocation(_program->_id, "size"), CLIPMAP_SIZE);
+
+	constexpr int inner = CLIPMAP_GRID / 2;
+	for (int level = 0; level < CLIPMAP_LEVELS; ++level) {
+		const int spacing = 1 << level;
+		glUniform1i(glGetUniformLocation(_program->_id, "level"), level);
+		glUniform1i(glGetUniformLocation(_program->_id, "spacing"), spacing);
+		glUniform2i(glGetUniformLocation(_program->_id, "origin"), origins[level].x / spacing, origins[level].y / spacing);
+		glUniform1i(glGetUniformLocation(_program->_id, "stitch"), level < CLIPMAP_LEVELS - 1);
+
+		if (level == 0) {
+			draw_rect(0, 0, CLIPMAP_GRID, CLIPMAP_GRID);
+			continue;
+		}
+
+		// the ring around the hole as 4 rectangles, above, below, left and right of it
+		const auto hole = (origins[level - 1] - origins[level]) / spacing;
+		draw_rect(0, 0, CLIPMAP_GRID, hole.y);
+		draw_rect(0, hole.y + inner, CLIPMAP_GRID, CLIPMAP_GRID - hole.y - inner);
+		draw_rect(0, hole.y, hole.x, inner);
+		draw_rect(hole.x + inner, hole.y, CLIPMAP_GRID - hole.x - inner, inner);
+	}
+}
+
+// x, z, width, length are quads of the current level's grid, one instance per quad
+void TerrainClipmap::draw_rect(int x, int z, int width, int length) {
+	if (width <= 0 || length <= 0) {
+		return;
+	}
+
+	glUniform4i(glGetUniformLocation(_program->_id, "rect"), x, z, width, length);
+	glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, width * length);
+}
+
+// Only the columns and rows that came into view are read, then whatever was edited or loaded inside the window
+void TerrainClipmap::update_level(int level, glm::ivec2 window) {
+	const int spacing = 1 << level;
+	const auto old = _windows[level];
+	const auto shift = window - old;
+
+	if (!_valid[level] || abs(shift.x) >= WINDOW_SIZE || abs(shift.y) >= WINDOW_SIZE) {
+		update_region(level, window.x, window.y, WINDOW_SIZE, WINDOW_SIZE);
+	}
+	else {
+		if (shift.x > 0) {
+			update_region(level, old.x + WINDOW_SIZE, window.y, shift.x, WINDOW_SIZE);
+		}
+		else if (shift.x < 0) {
+			update_region(level, window.x, window.y, -shift.x, WINDOW_SIZE);
+		}
+
+		if (shift.y > 0) {
+			update_region(level, window.x, old.y + WINDOW_SIZE, WINDOW_SIZE, shift.y);
+		}
+		else if (shift.y < 0) {
+			update_region(level, window.x, window.y, WINDOW_SIZE, -shift.y);
+		}
+
+		for (const auto& rect : _dirty) {
+			const int start_x = std::max(floor_div(rect.x + spacing - 1, spacing), window.x);
+			const int start_z = std::max(floor_div(rect.y + spacing - 1, spacing), window.y);
+			const int end_x = std::min(floor_div(rect.x + rect.z - 1, spacing), window.x + WINDOW_SIZE - 1);
+			const int end_z = std::min(floor_div(rect.y + rect.w - 1, spacing), window.y + WINDOW_SIZE - 1);
+
+			if (end_x >= start_x && end_z >= start_z) {
+				update_region(level, start_x, start_z, end_x - start_x + 1, end_z - start_z + 1);
+			}
+		}
+	}
+
+	_windows[level] = window;
+	_valid[level] = true;
+}
+
+// x, z, width, length are samples of the level, a region crossing the layer's edge is uploaded in up to 4 pieces
+void TerrainClipmap::update_region(int level, int x, int z, int width, int length) {
+	const int spacing = 1 << level;
+
+	_samples.resize(width * length);
+	_root->read_heights(x * spacing, z * spacing, spacing, width, length, _samples.data());
+
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, width);
+
+	for (int j = 0; j < length;) {
+		const int texel_z = wrap(z + j);
+		const int rows = std::min(length - j, CLIPMAP_SIZE - texel_z);
+
+		for (int i = 0; i < width;) {
+			const int texel_x = wrap(x + i);
+			const int columns = std::min(width - i, CLIPMAP_SIZE - texel_x);
+
+			glTextureSubImage3D(_height_texture, 0, texel_x, texel_z, level, columns, rows, 1, GL_RED, GL_FLOAT, &_samples[i + j * width]);
+			i += columns;
+		}
+
+		j += rows;
+	}
+
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+}
@@ -0,0 +1,54 @@
+#ifndef TERRAIN_CLIPMAP_H
+#define TERRAIN_CLIPMAP_H
+
+#include <GL/gl3w.h>
+
+#include <array>
+#include <vector>
+
+#include "Program.h"
+#include "Terrain.h"
+
+#define CLIPMAP_LEVELS 6
+#define CLIPMAP_GRID 124		// quads per side of every level, a multiple of 4 so each level's hole lines up with the level inside it
+#define CLIPMAP_SIZE 128		// texels per side of each level's height layer, the grid plus a sample either side for normals
+
+/* Geometry clipmap
+** Nested rings of the same CLIPMAP_GRID x CLIPMAP_GRID grid centered on the camera, level l is 2^l world vertices between samples
+** so the triangle count is the same for any world size
+
+** Each level's heights live in one layer of a texture array addressed toroidally, when the camera moves only the rows and columns
+** that came into view are read from the terrain and uploaded, edits and page loads re-upload the samples they cover
+** Level 0 is the full grid, every other level leaves a hole where the level inside it is drawn
+** Outer border vertices at odd positions take the average of their neighbours so they meet the coarser level without cracks
+*/
+
+class TerrainClipmap {
+public:
+	TerrainClipmap(Terrain* root, Program* program);
+	~TerrainClipmap();
+
+	TerrainClipmap(const TerrainClipmap&) = delete;
+	TerrainClipmap& operator=(const TerrainClipmap&) = delete;
+
+	void draw(glm::vec3 camera_position);
+
+	// x, z, width, length are world vertices
+	void invalidate(int x, int z, int width, int length);
+private:
+	void update_level(int level, glm::ivec2 window);
+	void update_region(int level, int x, int z, int width, int length);
+	void draw_rect(int x, int z, int width, int length);
+
+	Terrain*								_root;
+	Program*								_program;
+
+	GLuint									_height_texture;
+
+	std::array<glm::ivec2, CLIPMAP_LEVELS>	_windows;		// first sample held by each level's layer
+	std::array<bool, CLIPMAP_LEVELS>		_valid;
+	std::vector<glm::ivec4>					_dirty;
+	std::vector<float>						_samples;
+};
+
+#endif
@@ -0,0 +1,421 @@
+#include "TerrainCodec.h"
+
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+
+constexpr size_t LZ_MIN_MATCH = 4;
+constexpr size_t LZ_HASH_BITS = 16;
+constexpr size_t LZ_MAX_OFFSET = 65535;
+
+constexpr float HEIGHT_STEPS = 65535.0f;
+constexpr float BLEND_STEPS = 255.0f;
+
+//-----------------------------------------------------------------LZ---------------------------------------------------------------------------------------------------------
+
+static uint32_t read32(const uint8_t* p) {
+	uint32_t v;
+	std::memcpy(&v, p, 4);
+	return v;
+}
+
+static void write_length(std::vector<uint8_t>& out, size_t length) {
+	while (length >= 255) {
+		out.push_back(255);
+		length -= 255;
+	}
+	out.push_back(static_cast<uint8_t>(length));
+}
+
+// token -> literal length (4 bits) | match length - LZ_MIN_MATCH (4 bits), 15 continues into 255 terminated bytes
+// the last sequence only has literals
+static void write_sequence(std::vector<uint8_t>& out, const uint8_t* literals, size_t literal_length, size_t offset, size_t match_length) {
+	const size_t match_code = match_length ? match_length - LZ_MIN_MATCH : 0;
+
+	out.push_back(static_cast<uint8_t>((std::min<size_t>(literal_length, 15) << 4) | std::min<size_t>(match_code, 15)));
+	if (literal_length >= 15) {
+		write_length(out, literal_length - 15);
+	}
+
+	out.insert(out.end(), literals, literals + literal_length);
+
+	if (match_length) {
+		out.push_back(static_cast<uint8_t>(offset & 0xff));
+		out.push_back(static_cast<uint8_t>(offset >> 8));
+		if (match_code >= 15) {
+			write_length(out, match_code - 15);
+		}
+	}
+}
+
+std::vector<uint8_t> lz_compress(const uint8_t* data, size_t size) {
+	std::vector<uint8_t> out;
+	out.reserve(size / 2 + 16);
+
+	// one slot per input byte up to LZ_HASH_BITS, small tiles only clear what they can use
+	size_t bits = 8;
+	while (bits < LZ_HASH_BITS && (size_t(1) << bits) < size) {
+		++bits;
+	}
+
+	thread_local std::vector<uint32_t> table;
+	table.assign(size_t(1) << bits, UINT32_MAX);
+
+	size_t anchor = 0;
+	size_t i = 0;
+	while (size >= LZ_MIN_MATCH && i <= size - LZ_MIN_MATCH) {
+		const uint32_t sequence = read32(data + i);
+		const uint32_t hash = (sequence * 2654435761u) >> (32 - bits);
+		const uint32_t candidate = table[hash];
+		table[hash] = static_cast<uint32_t>(i);
+
+		if (candidate == UINT32_MAX || i - candidate > LZ_MAX_OFFSET || read32(data + candidate) != sequence) {
+			++i;
+			continue;
+		}
+
+		size_t length = LZ_MIN_MATCH;
+		while (i + length < size && data[candidate + length] == data[i + length]) {
+			++length;
+		}
+
+		write_sequence(out, data + anchor, i - anchor, i - candidate, length);
+		i += length;
+		anchor = i;
+	}
+
+	write_sequence(out, data + anchor, size - anchor, 0, 0);
+
+	return out;
+}
+
+static bool read_length(const uint8_t*& in, const uint8_t* end, size_t* length) {
+	uint8_t byte;
+	do {
+		if (in >= end) {
+			return false;
+		}
+		byte = *in++;
+		*length += byte;
+	} while (byte == 255);
+
+	return true;
+}
+
+// the stream must end with the literal only sequence, a stream cut after a match is rejected even when the output is full
+bool lz_decompress(const uint8_t* data, size_t size, uint8_t* out, size_t out_size) {
+	const uint8_t* in = data;
+	const uint8_t* end = data + size;
+	size_t written = 0;
+	bool terminated = false;
+
+	while (in < end) {
+		const uint8_t token = *in++;
+
+		size_t literal_length = token >> 4;
+		if (literal_length == 15 && !read_length(in, end, &literal_length)) {
+			return false;
+		}
+
+		if (literal_length > static_cast<size_t>(end - in) || literal_length > out_size - written) {
+			return false;
+		}
+
+		std::memcpy(out + written, in, literal_length);
+		in += literal_length;
+		written += literal_length;
+
+		if (in == end) {
+			terminated = true;
+			break;
+		}
+
+		if (end - in < 2) {
+			return false;
+		}
+
+		const size_t offset = in[0] | (in[1] << 8);
+		in += 2;
+
+		size_t match_length = token & 15;
+		if (match_length == 15 && !read_length(in, end, &match_length)) {
+			return false;
+		}
+		match_length += LZ_MIN_MATCH;
+
+		if (offset == 0 || offset > written || match_length > out_size - written) {
+			return false;
+		}
+
+		// matches may overlap the bytes they produce
+		for (size_t i = 0; i < match_length; ++i, ++written) {
+			out[written] = out[written - offset];
+		}
+	}
+
+	return terminated && written == out_size;
+}
+
+//-----------------------------------------------------------------HEIGHTS---------------------------------------------------------------------------------------------------------
+
+struct PackedRange {
+	float _min;
+	float _max;
+};
+
+// shifted unsigned, shifting a negative value left is undefined before c++20
+static uint16_t zigzag(uint16_t residual) {
+	return static_cast<uint16_t>((residual << 1) ^ (0 - (residual >> 15)));
+}
+
+static uint16_t unzigzag(uint16_t value) {
+	return static_cast<uint16_t>((value >> 1) ^ (0 - (value & 1)));
+}
+
+static uint16_t predict(const uint16_t* q, int x, int z, int width) {
+	const int i = x + z * width;
+	if (x > 0 && z > 0) {
+		return static_cast<uint16_t>(q[i - 1] + q[i - width] - q[i - width - 1]);
+	}
+	if (x > 0) {
+		return q[i - 1];
+	}
+	if (z > 0) {
+		return q[i - width];
+	}
+	return 0;
+}
+
+std::vector<uint8_t> pack_heights(const float* heights, int width, int length) {
+	const size_t count = static_cast<size_t>(width) * length;
+
+	PackedRange range = { 0.0f, 0.0f };
+	if (count) {
+		const auto minmax = std::minmax_element(heights, heights + count);
+		range = { *minmax.first, *minmax.second };
+	}
+
+	const float scale = range._max > range._min ? HEIGHT_STEPS / (range._max - range._min) : 0.0f;
+
+	std::vector<uint16_t> q(count);
+	for (size_t i = 0; i < count; ++i) {
+		q[i] = static_cast<uint16_t>(std::lround((heights[i] - range._min) * scale));
+	}
+
+	// low bytes then high bytes, smooth terrain leaves the high plane almost all zero
+	std::vector<uint8_t> planes(count * 2);
+	for (int z = 0; z < length; ++z) {
+		for (int x = 0; x < width; ++x) {
+			const size_t i = x + static_cast<size_t>(z) * width;
+			const uint16_t residual = zigzag(static_cast<uint16_t>(q[i] - predict(&q[0], x, z, width)));
+			planes[i] = static_cast<uint8_t>(residual & 0xff);
+			planes[i + count] = static_cast<uint8_t>(residual >> 8);
+		}
+	}
+
+	auto packed = lz_compress(planes.data(), planes.size());
+	packed.insert(packed.begin(), reinterpret_cast<const uint8_t*>(&range), reinterpret_cast<const uint8_t*>(&range) + sizeof(PackedRange));
+
+	return packed;
+}
+
+bool unpack_heights(const uint8_t* data, size_t size, float* heights, int width, int length) {
+	if (size < sizeof(PackedRange)) {
+		return false;
+	}
+
+	PackedRange range;
+	std::memcpy(&range, data, sizeof(PackedRange));
+
+	const size_t count = static_cast<size_t>(width) * length;
+	std::vector<uint8_t> planes(count * 2);
+	if (!lz_decompress(data + sizeof(PackedRange), size - sizeof(PackedRange), planes.data(), planes.size())) {
+		return false;
+	}
+
+	const float step = (range._max - range._min) / HEIGHT_STEPS;
+
+	std::vector<uint16_t> q(count);
+	for (int z = 0; z < length; ++z) {
+		for (int x = 0; x < width; ++x) {
+			const size_t i = x + static_cast<size_t>(z) * width;
+			const uint16_t residual = static_cast<uint16_t>(planes[i] | (planes[i + count] << 8));
+			q[i] = static_cast<uint16_t>(predict(&q[0], x, z, width) + unzigzag(residual));
+			heights[i] = range._min + q[i] * step;
+		}
+	}
+
+	return true;
+}
+
+float pack_heights_tolerance(const uint8_t* data, size_t size) {
+	if (size < sizeof(PackedRange)) {
+		return 0.0f;
+	}
+
+	PackedRange range;
+	std::memcpy(&range, data, sizeof(PackedRange));
+
+	// half a step plus float error from dequantizing
+	return (range._max - range._min) / HEIGHT_STEPS * 0.5f + std::max(std::abs(range._min), std::abs(range._max)) * 1e-6f;
+}
+
+//-----------------------------------------------------------------BLEND---------------------------------------------------------------------------------------------------------
+
+std::vector<uint8_t> pack_blend(const glm::vec4* blend, int width, int length) {
+	const size_t count = static_cast<size_t>(width) * length;
+
+	PackedRange ranges[4];
+	for (int c = 0; c < 4; ++c) {
+		ranges[c] = { count ? blend[0][c] : 0.0f, count ? blend[0][c] : 0.0f };
+	}
+	for (size_t i = 0; i < count; ++i) {
+		for (int c = 0; c < 4; ++c) {
+			ranges[c]._min = std::min(ranges[c]._min, blend[i][c]);
+			ranges[c]._max = std::max(ranges[c]._max, blend[i][c]);
+		}
+	}
+
+	std::vector<uint8_t> planes(count * 4);
+	for (int c = 0; c < 4; ++c) {
+		const float scale = ranges[c]._max > ranges[c]._min ? BLEND_STEPS / (ranges[c]._max - ranges[c]._min) : 0.0f;
+		uint8_t* plane = &planes[count * c];
+
+		for (int z = 0; z < length; ++z) {
+			uint8_t previous = 0;
+			for (int x = 0; x < width; ++x) {
+				const size_t i = x + static_cast<size_t>(z) * width;
+				const uint8_t q = static_cast<uint8_t>(std::lround((blend[i][c] - ranges[c]._min) * scale));
+				plane[i] = static_cast<uint8_t>(q - previous);
+				previous = q;
+			}
+		}
+	}
+
+	auto packed = lz_compress(planes.data(), planes.size());
+	packed.insert(packed.begin(), reinterpret_cast<const uint8_t*>(ranges), reinterpret_cast<const uint8_t*>(ranges) + sizeof(ranges));
+
+	return packed;
+}
+
+bool unpack_blend(const uint8_t* data, size_t size, glm::vec4* blend, int width, int length) {
+	PackedRange ranges[4];
+	if (size < sizeof(ranges)) {
+		return false;
+	}
+
+	std::memcpy(ranges, data, sizeof(ranges));
+
+	const size_t count = static_cast<size_t>(width) * length;
+	std::vector<uint8_t> planes(count * 4);
+	if (!lz_decompress(data + sizeof(ranges), size - sizeof(ranges), planes.data(), planes.size())) {
+		return false;
+	}
+
+	for (int c = 0; c < 4; ++c) {
+		const float step = (ranges[c]._max - ranges[c]._min) / BLEND_STEPS;
+		const uint8_t* plane = &planes[count * c];
+
+		for (int z = 0; z < length; ++z) {
+			uint8_t q = 0;
+			for (int x = 0; x < width; ++x) {
+				const size_t i = x + static_cast<size_t>(z) * width;
+				q = static_cast<uint8_t>(q + plane[i]);
+				blend[i][c] = ranges[c]._min + q * step;
+			}
+		}
+	}
+
+	return true;
+}
+
+float pack_blend_tolerance(const uint8_t* data, size_t size) {
+	PackedRange ranges[4];
+	if (size < sizeof(ranges)) {
+		return 0.0f;
+	}
+
+	std::memcpy(ranges, data, sizeof(ranges));
+
+	float tolerance = 0.0f;
+	for (const auto& range : ranges) {
+		tolerance = std::max(tolerance, (range._max - range._min) / BLEND_STEPS * 0.5f + std::max(std::abs(range._min), std::abs(range._max)) * 1e-6f);
+	}
+
+	return tolerance;
+}
+
+//-----------------------------------------------------------------TEXELS---------------------------------------------------------------------------------------------------------
+
+static uint16_t read_channel(const uint8_t* texel, int channel_size) {
+	if (channel_size == 1) {
+		return *texel;
+	}
+
+	uint16_t value;
+	std::memcpy(&value, texel, sizeof(uint16_t));
+	return value;
+}
+
+static void write_channel(uint8_t* texel, uint16_t value, int channel_size) {
+	if (channel_size == 1) {
+		*texel = static_cast<uint8_t>(value);
+	}
+	else {
+		std::memcpy(texel, &value, sizeof(uint16_t));
+	}
+}
+
+// plane c * channel_size + b holds byte b of channel c's deltas, 16 bit deltas wrap like the channels
+std::vector<uint8_t> pack_texels(const uint8_t* texels, int width, int length, int channel_size) {
+	const size_t count = static_cast<size_t>(width) * length;
+	const size_t texel_size = 4 * static_cast<size_t>(channel_size);
+
+	std::vector<uint8_t> planes(count * texel_size);
+	for (int c = 0; c < 4; ++c) {
+		for (int z = 0; z < length; ++z) {
+			uint16_t previous = 0;
+			for (int x = 0; x < width; ++x) {
+				const size_t i = x + static_cast<size_t>(z) * width;
+				const uint16_t value = read_channel(texels + i * texel_size + c * channel_size, channel_size);
+				const uint16_t delta = static_cast<uint16_t>(value - previous);
+				previous = value;
+
+				for (int b = 0; b < channel_size; ++b) {
+					planes[count * (c * channel_size + b) + i] = static_cast<uint8_t>(delta >> (8 * b));
+				}
+			}
+		}
+	}
+
+	return lz_compress(planes.data(), planes.size());
+}
+
+bool unpack_texels(const uint8_t* data, size_t size, uint8_t* texels, int width, int length, int channel_size) {
+	const size_t count = static_cast<size_t>(width) * length;
+	const size_t texel_size = 4 * static_cast<size_t>(channel_size);
+
+	std::vector<uint8_t> planes(count * texel_size);
+	if (!lz_decompress(data, size, planes.data(), planes.size())) {
+		return false;
+	}
+
+	for (int c = 0; c < 4; ++c) {
+		for (int z = 0; z < length; ++z) {
+			uint16_t value = 0;
+			for (int x = 0; x < width; ++x) {
+				const size_t i = x + static_cast<size_t>(z) * width;
+
+				uint16_t delta = 0;
+				for (int b = 0; b < channel_size; ++b) {
+					delta = static_cast<uint16_t>(delta | (planes[count * (c * channel_size + b) + i] << (8 * b)));
+				}
+
+				value = static_cast<uint16_t>(value + delta);
+				write_channel(texels + i * texel_size + c * channel_size, value, channel_size);
+			}
+		}
+	}
+
+	return true;
+}
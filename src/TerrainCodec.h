@@ -0,0 +1,35 @@
+#ifndef TERRAIN_CODEC_H
+#define TERRAIN_CODEC_H
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <cstdint>
+
+/* Compression for terrain chunks
+
+** Heights	-> quantized to 16 bits over the chunk's min/max, predicted from left + up - up left,
+**			   zigzag residuals split into low and high byte planes, lz
+** Blend	-> each channel quantized to 8 bits over the chunk's min/max, delta from the left texel, one plane per channel, lz
+** Texels	-> blend texels already stored as 8 or 16 bit channels, delta from the left texel, one plane per channel byte, lz
+
+** Round trips are within pack_*_tolerance of the original values, texels round trip exactly
+*/
+
+std::vector<uint8_t> pack_heights(const float* heights, int width, int length);
+bool unpack_heights(const uint8_t* data, size_t size, float* heights, int width, int length);
+float pack_heights_tolerance(const uint8_t* data, size_t size);
+
+std::vector<uint8_t> pack_blend(const glm::vec4* blend, int width, int length);
+bool unpack_blend(const uint8_t* data, size_t size, glm::vec4* blend, int width, int length);
+float pack_blend_tolerance(const uint8_t* data, size_t size);
+
+// texels are width * length RGBA texels of channel_size bytes each, 1 or 2
+std::vector<uint8_t> pack_texels(const uint8_t* texels, int width, int length, int channel_size);
+bool unpack_texels(const uint8_t* data, size_t size, uint8_t* texels, int width, int length, int channel_size);
+
+// Byte oriented lz77, 64kb window
+std::vector<uint8_t> lz_compress(const uint8_t* data, size_t size);
+bool lz_decompress(const uint8_t* data, size_t size, uint8_t* out, size_t out_size);
+
+#endif
@@ -0,0 +1,485 @@
+#include "TerrainKernels.h"
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+
+#if defined(TERRAIN_SIMD_AVX)
+#include <immintrin.h>
+#elif defined(TERRAIN_SIMD_SSE2)
+#include <emmintrin.h>
+#endif
+
+// out[2k] = row[k], out[2k + 1] = (row[k] + row[k + 1]) / 2
+static void upsample_row(const float* row, int half, float* out) {
+	int k = 0;
+
+#if defined(TERRAIN_SIMD_AVX)
+	const __m256 half_8 = _mm256_set1_ps(0.5f);
+	for (; k + 8 <= half; k += 8) {
+		const __m256 a = _mm256_loadu_ps(row + k);
+		const __m256 mid = _mm256_mul_ps(_mm256_add_ps(a, _mm256_loadu_ps(row + k + 1)), half_8);
+
+		const __m256 lo = _mm256_unpacklo_ps(a, mid);
+		const __m256 hi = _mm256_unpackhi_ps(a, mid);
+		_mm256_storeu_ps(out + 2 * k, _mm256_permute2f128_ps(lo, hi, 0x20));
+		_mm256_storeu_ps(out + 2 * k + 8, _mm256_permute2f128_ps(lo, hi, 0x31));
+	}
+#elif defined(TERRAIN_SIMD_SSE2)
+	const __m128 half_4 = _mm_set1_ps(0.5f);
+	for (; k + 4 <= half; k += 4) {
+		const __m128 a = _mm_loadu_ps(row + k);
+		const __m128 mid = _mm_mul_ps(_mm_add_ps(a, _mm_loadu_ps(row + k + 1)), half_4);
+
+		_mm_storeu_ps(out + 2 * k, _mm_unpacklo_ps(a, mid));
+		_mm_storeu_ps(out + 2 * k + 4, _mm_unpackhi_ps(a, mid));
+	}
+#endif
+
+	for (; k < half; ++k) {
+		out[2 * k] = row[k];
+		out[2 * k + 1] = (row[k] + row[k + 1]) * 0.5f;
+	}
+
+	out[2 * half] = row[half];
+}
+
+// out[2k] = (top[k] + bottom[k]) / 2, out[2k + 1] = (((bottom[k + 1] + top[k + 1]) + bottom[k]) + top[k]) / 4
+static void upsample_between_rows(const float* top, const float* bottom, int half, float* out) {
+	int k = 0;
+
+#if defined(TERRAIN_SIMD_AVX)
+	const __m256 half_8 = _mm256_set1_ps(0.5f);
+	const __m256 quarter_8 = _mm256_set1_ps(0.25f);
+	for (; k + 8 <= half; k += 8) {
+		const __m256 t = _mm256_loadu_ps(top + k);
+		const __m256 b = _mm256_loadu_ps(bottom + k);
+		const __m256 t1 = _mm256_loadu_ps(top + k + 1);
+		const __m256 b1 = _mm256_loadu_ps(bottom + k + 1);
+
+		const __m256 edge = _mm256_mul_ps(_mm256_add_ps(t, b), half_8);
+		const __m256 center = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_add_ps(b1, t1), b), t), quarter_8);
+
+		const __m256 lo = _mm256_unpacklo_ps(edge, center);
+		const __m256 hi = _mm256_unpackhi_ps(edge, center);
+		_mm256_storeu_ps(out + 2 * k, _mm256_permute2f128_ps(lo, hi, 0x20));
+		_mm256_storeu_ps(out + 2 * k + 8, _mm256_permute2f128_ps(lo, hi, 0x31));
+	}
+#elif defined(TERRAIN_SIMD_SSE2)
+	const __m128 half_4 = _mm_set1_ps(0.5f);
+	const __m128 quarter_4 = _mm_set1_ps(0.25f);
+	for (; k + 4 <= half; k += 4) {
+		const __m128 t = _mm_loadu_ps(top + k);
+		const __m128 b = _mm_loadu_ps(bottom + k);
+		const __m128 t1 = _mm_loadu_ps(top + k + 1);
+		const __m128 b1 = _mm_loadu_ps(bottom + k + 1);
+
+		const __m128 edge = _mm_mul_ps(_mm_add_ps(t, b), half_4);
+		const __m128 center = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_add_ps(b1, t1), b), t), quarter_4);
+
+		_mm_storeu_ps(out + 2 * k, _mm_unpacklo_ps(edge, center));
+		_mm_storeu_ps(out + 2 * k + 4, _mm_unpackhi_ps(edge, center));
+	}
+#endif
+
+	for (; k < half; ++k) {
+		out[2 * k] = (top[k] + bottom[k]) * 0.5f;
+		out[2 * k + 1] = (((bottom[k + 1] + top[k + 1]) + bottom[k]) + top[k]) * 0.25f;
+	}
+
+	out[2 * half] = (top[half] + bottom[half]) * 0.5f;
+}
+
+// halving is exact so * 0.5f / * 0.25f match the old / 2 / 4 averages bit for bit
+void upsample_heights(const float* parent, size_t start, int width, int length, float* out) {
+	const size_t row = static_cast<size_t>(width) + 1;
+	const int half = width / 2;
+
+	for (int z = 0; z <= length; ++z) {
+		const float* top = parent + start + (z / 2) * row;
+		if (z % 2 == 0) {
+			upsample_row(top, half, out + z * row);
+		}
+		else {
+			upsample_between_rows(top, top + row, half, out + z * row);
+		}
+	}
+}
+
+/********************************************************************************************************************************************************/
+
+// Triangle normals of a tile, the cross products of TerrainNode::calc_face_normal written out
+// y is always 1, the * 0.0f terms are kept so signed zeros come out the same as the cross product
+struct FaceRow {
+	float*	_ax;
+	float*	_az;
+	float*	_bx;
+	float*	_bz;
+	float	_y;		// 1, or 0 for rows outside the grid which are all zeros
+};
+
+static void face_normals(float h0, float h1, float h2, float h3, float* ax, float* az, float* bx, float* bz) {
+	const float p = h0 - h1;
+	const float q = h2 - h1;
+	const float r = h3 - h2;
+	const float s = h1 - h2;
+
+	*ax = p - q * 0.0f;
+	*az = p - q;
+	*bx = r * -1.0f - s * 0.0f;
+	*bz = s - r;
+}
+
+static void face_row(const float* top, const float* bottom, int width, const FaceRow& row) {
+	int x = 0;
+
+#if defined(TERRAIN_SIMD_AVX)
+	const __m256 zero_8 = _mm256_setzero_ps();
+	const __m256 minus_8 = _mm256_set1_ps(-1.0f);
+	for (; x + 8 <= width; x += 8) {
+		const __m256 h0 = _mm256_loadu_ps(top + x);
+		const __m256 h1 = _mm256_loadu_ps(top + x + 1);
+		const __m256 h2 = _mm256_loadu_ps(bottom + x);
+		const __m256 h3 = _mm256_loadu_ps(bottom + x + 1);
+
+		const __m256 p = _mm256_sub_ps(h0, h1);
+		const __m256 q = _mm256_sub_ps(h2, h1);
+		const __m256 r = _mm256_sub_ps(h3, h2);
+		const __m256 s = _mm256_sub_ps(h1, h2);
+
+		_mm256_storeu_ps(row._ax + x, _mm256_sub_ps(p, _mm256_mul_ps(q, zero_8)));
+		_mm256_storeu_ps(row._az + x, _mm256_sub_ps(p, q));
+		_mm256_storeu_ps(row._bx + x, _mm256_sub_ps(_mm256_mul_ps(r, minus_8), _mm256_mul_ps(s, zero_8)));
+		_mm256_storeu_ps(row._bz + x, _mm256_sub_ps(s, r));
+	}
+#elif defined(TERRAIN_SIMD_SSE2)
+	const __m128 zero_4 = _mm_setzero_ps();
+	const __m128 minus_4 = _mm_set1_ps(-1.0f);
+	for (; x + 4 <= width; x += 4) {
+		const __m128 h0 = _mm_loadu_ps(top + x);
+		const __m128 h1 = _mm_loadu_ps(top + x + 1);
+		const __m128 h2 = _mm_loadu_ps(bottom + x);
+		const __m128 h3 = _mm_loadu_ps(bottom + x + 1);
+
+		const __m128 p = _mm_sub_ps(h0, h1);
+		const __m128 q = _mm_sub_ps(h2, h1);
+		const __m128 r = _mm_sub_ps(h3, h2);
+		const __m128 s = _mm_sub_ps(h1, h2);
+
+		_mm_storeu_ps(row._ax + x, _mm_sub_ps(p, _mm_mul_ps(q, zero_4)));
+		_mm_storeu_ps(row._az + x, _mm_sub_ps(p, q));
+		_mm_storeu_ps(row._bx + x, _mm_sub_ps(_mm_mul_ps(r, minus_4), _mm_mul_ps(s, zero_4)));
+		_mm_storeu_ps(row._bz + x, _mm_sub_ps(s, r));
+	}
+#endif
+
+	for (; x < width; ++x) {
+		face_normals(top[x], top[x + 1], bottom[x], bottom[x + 1], row._ax + x, row._az + x, row._bx + x, row._bz + x);
+	}
+}
+
+// interior vertices add 6 triangles: a and b of the tile above, b of the tile above left, a and b of the tile to the left and a of their own tile
+// sums start from 0 and add in the order the old per vertex loop did
+static void vertex_row_sums(const float* cur_a, const float* prev_a, const float* prev_b, const float* cur_b, int width, float* out) {
+	int x = 1;
+
+#if defined(TERRAIN_SIMD_AVX)
+	for (; x + 8 <= width; x += 8) {
+		__m256 sum = _mm256_add_ps(_mm256_setzero_ps(), _mm256_loadu_ps(cur_a + x));
+		sum = _mm256_add_ps(sum, _mm256_loadu_ps(prev_a + x));
+		sum = _mm256_add_ps(sum, _mm256_loadu_ps(prev_b + x));
+		sum = _mm256_add_ps(sum, _mm256_loadu_ps(prev_b + x - 1));
+		sum = _mm256_add_ps(sum, _mm256_loadu_ps(cur_a + x - 1));
+		sum = _mm256_add_ps(sum, _mm256_loadu_ps(cur_b + x - 1));
+		_mm256_storeu_ps(out + x, sum);
+	}
+#elif defined(TERRAIN_SIMD_SSE2)
+	for (; x + 4 <= width; x += 4) {
+		__m128 sum = _mm_add_ps(_mm_setzero_ps(), _mm_loadu_ps(cur_a + x));
+		sum = _mm_add_ps(sum, _mm_loadu_ps(prev_a + x));
+		sum = _mm_add_ps(sum, _mm_loadu_ps(prev_b + x));
+		sum = _mm_add_ps(sum, _mm_loadu_ps(prev_b + x - 1));
+		sum = _mm_add_ps(sum, _mm_loadu_ps(cur_a + x - 1));
+		sum = _mm_add_ps(sum, _mm_loadu_ps(cur_b + x - 1));
+		_mm_storeu_ps(out + x, sum);
+	}
+#endif
+
+	for (; x < width; ++x) {
+		out[x] = (((((0.0f + cur_a[x]) + prev_a[x]) + prev_b[x]) + prev_b[x - 1]) + cur_a[x - 1]) + cur_b[x - 1];
+	}
+
+	// the left edge vertex only touches a of its own tile and both triangles of the tile above
+	// the right edge vertex touches both triangles of the tile to its left and b of the tile above left
+	out[0] = ((0.0f + cur_a[0]) + prev_a[0]) + prev_b[0];
+	out[width] = ((0.0f + cur_a[width - 1]) + cur_b[width - 1]) + prev_b[width - 1];
+}
+
+void generate_vertex_normals(const float* heights, int width, int length, int begin, int end, glm::vec3* normals) {
+	const size_t row = static_cast<size_t>(width) + 1;
+
+	// two face rows and the x / z sums of one vertex row, reused by every call on this thread
+	thread_local std::vector<float> scratch;
+	scratch.resize(8 * static_cast<size_t>(width) + 2 * row);
+
+	auto data = scratch.data();
+	FaceRow rows[2];
+	for (auto& face : rows) {
+		face = { data, data + width, data + 2 * width, data + 3 * width, 0.0f };
+		data += 4 * width;
+	}
+	float* sum_x = data;
+	float* sum_z = data + row;
+
+	const auto fill = [&](FaceRow& face, int z) {
+		if (z >= 0 && z < length) {
+			face_row(heights + z * row, heights + (z + 1) * row, width, face);
+			face._y = 1.0f;
+		}
+		else {
+			std::fill(face._ax, face._ax + 4 * width, 0.0f);
+			face._y = 0.0f;
+		}
+	};
+
+	auto prev = &rows[0];
+	auto cur = &rows[1];
+	fill(*prev, begin - 1);
+
+	for (int z = begin; z < end; ++z) {
+		fill(*cur, z);
+
+		vertex_row_sums(cur->_ax, prev->_ax, prev->_bx, cur->_bx, width, sum_x);
+		vertex_row_sums(cur->_az, prev->_az, prev->_bz, cur->_bz, width, sum_z);
+
+		const float left_y = ((0.0f + cur->_y) + prev->_y) + prev->_y;
+		const float y = (((((0.0f + cur->_y) + prev->_y) + prev->_y) + prev->_y) + cur->_y) + cur->_y;
+		const float right_y = ((0.0f + cur->_y) + cur->_y) + prev->_y;
+
+		auto out = normals + z * row;
+		out[0] = glm::vec3(sum_x[0], left_y, sum_z[0]);
+		for (int x = 1; x < width; ++x) {
+			out[x] = glm::vec3(sum_x[x], y, sum_z[x]);
+		}
+		out[width] = glm::vec3(sum_x[width], right_y, sum_z[width]);
+
+		std::swap(prev, cur);
+	}
+}
+
+void generate_padded_normals(const float* heights, int width, int length, int begin, int end, glm::vec3* normals) {
+	// the halo holds vertex rows 0 - length of the inner grid
+	end = std::min(end, length + 1);
+	if (begin >= end) {
+		return;
+	}
+
+	const int padded = width + 2;
+	const size_t row = static_cast<size_t>(padded) + 1;
+
+	thread_local std::vector<float> scratch;
+	scratch.resize(8 * static_cast<size_t>(padded) + 2 * row);
+
+	auto data = scratch.data();
+	FaceRow rows[2];
+	for (auto& face : rows) {
+		face = { data, data + padded, data + 2 * padded, data + 3 * padded, 1.0f };
+		data += 4 * padded;
+	}
+	float* sum_x = data;
+	float* sum_z = data + row;
+
+	// vertex row z of the inner grid is row z + 1 of the padded grid, between face rows z and z + 1
+	auto prev = &rows[0];
+	auto cur = &rows[1];
+	face_row(heights + begin * row, heights + (begin + 1) * row, padded, *prev);
+
+	const float y = (((((0.0f + 1.0f) + 1.0f) + 1.0f) + 1.0f) + 1.0f) + 1.0f;
+	for (int z = begin; z < end; ++z) {
+		face_row(heights + (z + 1) * row, heights + (z + 2) * row, padded, *cur);
+
+		vertex_row_sums(cur->_ax, prev->_ax, prev->_bx, cur->_bx, padded, sum_x);
+		vertex_row_sums(cur->_az, prev->_az, prev->_bz, cur->_bz, padded, sum_z);
+
+		auto out = normals + z * (static_cast<size_t>(width) + 1);
+		for (int x = 0; x <= width; ++x) {
+			out[x] = glm::vec3(sum_x[x + 1], y, sum_z[x + 1]);
+		}
+
+		std::swap(prev, cur);
+	}
+}
+
+// One vertex of generate_vertex_normals, for edits that only touch a few vertices
+glm::vec3 vertex_normal(const float* heights, int width, int length, int x, int z) {
+	const size_t row = static_cast<size_t>(width) + 1;
+
+	const auto face = [&](int fx, int fz, int triangle) {
+		if (fz < 0 || fz >= length) {
+			return glm::vec3(0, 0, 0);
+		}
+
+		const auto top = heights + fz * row + fx;
+		const auto bottom = top + row;
+
+		glm::vec3 a(0, 1, 0), b(0, 1, 0);
+		face_normals(top[0], top[1], bottom[0], bottom[1], &a.x, &a.z, &b.x, &b.z);
+		return triangle == 0 ? a : b;
+	};
+
+	auto normal = glm::vec3(0, 0, 0);
+	if (x == 0) {
+		normal += face(0, z, 0);
+		normal += face(0, z - 1, 0);
+		normal += face(0, z - 1, 1);
+	}
+	else if (x == width) {
+		normal += face(width - 1, z, 0);
+		normal += face(width - 1, z, 1);
+		normal += face(width - 1, z - 1, 1);
+	}
+	else {
+		normal += face(x, z, 0);
+		normal += face(x, z - 1, 0);
+		normal += face(x, z - 1, 1);
+		normal += face(x - 1, z - 1, 1);
+		normal += face(x - 1, z, 0);
+		normal += face(x - 1, z, 1);
+	}
+
+	return normal;
+}
+
+/********************************************************************************************************************************************************/
+
+// The cross product of Terrain::exact_height written out for a = (0, v2, 1), c = (1, v1, 0) and b = (0, v0, 0) or (1, v3, 1) below the diagonal
+// p = a - c and q = b - c, the * 1.0f and * -1.0f terms are kept so signed zeros come out the same as glm::cross
+static void tile_height(float dx, float dz, float v0, float v1, float v2, float v3, glm::vec3 scale, float* height, glm::vec3* normal) {
+	const bool lower = dx + dz > 1.0f;
+	const float py = v2 - v1;
+	const float qx = lower ? 0.0f : -1.0f;
+	const float qy = lower ? v3 - v1 : v0 - v1;
+	const float qz = lower ? 1.0f : 0.0f;
+
+	const float nx = py * qz - qy * 1.0f;
+	const float ny = 1.0f * qx - qz * -1.0f;
+	const float nz = -1.0f * qy - qx * py;
+
+	*height = (v2 - (dx * nx + (dz - 1.0f) * nz) / ny) * scale.y;
+
+	// ny is -1 above the diagonal, multiplying by it turns the normal up
+	if (normal) {
+		const float x = nx * ny / scale.x;
+		const float y = ny * ny / scale.y;
+		const float z = nz * ny / scale.z;
+		const float inverse = 1.0f / std::sqrt((x * x + y * y) + z * z);
+		*normal = glm::vec3(x * inverse, y * inverse, z * inverse);
+	}
+}
+
+static void store_normals(const float* x, const float* y, const float* z, int count, glm::vec3* normals) {
+	for (int i = 0; i < count; ++i) {
+		normals[i] = glm::vec3(x[i], y[i], z[i]);
+	}
+}
+
+#if defined(TERRAIN_SIMD_SSE2)
+// mask ? b : a, SSE2 has no blend
+static __m128 select_4(__m128 mask, __m128 a, __m128 b) {
+	return _mm_or_ps(_mm_and_ps(mask, b), _mm_andnot_ps(mask, a));
+}
+#endif
+
+void tile_heights(const float* dx, const float* dz, const float* v0, const float* v1, const float* v2, const float* v3, size_t count, glm::vec3 scale, float* heights, glm::vec3* normals) {
+	size_t i = 0;
+
+#if defined(TERRAIN_SIMD_AVX)
+	const __m256 zero_8 = _mm256_setzero_ps();
+	const __m256 one_8 = _mm256_set1_ps(1.0f);
+	const __m256 minus_8 = _mm256_set1_ps(-1.0f);
+	const __m256 scale_x = _mm256_set1_ps(scale.x);
+	const __m256 scale_y = _mm256_set1_ps(scale.y);
+	const __m256 scale_z = _mm256_set1_ps(scale.z);
+	for (; i + 8 <= count; i += 8) {
+		const __m256 x = _mm256_loadu_ps(dx + i);
+		const __m256 z = _mm256_loadu_ps(dz + i);
+		const __m256 h0 = _mm256_loadu_ps(v0 + i);
+		const __m256 h1 = _mm256_loadu_ps(v1 + i);
+		const __m256 h2 = _mm256_loadu_ps(v2 + i);
+		const __m256 h3 = _mm256_loadu_ps(v3 + i);
+
+		const __m256 lower = _mm256_cmp_ps(_mm256_add_ps(x, z), one_8, _CMP_GT_OQ);
+		const __m256 py = _mm256_sub_ps(h2, h1);
+		const __m256 qx = _mm256_blendv_ps(minus_8, zero_8, lower);
+		const __m256 qy = _mm256_blendv_ps(_mm256_sub_ps(h0, h1), _mm256_sub_ps(h3, h1), lower);
+		const __m256 qz = _mm256_blendv_ps(zero_8, one_8, lower);
+
+		const __m256 nx = _mm256_sub_ps(_mm256_mul_ps(py, qz), _mm256_mul_ps(qy, one_8));
+		const __m256 ny = _mm256_sub_ps(_mm256_mul_ps(one_8, qx), _mm256_mul_ps(qz, minus_8));
+		const __m256 nz = _mm256_sub_ps(_mm256_mul_ps(minus_8, qy), _mm256_mul_ps(qx, py));
+
+		const __m256 offset = _mm256_div_ps(_mm256_add_ps(_mm256_mul_ps(x, nx), _mm256_mul_ps(_mm256_sub_ps(z, one_8), nz)), ny);
+		_mm256_storeu_ps(heights + i, _mm256_mul_ps(_mm256_sub_ps(h2, offset), scale_y));
+
+		if (normals) {
+			const __m256 wx = _mm256_div_ps(_mm256_mul_ps(nx, ny), scale_x);
+			const __m256 wy = _mm256_div_ps(_mm256_mul_ps(ny, ny), scale_y);
+			const __m256 wz = _mm256_div_ps(_mm256_mul_ps(nz, ny), scale_z);
+			const __m256 length = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(wx, wx), _mm256_mul_ps(wy, wy)), _mm256_mul_ps(wz, wz));
+			const __m256 inverse = _mm256_div_ps(one_8, _mm256_sqrt_ps(length));
+
+			alignas(32) float out_x[8], out_y[8], out_z[8];
+			_mm256_store_ps(out_x, _mm256_mul_ps(wx, inverse));
+			_mm256_store_ps(out_y, _mm256_mul_ps(wy, inverse));
+			_mm256_store_ps(out_z, _mm256_mul_ps(wz, inverse));
+			store_normals(out_x, out_y, out_z, 8, normals + i);
+		}
+	}
+#elif defined(TERRAIN_SIMD_SSE2)
+	const __m128 zero_4 = _mm_setzero_ps();
+	const __m128 one_4 = _mm_set1_ps(1.0f);
+	const __m128 minus_4 = _mm_set1_ps(-1.0f);
+	const __m128 scale_x = _mm_set1_ps(scale.x);
+	const __m128 scale_y = _mm_set1_ps(scale.y);
+	const __m128 scale_z = _mm_set1_ps(scale.z);
+	for (; i + 4 <= count; i += 4) {
+		const __m128 x = _mm_loadu_ps(dx + i);
+		const __m128 z = _mm_loadu_ps(dz + i);
+		const __m128 h0 = _mm_loadu_ps(v0 + i);
+		const __m128 h1 = _mm_loadu_ps(v1 + i);
+		const __m128 h2 = _mm_loadu_ps(v2 + i);
+		const __m128 h3 = _mm_loadu_ps(v3 + i);
+
+		const __m128 lower = _mm_cmpgt_ps(_mm_add_ps(x, z), one_4);
+		const __m128 py = _mm_sub_ps(h2, h1);
+		const __m128 qx = select_4(lower, minus_4, zero_4);
+		const __m128 qy = select_4(lower, _mm_sub_ps(h0, h1), _mm_sub_ps(h3, h1));
+		const __m128 qz = select_4(lower, zero_4, one_4);
+
+		const __m128 nx = _mm_sub_ps(_mm_mul_ps(py, qz), _mm_mul_ps(qy, one_4));
+		const __m128 ny = _mm_sub_ps(_mm_mul_ps(one_4, qx), _mm_mul_ps(qz, minus_4));
+		const __m128 nz = _mm_sub_ps(_mm_mul_ps(minus_4, qy), _mm_mul_ps(qx, py));
+
+		const __m128 offset = _mm_div_ps(_mm_add_ps(_mm_mul_ps(x, nx), _mm_mul_ps(_mm_sub_ps(z, one_4), nz)), ny);
+		_mm_storeu_ps(heights + i, _mm_mul_ps(_mm_sub_ps(h2, offset), scale_y));
+
+		if (normals) {
+			const __m128 wx = _mm_div_ps(_mm_mul_ps(nx, ny), scale_x);
+			const __m128 wy = _mm_div_ps(_mm_mul_ps(ny, ny), scale_y);
+			const __m128 wz = _mm_div_ps(_mm_mul_ps(nz, ny), scale_z);
+			const __m128 length = _mm_add_ps(_mm_add_ps(_mm_mul_ps(wx, wx), _mm_mul_ps(wy, wy)), _mm_mul_ps(wz, wz));
+			const __m128 inverse = _mm_div_ps(one_4, _mm_sqrt_ps(length));
+
+			alignas(16) float out_x[4], out_y[4], out_z[4];
+			_mm_store_ps(out_x, _mm_mul_ps(wx, inverse));
+			_mm_store_ps(out_y, _mm_mul_ps(wy, inverse));
+			_mm_store_ps(out_z, _mm_mul_ps(wz, inverse));
+			store_normals(out_x, out_y, out_z, 4, normals + i);
+		}
+	}
+#endif
+
+	for (; i < count; ++i) {
+		tile_height(dx[i], dz[i], v0[i], v1[i], v2[i], v3[i], scale, heights + i, normals ? normals + i : nullptr);
+	}
+}
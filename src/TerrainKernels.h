@@ -0,0 +1,38 @@
+#ifndef TERRAIN_KERNELS_H
+#define TERRAIN_KERNELS_H
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+
+/* Vectorized terrain grid kernels
+** AVX when the build targets it, SSE2 on x86 otherwise and plain loops everywhere else
+** Every path gives the same bits, sums are taken in the same order as the scalar loops
+*/
+
+#if defined(__AVX__)
+#define TERRAIN_SIMD_AVX
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TERRAIN_SIMD_SSE2
+#endif
+
+// 2x upsampling of one quadrant of a (width + 1) x (length + 1) vertex grid into a grid of the same size
+// start is the quadrant's first vertex in parent, out must not overlap parent
+// even rows copy parent vertices with midpoints between them, odd rows average the parent rows above and below
+void upsample_heights(const float* parent, size_t start, int width, int length, float* out);
+
+// Vertex normals for vertex rows [begin, end) of a (width + 1) x (length + 1) grid, normals is the whole grid
+// each vertex is the sum of the normals of the triangles around it, see TerrainNode::calc_face_normal for the triangles
+// face rows are built once per row as structure of arrays and shared by the two vertex rows they touch
+void generate_vertex_normals(const float* heights, int width, int length, int begin, int end, glm::vec3* normals);
+glm::vec3 vertex_normal(const float* heights, int width, int length, int x, int z);
+
+// Same sums for a grid with a one vertex halo, heights is (width + 3) x (length + 3) and normals is the (width + 1) x (length + 1) grid inside it
+// every vertex has all 6 triangles so normals on a border match the neighbour holding the same vertex
+void generate_padded_normals(const float* heights, int width, int length, int begin, int end, glm::vec3* normals);
+
+// Heights inside count tiles split along the diagonal of Terrain::exact_height, dx, dz are the offsets in each tile and v0 - v3 its corners
+// heights are scaled by scale.y, normals are the unit world normals of the triangles and may be null
+void tile_heights(const float* dx, const float* dz, const float* v0, const float* v1, const float* v2, const float* v3, size_t count, glm::vec3 scale, float* heights, glm::vec3* normals);
+
+#endif
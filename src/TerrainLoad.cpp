@@ -0,0 +1,161 @@
+#include "TerrainLoad.h"
+
+#include "Terrain.h"
+#include "Parallel.h"
+
+#include <algorithm>
+
+TerrainLoader::TerrainLoader(Terrain* terrain) :
+	_terrain				( terrain ),
+	_epoch					( 0 ),
+	_next_id				( 0 ),
+	_busy					( false ),
+	_stop					( false )
+{
+	_thread = std::thread(&TerrainLoader::run, this);
+}
+
+TerrainLoader::~TerrainLoader() {
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_stop = true;
+	}
+
+	_wake.notify_all();
+	_thread.join();
+}
+
+void TerrainLoader::request(const std::vector<glm::ivec2>& coords) {
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	for (const auto& coord : coords) {
+		if (_requested.insert(page_key(coord)).second) {
+			_queue.push_back(coord);
+		}
+	}
+
+	_wake.notify_all();
+}
+
+bool TerrainLoader::pending(glm::ivec2 coord) {
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _requested.count(page_key(coord)) != 0;
+}
+
+std::vector<std::unique_ptr<TerrainPage>> TerrainLoader::take_pages() {
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	auto pages = std::move(_pages);
+	_pages.clear();
+	for (const auto& page : pages) {
+		_requested.erase(page_key(page->_coord));
+	}
+
+	return pages;
+}
+
+std::vector<TerrainLoadNormals> TerrainLoader::take_normals() {
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	auto normals = std::move(_normals);
+	_normals.clear();
+	return normals;
+}
+
+// Normals already queued are kept, they only install on a page with a matching _load_id
+void TerrainLoader::cancel() {
+	std::unique_lock<std::mutex> lock(_mutex);
+
+	++_epoch;
+	_queue.clear();
+	_requested.clear();
+	_pages.clear();
+
+	_idle.wait(lock, [&]() { return !_busy; });
+}
+
+// worker thread, pages are read in batches of one page per core so packed sources decode them in parallel
+void TerrainLoader::run() {
+	const size_t batch_size = std::max(std::thread::hardware_concurrency(), 1u);
+
+	std::unique_lock<std::mutex> lock(_mutex);
+	while (true) {
+		_wake.wait(lock, [&]() { return _stop || !_queue.empty(); });
+		if (_stop) {
+			return;
+		}
+
+		const auto epoch = _epoch;
+		std::vector<glm::ivec2> coords;
+		while (!_queue.empty() && coords.size() < batch_size) {
+			coords.push_back(_queue.front());
+			_queue.pop_front();
+		}
+
+		_busy = true;
+		lock.unlock();
+
+		std::vector<std::unique_ptr<TerrainPage>> pages;
+		std::vector<TerrainPage*> reads;
+		for (const auto& coord : coords) {
+			pages.push_back(std::make_unique<TerrainPage>(_terrain, coord));
+			reads.push_back(pages.back().get());
+		}
+
+		std::vector<bool> found(reads.size(), false);
+		{
+			std::lock_guard<std::mutex> source_lock(_terrain->_source_mutex);
+			if (_terrain->_source) {
+				found = _terrain->_source->read_pages(reads);
+			}
+		}
+
+		// the first stage is drawn lit from straight above, the normals are generated from a copy of the heights
+		const size_t vertices = static_cast<size_t>(_terrain->_width + 1) * (_terrain->_length + 1);
+		std::vector<TerrainNode> nodes;
+		nodes.reserve(pages.size());
+		for (size_t i = 0; i < pages.size(); ++i) {
+			auto& node = pages[i]->_node;
+			if (!found[i]) {
+				node._heights.assign(vertices, 0.0f);
+			}
+			node._pyramid.build(node._heights.data(), _terrain->_width, _terrain->_length);
+			node._normals.assign(vertices, glm::vec3(0, 1, 0));
+			pages[i]->_stage = PAGE_LOADING;
+
+			nodes.emplace_back(_terrain, nullptr, node._space, node._quad);
+			nodes.back()._heights = node._heights;
+		}
+
+		lock.lock();
+
+		std::vector<TerrainLoadNormals> normals(pages.size());
+		for (size_t i = 0; i < pages.size(); ++i) {
+			pages[i]->_load_id = ++_next_id;
+			normals[i]._coord = pages[i]->_coord;
+			normals[i]._load_id = pages[i]->_load_id;
+
+			if (epoch == _epoch) {
+				_pages.push_back(std::move(pages[i]));
+			}
+		}
+
+		lock.unlock();
+
+		parallel_for(nodes.size(), [&](size_t i) {
+			nodes[i].generate_normals(false);
+			normals[i]._normals = std::move(nodes[i]._normals);
+			normals[i]._face_normals = std::move(nodes[i]._face_normals);
+		});
+
+		pages.clear();
+		lock.lock();
+
+		for (auto& result : normals) {
+			_normals.push_back(std::move(result));
+		}
+
+		_busy = false;
+		_idle.notify_all();
+	}
+}
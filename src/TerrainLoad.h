@@ -0,0 +1,72 @@
+#ifndef TERRAIN_LOAD_H
+#define TERRAIN_LOAD_H
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <unordered_set>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <array>
+
+class Terrain;
+struct TerrainPage;
+
+/* Background page loading
+** Requested pages are read and prepared on a worker thread, the render thread picks them up in stages from Terrain::update
+
+** 1 -> heights and blend map are read, the page is drawable at its root lod with flat normals
+** 2 -> normals are generated from a copy of the heights, the page can be subdivided once they are installed
+** Blend tiles are uploaded by the render thread within TerrainPageSettings::_upload_budget bytes per frame
+
+** Normals are matched to their page by _load_id, results for pages that were evicted, edited or reloaded are dropped
+*/
+
+struct TerrainLoadNormals {
+	glm::ivec2								_coord;
+	uint64_t								_load_id;
+	std::vector<glm::vec3>					_normals;
+	std::vector<std::array<glm::vec3, 2>>	_face_normals;
+};
+
+class TerrainLoader {
+public:
+	TerrainLoader(Terrain* terrain);
+	~TerrainLoader();
+
+	TerrainLoader(const TerrainLoader&) = delete;
+	TerrainLoader& operator=(const TerrainLoader&) = delete;
+
+	// render thread
+	void request(const std::vector<glm::ivec2>& coords);
+	bool pending(glm::ivec2 coord);
+	std::vector<std::unique_ptr<TerrainPage>> take_pages();
+	std::vector<TerrainLoadNormals> take_normals();
+
+	// drops queued requests and pages that haven't been picked up, waits for the batch being read
+	void cancel();
+private:
+	void run();
+
+	Terrain*									_terrain;
+
+	std::mutex									_mutex;
+	std::condition_variable						_wake;
+	std::condition_variable						_idle;
+	std::thread									_thread;
+
+	std::deque<glm::ivec2>						_queue;
+	std::unordered_set<uint64_t>				_requested;
+	std::vector<std::unique_ptr<TerrainPage>>	_pages;
+	std::vector<TerrainLoadNormals>				_normals;
+
+	uint64_t									_epoch;
+	uint64_t									_next_id;
+	bool										_busy;
+	bool										_stop;
+};
+
+#endif
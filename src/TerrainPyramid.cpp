@@ -0,0 +1,148 @@
+#include "TerrainPyramid.h"
+
+#include <algorithm>
+#include <limits>
+
+void TerrainPyramid::build(const float* heights, int width, int length) {
+	_width = width;
+	_length = length;
+	_sizes.clear();
+	_levels.clear();
+
+	_sizes.push_back(glm::ivec2(width, length));
+	_levels.emplace_back(static_cast<size_t>(width) * length);
+
+	const size_t row = static_cast<size_t>(width) + 1;
+	auto& tiles = _levels[0];
+	for (int z = 0; z < length; ++z) {
+		const auto top = heights + z * row;
+		const auto bottom = top + row;
+		for (int x = 0; x < width; ++x) {
+			tiles[x + z * width] = glm::vec2(std::min(std::min(top[x], top[x + 1]), std::min(bottom[x], bottom[x + 1])),
+											 std::max(std::max(top[x], top[x + 1]), std::max(bottom[x], bottom[x + 1])));
+		}
+	}
+
+	while (_sizes.back().x > 1 || _sizes.back().y > 1) {
+		const auto size = (_sizes.back() + 1) / 2;
+		const int level = static_cast<int>(_levels.size());
+
+		_sizes.push_back(size);
+		_levels.emplace_back(static_cast<size_t>(size.x) * size.y);
+		for (int z = 0; z < size.y; ++z) {
+			for (int x = 0; x < size.x; ++x) {
+				_levels[level][x + z * size.x] = reduce(level, x, z);
+			}
+		}
+	}
+}
+
+// Vertex x, z is a corner of up to 4 tiles, each level above has at most 2x2 cells over them
+void TerrainPyramid::update(const float* heights, int x, int z) {
+	if (empty()) {
+		return;
+	}
+
+	const size_t row = static_cast<size_t>(_width) + 1;
+	const int min_x = std::max(x - 1, 0);
+	const int min_z = std::max(z - 1, 0);
+	const int max_x = std::min(x, _width - 1);
+	const int max_z = std::min(z, _length - 1);
+
+	for (int tile_z = min_z; tile_z <= max_z; ++tile_z) {
+		for (int tile_x = min_x; tile_x <= max_x; ++tile_x) {
+			const auto top = heights + tile_z * row + tile_x;
+			const auto bottom = top + row;
+			_levels[0][tile_x + tile_z * _width] = glm::vec2(std::min(std::min(top[0], top[1]), std::min(bottom[0], bottom[1])),
+															 std::max(std::max(top[0], top[1]), std::max(bottom[0], bottom[1])));
+		}
+	}
+
+	for (int level = 1; level < levels(); ++level) {
+		for (int cell_z = min_z >> level; cell_z <= max_z >> level; ++cell_z) {
+			for (int cell_x = min_x >> level; cell_x <= max_x >> level; ++cell_x) {
+				_levels[level][cell_x + cell_z * _sizes[level].x] = reduce(level, cell_x, cell_z);
+			}
+		}
+	}
+}
+
+void TerrainPyramid::clear() {
+	std::vector<glm::ivec2>().swap(_sizes);
+	std::vector<std::vector<glm::vec2>>().swap(_levels);
+}
+
+bool TerrainPyramid::empty() const {
+	return _levels.empty();
+}
+
+int TerrainPyramid::levels() const {
+	return static_cast<int>(_levels.size());
+}
+
+glm::ivec2 TerrainPyramid::size(int level) const {
+	return _sizes[level];
+}
+
+glm::vec2 TerrainPyramid::cell(int level, int x, int z) const {
+	return _levels[level][x + z * _sizes[level].x];
+}
+
+glm::vec2 TerrainPyramid::bounds(int min_x, int min_z, int max_x, int max_z) const {
+	if (empty() || min_x >= max_x || min_z >= max_z) {
+		return glm::vec2(std::numeric_limits<float>::max(), std::numeric_limits<float>::lowest());
+	}
+
+	return bounds(levels() - 1, 0, 0, glm::ivec4(min_x, min_z, max_x, max_z));
+}
+
+size_t TerrainPyramid::bytes() const {
+	size_t bytes = 0;
+	for (const auto& level : _levels) {
+		bytes += sizeof(glm::vec2) * level.capacity();
+	}
+
+	return bytes;
+}
+
+glm::vec2 TerrainPyramid::reduce(int level, int x, int z) const {
+	const auto& below = _levels[level - 1];
+	const auto size = _sizes[level - 1];
+
+	auto range = glm::vec2(std::numeric_limits<float>::max(), std::numeric_limits<float>::lowest());
+	for (int j = 2 * z; j < std::min(2 * z + 2, size.y); ++j) {
+		for (int i = 2 * x; i < std::min(2 * x + 2, size.x); ++i) {
+			const auto cell = below[i + j * size.x];
+			range = glm::vec2(std::min(range.x, cell.x), std::max(range.y, cell.y));
+		}
+	}
+
+	return range;
+}
+
+// Cells inside rect are taken whole, cells on its border are split down to the tiles
+glm::vec2 TerrainPyramid::bounds(int level, int x, int z, const glm::ivec4& rect) const {
+	const int min_x = x << level;
+	const int min_z = z << level;
+	const int max_x = std::min((x + 1) << level, _width);
+	const int max_z = std::min((z + 1) << level, _length);
+
+	if (max_x <= rect.x || max_z <= rect.y || min_x >= rect.z || min_z >= rect.w) {
+		return glm::vec2(std::numeric_limits<float>::max(), std::numeric_limits<float>::lowest());
+	}
+
+	if (level == 0 || (min_x >= rect.x && min_z >= rect.y && max_x <= rect.z && max_z <= rect.w)) {
+		return cell(level, x, z);
+	}
+
+	auto range = glm::vec2(std::numeric_limits<float>::max(), std::numeric_limits<float>::lowest());
+	const auto below = _sizes[level - 1];
+	for (int j = 2 * z; j < std::min(2 * z + 2, below.y); ++j) {
+		for (int i = 2 * x; i < std::min(2 * x + 2, below.x); ++i) {
+			const auto child = bounds(level - 1, i, j, rect);
+			range = glm::vec2(std::min(range.x, child.x), std::max(range.y, child.y));
+		}
+	}
+
+	return range;
+}
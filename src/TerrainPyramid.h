@@ -0,0 +1,45 @@
+#ifndef TERRAIN_PYRAMID_H
+#define TERRAIN_PYRAMID_H
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <cstddef>
+
+/* Min/max height pyramid of a page's root grid
+** Level 0 holds the lowest and highest corner of every tile, each level above reduces 2x2 cells of the one below
+** until a single cell covers the page, odd sizes round up and the last cell of a row covers what is left
+
+** Rays skip every cell they pass over or under without looking at its tiles, see Terrain::raycast
+** An edit updates the tiles around the vertex and the cells above them, one cell per level
+*/
+
+class TerrainPyramid {
+public:
+	// heights is the (width + 1) x (length + 1) vertex grid
+	void build(const float* heights, int width, int length);
+	void update(const float* heights, int x, int z);
+	void clear();
+
+	bool empty() const;
+	int levels() const;
+	glm::ivec2 size(int level) const;
+
+	// min, max height of a cell, level 0 cells are tiles
+	glm::vec2 cell(int level, int x, int z) const;
+
+	// min, max height over tiles [min_x, max_x) x [min_z, max_z)
+	glm::vec2 bounds(int min_x, int min_z, int max_x, int max_z) const;
+
+	size_t bytes() const;
+private:
+	glm::vec2 reduce(int level, int x, int z) const;
+	glm::vec2 bounds(int level, int x, int z, const glm::ivec4& rect) const;
+
+	int										_width;
+	int										_length;
+	std::vector<glm::ivec2>					_sizes;
+	std::vector<std::vector<glm::vec2>>		_levels;
+};
+
+#endif
@@ -0,0 +1,495 @@
+#include "TerrainRender.h"
+
+#include <SOIL/SOIL2.h>
+#include <iostream>
+#include <algorithm>
+#include <limits>
+
+constexpr size_t TILE_VERTICES_SIZE = 12;
+
+constexpr GLfloat TILE_VERTICES[] = {
+	0.0f, 1.0f, 0.0f, 0.0f, 1.0f, 0.0f,
+	0.0f, 1.0f, 1.0f, 1.0f, 1.0f, 0.0f
+};
+
+constexpr GLfloat TILE_UVS[] = {
+	0.0f, 1.0f, 0.0f, 0.0f, 1.0f, 0.0f,
+	0.0f, 1.0f, 1.0f, 1.0f, 1.0f, 0.0f
+};
+
+// dirty rect of a node buffer with nothing to upload
+constexpr int CLEAN_RECT = std::numeric_limits<int>::max();
+
+//-----------------------------------------------------------Grass MESH---------------------------------------------------------------------------------------------------------
+
+GrassMesh::GrassMesh(Program* program) :
+	_program ( program )
+{
+	create_buffers();
+}
+
+void GrassMesh::create_buffers() {
+	glCreateBuffers(1, &_vertex_buffer);
+	glBindBuffer(GL_ARRAY_BUFFER, _vertex_buffer);
+	glNamedBufferStorage(_vertex_buffer, sizeof(GLfloat) * TILE_VERTICES_SIZE, TILE_VERTICES, 0);
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, (void*)0);
+}
+
+void GrassMesh::draw(glm::vec3 position) {
+	glUseProgram(_program->_id);
+
+	glBindBuffer(GL_ARRAY_BUFFER, _vertex_buffer);
+
+	glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, TILE_VERTICES_SIZE / 2, 1);
+}
+
+//-----------------------------------------------------------TERRAIN MESH---------------------------------------------------------------------------------------------------------
+
+TerrainMesh::TerrainMesh(Terrain* root, TerrainShaders shaders) :
+	_root			( root ),
+	_frame			( 0 ),
+	_program		( shaders._terrain ),
+	_brush_program	( shaders._brush ),
+	_mode			( TERRAIN_DRAW_QUADTREE )
+{
+	create_buffers();
+	create_tile_textures();
+
+	if (shaders._clipmap) {
+		_clipmap = std::make_unique<TerrainClipmap>(root, shaders._clipmap);
+	}
+}
+
+TerrainMesh::~TerrainMesh() {
+	release_node_buffers();
+}
+
+void TerrainMesh::create_buffers() {
+	glCreateBuffers(1, &_vertex_buffer);
+	glBindBuffer(GL_ARRAY_BUFFER, _vertex_buffer);
+	glNamedBufferStorage(_vertex_buffer, sizeof(GLfloat) * TILE_VERTICES_SIZE, TILE_VERTICES, 0);
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, (void*)0);
+
+	glCreateBuffers(1, &_uv_buffer);
+	glBindBuffer(GL_ARRAY_BUFFER, _uv_buffer);
+	glNamedBufferStorage(_uv_buffer, sizeof(GLfloat) * TILE_VERTICES_SIZE, TILE_UVS, 0);
+	glEnableVertexAttribArray(1);
+	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, (void*)0);
+}
+
+void TerrainMesh::create_tile_textures() {
+	const auto create_texture = [](GLuint* texture, int active_texture, const char* file) {
+		glActiveTexture(active_texture);
+
+		*texture = SOIL_load_OGL_texture(file, SOIL_LOAD_AUTO, SOIL_CREATE_NEW_ID, 0);
+		if (*texture == 0) {
+			std::cout << "SOIL FAILED TO LOAD TILE TEXTURE" << '\n';
+		}
+
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+
+		glBindTexture(GL_TEXTURE_2D, *texture);
+	};
+
+	create_texture(&_tile_textures[0], GL_TEXTURE3, "Data\\t1.png");
+	create_texture(&_tile_textures[1], GL_TEXTURE4, "Data\\t2.png");
+	create_texture(&_tile_textures[2], GL_TEXTURE5, "Data\\t3.png");
+	create_texture(&_tile_textures[3], GL_TEXTURE6, "Data\\t4.png");
+}
+
+void TerrainMesh::bind_page(TerrainPage* page) {
+	glUseProgram(_program->_id);
+
+	glUniform2f(glGetUniformLocation(_program->_id, "origin"), (float)page->_origin.x, (float)page->_origin.y);
+
+	glActiveTexture(GL_TEXTURE2);
+	glBindTexture(GL_TEXTURE_2D, _page_textures.at(page)._texture);
+}
+
+// Nodes of every page are handed to the terrain together so their grids are built in one batch before anything is drawn
+// nodes outside the frustum are never selected so their grids aren't built either
+void TerrainMesh::draw(glm::vec3 camera_position, const TerrainFrustum& frustum) {
+	++_frame;
+	_buffer_stats._uploaded = 0;
+
+	if (_mode == TERRAIN_DRAW_CLIPMAP && _clipmap) {
+		_clipmap->draw(camera_position);
+		return;
+	}
+
+	std::vector<TerrainDrawNode> selected;
+	_root->select_nodes(camera_position, frustum, &selected);
+
+	std::vector<TerrainNode*> nodes;
+	nodes.reserve(selected.size());
+	for (const auto& node : selected) {
+		nodes.push_back(node._node);
+	}
+
+	_root->use_nodes(nodes);
+
+	// selection walks page by page, a page is bound when its first node comes up
+	const TerrainPage* bound = nullptr;
+	for (const auto& node : selected) {
+		if (node._page != bound) {
+			bind_page(node._page);
+			bound = node._page;
+		}
+
+		draw(node, camera_position);
+	}
+
+	evict_node_buffers();
+}
+
+// Each quadrant the node draws is one instanced rectangle of its tiles, child nodes hang a skirt from each rectangle's border
+// edges facing a coarser node are stitched by morphing, the skirt covers what is left while that node morphs toward its own parent
+void TerrainMesh::draw(const TerrainDrawNode& draw_node, glm::vec3 camera_position) {
+	const auto node = draw_node._node;
+
+	glUseProgram(_program->_id);
+
+	glBindBuffer(GL_ARRAY_BUFFER, _vertex_buffer);
+	glBindBuffer(GL_ARRAY_BUFFER, _uv_buffer);
+
+	glUniform1i(glGetUniformLocation(_program->_id, "width"), node->_root->_width);
+	glUniform1i(glGetUniformLocation(_program->_id, "length"), node->_root->_length);
+	glUniform1f(glGetUniformLocation(_program->_id, "space"), node->_space);
+	glUniform4f(glGetUniformLocation(_program->_id, "quad"), node->_quad.x, node->_quad.y, node->_quad.z, node->_quad.w);
+	glUniformMatrix4fv(glGetUniformLocation(_program->_id, "model"), 1, GL_FALSE, &node->_root->_transform.get_model()[0][0]);
+	glUniform3fv(glGetUniformLocation(_program->_id, "camera"), 1, &camera_position[0]);
+	glUniform2f(glGetUniformLocation(_program->_id, "morph"), draw_node._morph.x, draw_node._morph.y);
+	glUniform1i(glGetUniformLocation(_program->_id, "edges"), draw_node._edges);
+
+	glUniform3fv(glGetUniformLocation(_program->_id, "test_light_position"), 1, &node->_root->_brush_mesh->_position[0]);
+
+	bind_node(node);
+
+	const int width = node->_root->_width / 2;
+	const int length = node->_root->_length / 2;
+	const float skirt = node->_parent ? node->_space * TERRAIN_SKIRT : 0.0f;
+
+	const auto draw_rect = [&](int x, int z, int width, int length) {
+		glUniform4i(glGetUniformLocation(_program->_id, "tiles"), x, z, width, length);
+		glUniform1f(glGetUniformLocation(_program->_id, "skirt"), 0.0f);
+		glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, TILE_VERTICES_SIZE / 2, width * length);
+
+		if (skirt > 0.0f) {
+			glUniform1f(glGetUniformLocation(_program->_id, "skirt"), skirt);
+			glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, TILE_VERTICES_SIZE / 2, 2 * (width + length));
+		}
+	};
+
+	if (draw_node._quadrants == 0xF) {
+		draw_rect(0, 0, width * 2, length * 2);
+		return;
+	}
+
+	for (int i = 0; i < 4; ++i) {
+		if (draw_node._quadrants & (1 << i)) {
+			draw_rect((i % 2) * width, (i / 2) * length, width, length);
+		}
+	}
+}
+
+void TerrainMesh::draw_brush() {
+	const auto brush = _root->_brush_mesh.get();
+	auto page = _root->page_at(static_cast<int>(floor(brush->_position.x)), static_cast<int>(floor(brush->_position.z)));
+	if (!page) {
+		return;
+	}
+
+	glUseProgram(_brush_program->_id);
+
+	bind_node(&page->_node);
+
+	glUniformMatrix4fv(glGetUniformLocation(_brush_program->_id, "model"), 1, GL_FALSE, &_root->_transform.get_model()[0][0]);
+	glUniform1i(glGetUniformLocation(_brush_program->_id, "width"), _root->_width);
+	glUniform1i(glGetUniformLocation(_brush_program->_id, "length"), _root->_length);
+	glUniform3fv(glGetUniformLocation(_brush_program->_id, "position"), 1, &brush->_position[0]);
+	glUniform1f(glGetUniformLocation(_brush_program->_id, "radius"), brush->_radius);
+	glUniform2f(glGetUniformLocation(_brush_program->_id, "origin"), (float)page->_origin.x, (float)page->_origin.y);
+
+	glDrawArrays(GL_POINTS, 0, 1);
+}
+
+// Every page has the same grid size, buffers of the old size are dropped
+void TerrainMesh::resize(int /*width*/, int /*length*/) {
+	release_node_buffers();
+}
+
+//-----------------------------------------------------------------NODE BUFFERS-------------------------------------------------------------------------------------------------------
+
+// A node seen for the first time or rebuilt since it was last bound is uploaded whole, edits to a root grid upload the rows they touched
+// a static view uploads nothing
+void TerrainMesh::bind_node(const TerrainNode* node) {
+	auto found = _node_buffers.find(node);
+	if (found == _node_buffers.end()) {
+		found = _node_buffers.emplace(node, create_node_buffers()).first;
+	}
+
+	auto& buffers = found->second;
+	if (buffers._version != node->_version) {
+		glNamedBufferSubData(buffers._height_buffer, 0, sizeof(GLfloat) * node->_heights.size(), node->_heights.data());
+		glNamedBufferSubData(buffers._normal_buffer, 0, sizeof(glm::vec3) * node->_normals.size(), node->_normals.data());
+		_buffer_stats._uploaded += sizeof(GLfloat) * node->_heights.size() + sizeof(glm::vec3) * node->_normals.size();
+	}
+	else if (buffers._dirty.x <= buffers._dirty.z) {
+		const auto dirty = buffers._dirty;
+		const size_t row = static_cast<size_t>(_root->_width) + 1;
+		const size_t count = dirty.z - dirty.x + 1;
+
+		for (int z = dirty.y; z <= dirty.w; ++z) {
+			const size_t first = dirty.x + z * row;
+			glNamedBufferSubData(buffers._height_buffer, sizeof(GLfloat) * first, sizeof(GLfloat) * count, &node->_heights[first]);
+			glNamedBufferSubData(buffers._normal_buffer, sizeof(glm::vec3) * first, sizeof(glm::vec3) * count, &node->_normals[first]);
+		}
+		_buffer_stats._uploaded += (sizeof(GLfloat) + sizeof(glm::vec3)) * count * (dirty.w - dirty.y + 1);
+	}
+
+	buffers._version = node->_version;
+	buffers._dirty = glm::ivec4(CLEAN_RECT, CLEAN_RECT, -CLEAN_RECT, -CLEAN_RECT);
+	buffers._last_used = _frame;
+
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_BUFFER, buffers._height_texture);
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_BUFFER, buffers._normal_texture);
+}
+
+// Evicted buffers are taken first, a version of 0 is never given to a node so the first bind uploads
+TerrainNodeBuffers TerrainMesh::create_node_buffers() {
+	TerrainNodeBuffers buffers;
+	if (!_free_buffers.empty()) {
+		buffers = _free_buffers.back();
+		_free_buffers.pop_back();
+	}
+	else {
+		const size_t vertices = (static_cast<size_t>(_root->_width) + 1) * (static_cast<size_t>(_root->_length) + 1);
+
+		glCreateBuffers(1, &buffers._height_buffer);
+		glNamedBufferStorage(buffers._height_buffer, sizeof(GLfloat) * vertices, nullptr, GL_DYNAMIC_STORAGE_BIT);
+		glCreateTextures(GL_TEXTURE_BUFFER, 1, &buffers._height_texture);
+		glTextureBuffer(buffers._height_texture, GL_R32F, buffers._height_buffer);
+
+		glCreateBuffers(1, &buffers._normal_buffer);
+		glNamedBufferStorage(buffers._normal_buffer, sizeof(glm::vec3) * vertices, nullptr, GL_DYNAMIC_STORAGE_BIT);
+		glCreateTextures(GL_TEXTURE_BUFFER, 1, &buffers._normal_texture);
+		glTextureBuffer(buffers._normal_texture, GL_RGB32F, buffers._normal_buffer);
+	}
+
+	buffers._version = 0;
+	buffers._dirty = glm::ivec4(CLEAN_RECT, CLEAN_RECT, -CLEAN_RECT, -CLEAN_RECT);
+	buffers._last_used = _frame;
+
+	return buffers;
+}
+
+void TerrainMesh::release_node_buffers() {
+	const auto release = [](TerrainNodeBuffers& buffers) {
+		glDeleteTextures(1, &buffers._height_texture);
+		glDeleteTextures(1, &buffers._normal_texture);
+		glDeleteBuffers(1, &buffers._height_buffer);
+		glDeleteBuffers(1, &buffers._normal_buffer);
+	};
+
+	for (auto& entry : _node_buffers) {
+		release(entry.second);
+	}
+	for (auto& buffers : _free_buffers) {
+		release(buffers);
+	}
+
+	_node_buffers.clear();
+	_free_buffers.clear();
+	_buffer_stats._buffers = 0;
+	_buffer_stats._bytes = 0;
+}
+
+// Buffers are evicted least recently drawn first once over the budget the child grids use, buffers bound this frame are kept
+void TerrainMesh::evict_node_buffers() {
+	const size_t bytes = node_buffer_bytes();
+	size_t held = _node_buffers.size();
+
+	if (held * bytes > _root->_page_settings._node_budget) {
+		std::vector<std::pair<uint64_t, const TerrainNode*>> used;
+		used.reserve(held);
+		for (const auto& entry : _node_buffers) {
+			used.push_back({ entry.second._last_used, entry.first });
+		}
+
+		std::sort(used.begin(), used.end());
+
+		for (const auto& entry : used) {
+			if (held * bytes <= _root->_page_settings._node_budget || entry.first == _frame) {
+				break;
+			}
+
+			const auto found = _node_buffers.find(entry.second);
+			_free_buffers.push_back(found->second);
+			_node_buffers.erase(found);
+			--held;
+			++_buffer_stats._evictions;
+		}
+	}
+
+	_buffer_stats._buffers = _node_buffers.size();
+	_buffer_stats._bytes = (_node_buffers.size() + _free_buffers.size()) * bytes;
+}
+
+size_t TerrainMesh::node_buffer_bytes() const {
+	const size_t vertices = (static_cast<size_t>(_root->_width) + 1) * (static_cast<size_t>(_root->_length) + 1);
+	return (sizeof(GLfloat) + sizeof(glm::vec3)) * vertices;
+}
+
+//-----------------------------------------------------------------BLEND TEXTURES-------------------------------------------------------------------------------------------------------
+
+static GLenum blend_texture_format(int format) {
+	switch (format) {
+	case BLEND_FORMAT_RGBA16:	return GL_RGBA16;
+	case BLEND_FORMAT_RGBA8:	return GL_RGBA8;
+	default:					return GL_RGBA32F;
+	}
+}
+
+static GLenum blend_texture_type(int format) {
+	switch (format) {
+	case BLEND_FORMAT_RGBA16:	return GL_UNSIGNED_SHORT;
+	case BLEND_FORMAT_RGBA8:	return GL_UNSIGNED_BYTE;
+	default:					return GL_FLOAT;
+	}
+}
+
+// unpainted tiles are cleared on the gpu, painted tiles are queued for upload_page
+// the texture keeps the blend map's format, quantized maps are sampled as normalized weights
+void TerrainMesh::create_page(TerrainPage* page) {
+	auto& texture = _page_textures[page];
+
+	glGenTextures(1, &texture._texture);
+	glActiveTexture(GL_TEXTURE2);
+	glBindTexture(GL_TEXTURE_2D, texture._texture);
+
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+	const auto format = page->_blend_map.format();
+	glTexImage2D(GL_TEXTURE_2D, 0, blend_texture_format(format), BLEND_MAP_SIZE, BLEND_MAP_SIZE, 0, GL_RGBA, blend_texture_type(format), nullptr);
+	glClearTexImage(texture._texture, 0, GL_RGBA, blend_texture_type(format), nullptr);
+	for (int i = 0; i < BLEND_TILE_COUNT; ++i) {
+		texture._upload_tiles.set(i, page->_blend_map.tile(i) != nullptr);
+	}
+	update_heights(page->_origin.x, page->_origin.y, _root->_width + 1, _root->_length + 1);
+}
+
+// The edited vertices and the normals around them are marked on the root grids holding them, the next bind uploads those rows
+// child grids near an edit are rebuilt by the terrain and upload whole with their new version
+void TerrainMesh::update_heights(int x, int z, int width, int length) {
+	if (_clipmap) {
+		_clipmap->invalidate(x, z, width, length);
+	}
+
+	const auto min = glm::ivec2(x - 1, z - 1);
+	const auto max = glm::ivec2(x + width, z + length);
+
+	// a vertex on a page edge is also the last vertex of the page before it
+	for (auto page : _root->pages_within(glm::vec2(min - 1), glm::vec2(max))) {
+		const auto found = _node_buffers.find(&page->_node);
+		if (found == _node_buffers.end()) {
+			continue;
+		}
+
+		const auto first = glm::max(min - page->_origin, glm::ivec2(0));
+		const auto last = glm::min(max - page->_origin, glm::ivec2(_root->_width, _root->_length));
+		if (first.x > last.x || first.y > last.y) {
+			continue;
+		}
+
+		auto& dirty = found->second._dirty;
+		dirty = glm::ivec4(glm::min(glm::ivec2(dirty.x, dirty.y), first), glm::max(glm::ivec2(dirty.z, dirty.w), last));
+	}
+}
+
+void TerrainMesh::release_page(TerrainPage* page) {
+	const auto texture = _page_textures.find(page);
+	if (texture == _page_textures.end()) {
+		return;
+	}
+
+	update_heights(page->_origin.x, page->_origin.y, _root->_width + 1, _root->_length + 1);
+
+	const auto buffers = _node_buffers.find(&page->_node);
+	if (buffers != _node_buffers.end()) {
+		_free_buffers.push_back(buffers->second);
+		_node_buffers.erase(buffers);
+	}
+
+	glDeleteTextures(1, &texture->second._texture);
+	_page_textures.erase(texture);
+}
+
+// Tiles painted since they were queued upload their current texels, tiles trimmed since were already cleared
+size_t TerrainMesh::upload_page(TerrainPage* page, size_t budget) {
+	auto& queued = _page_textures.at(page)._upload_tiles;
+
+	size_t uploaded = 0;
+	for (int i = 0; i < BLEND_TILE_COUNT && queued.any() && uploaded < budget; ++i) {
+		if (!queued.test(i)) {
+			continue;
+		}
+
+		queued.reset(i);
+		if (page->_blend_map.tile(i)) {
+			upload_blend_tile(page, i);
+			uploaded += page->_blend_map.tile_bytes();
+		}
+	}
+
+	if (uploaded && queued.none()) {
+		glGenerateMipmap(GL_TEXTURE_2D);
+	}
+
+	return uploaded;
+}
+
+void TerrainMesh::upload_blend_tile(TerrainPage* page, int index) {
+	const auto rect = BlendMap::tile_rect(index);
+	upload_blend_region(page, rect.x, rect.y, rect.z, rect.w);
+}
+
+// x, z, width, length are blend map texels, each tile overlapping the region uploads its part of it
+void TerrainMesh::upload_blend_region(TerrainPage* page, int x, int z, int width, int length) {
+	const auto texture = _page_textures.at(page)._texture;
+	const auto& blend_map = page->_blend_map;
+
+	glActiveTexture(GL_TEXTURE2);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, BLEND_TILE_SIZE);
+
+	const auto type = blend_texture_type(blend_map.format());
+	const auto texel_size = BlendMap::texel_size(blend_map.format());
+
+	for (int tile_z = z / BLEND_TILE_SIZE; tile_z <= (z + length - 1) / BLEND_TILE_SIZE; ++tile_z) {
+		for (int tile_x = x / BLEND_TILE_SIZE; tile_x <= (x + width - 1) / BLEND_TILE_SIZE; ++tile_x) {
+			const auto rect = BlendMap::tile_rect(tile_x + tile_z * BLEND_TILES);
+
+			const int start_x = std::max(x, rect.x);
+			const int start_z = std::max(z, rect.y);
+			const int end_x = std::min(x + width, rect.x + rect.z);
+			const int end_z = std::min(z + length, rect.y + rect.w);
+
+			const auto tile = blend_map.tile(tile_x + tile_z * BLEND_TILES);
+			if (tile) {
+				const auto data = tile + ((start_x - rect.x) + (start_z - rect.y) * BLEND_TILE_SIZE) * texel_size;
+				glTexSubImage2D(GL_TEXTURE_2D, 0, start_x, start_z, end_x - start_x, end_z - start_z, GL_RGBA, type, data);
+			}
+			else {
+				glClearTexSubImage(texture, 0, start_x, start_z, 0, end_x - start_x, end_z - start_z, 1, GL_RGBA, type, nullptr);
+			}
+		}
+	}
+
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+}
@@ -0,0 +1,126 @@
+#ifndef TERRAIN_RENDER_H
+#define TERRAIN_RENDER_H
+
+#include <GL/gl3w.h>
+
+#include <array>
+#include <bitset>
+#include <unordered_map>
+#include <vector>
+
+#include "Program.h"
+#include "Terrain.h"
+#include "TerrainClipmap.h"
+
+// TerrainMesh draw modes, the quadtree draws the selected nodes' grids, the clipmap draws nested rings around the camera
+#define TERRAIN_DRAW_QUADTREE 0
+#define TERRAIN_DRAW_CLIPMAP 1
+
+// depth of the skirts below child nodes' borders in the node's vertex spacings
+#define TERRAIN_SKIRT 8.0f
+
+// The gl side of the terrain, Terrain and the rest of the terrain core build without a context or gl headers
+
+struct TerrainShaders {
+	TerrainShaders(Program* t, Program* b, Program* g, Program* c = nullptr) : _terrain ( t ), _brush ( b ), _grass ( g ), _clipmap ( c )	{}
+	Program* _terrain;
+	Program* _brush;
+	Program* _grass;
+	Program* _clipmap;
+};
+
+/********************************************************************************************************************************************************/
+
+class GrassMesh {
+	GrassMesh(Program* program);
+
+	void draw(glm::vec3 position);
+	void create_buffers();
+
+	GLuint							_vertex_buffer;
+	GLuint							_texture;
+	Program*						_program;
+};
+
+/********************************************************************************************************************************************************/
+
+// A page's blend texture and the tiles still waiting to be uploaded to it
+struct TerrainPageTexture {
+	GLuint							_texture;
+	std::bitset<BLEND_TILE_COUNT>	_upload_tiles;
+};
+
+// A node's heights and normals on the gpu, uploaded whole when the node's version moves
+// dirty is the part of a root grid edited since, min x, min z, max x, max z in page vertices, empty while min x > max x
+struct TerrainNodeBuffers {
+	GLuint							_height_buffer;
+	GLuint							_normal_buffer;
+	GLuint							_height_texture;
+	GLuint							_normal_texture;
+	uint64_t						_version;
+	glm::ivec4						_dirty;
+	uint64_t						_last_used;
+};
+
+// Node buffers held, their bytes and the bytes sent to them in the last frame
+struct TerrainBufferStats {
+	size_t		_buffers = 0;
+	size_t		_bytes = 0;
+	size_t		_uploaded = 0;
+	uint64_t	_evictions = 0;
+};
+
+class TerrainMesh : public TerrainRenderer {
+public:
+	TerrainMesh(Terrain* root, TerrainShaders shaders);
+	~TerrainMesh();
+
+	void create_buffers();
+	void create_tile_textures();
+	void bind_page(TerrainPage* page);
+
+	// Binds the node's heights and normals to texture units 0 and 1, uploading what changed since they were last bound
+	void bind_node(const TerrainNode* node);
+	TerrainNodeBuffers create_node_buffers();
+	void release_node_buffers();
+	void evict_node_buffers();
+	size_t node_buffer_bytes() const;
+
+	void draw(glm::vec3 camera_position, const TerrainFrustum& frustum = TerrainFrustum());
+	void draw(const TerrainDrawNode& node, glm::vec3 camera_position);
+	void draw_brush();
+
+	void resize(int width, int length) override;
+	void create_page(TerrainPage* page) override;
+	void release_page(TerrainPage* page) override;
+	size_t upload_page(TerrainPage* page, size_t budget) override;
+	void upload_blend_region(TerrainPage* page, int x, int z, int width, int length) override;
+	void update_heights(int x, int z, int width, int length) override;
+
+	void upload_blend_tile(TerrainPage* page, int index);
+
+	Terrain*						_root;
+
+	GLuint							_vertex_buffer;
+	GLuint							_uv_buffer;
+
+	std::array<GLuint, 4>			_tile_textures;
+
+	// keyed by node, a node allocated where a freed one was finds its entry and uploads whole, versions never repeat
+	std::unordered_map<const TerrainNode*, TerrainNodeBuffers> _node_buffers;
+	std::vector<TerrainNodeBuffers>	_free_buffers;		// evicted buffers, every grid has the same size so they are reused as they are
+	TerrainBufferStats				_buffer_stats;
+	uint64_t						_frame;
+
+	std::unordered_map<const TerrainPage*, TerrainPageTexture> _page_textures;
+
+	Program*					    _program;
+	Program*						_brush_program;
+
+	int								_mode;
+	std::unique_ptr<TerrainClipmap>	_clipmap;		// nullptr without a clipmap shader
+};
+
+/********************************************************************************************************************************************************/
+
+#endif
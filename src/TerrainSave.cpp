@@ -0,0 +1,197 @@
+#include "TerrainSave.h"
+
+#include "Terrain.h"
+
+#include <filesystem>
+#include <unordered_map>
+#include <algorithm>
+
+// The snapshot is taken here on the render thread, live pages are cleaned so edits made during the save mark them dirty again
+TerrainSaveJob::TerrainSaveJob(Terrain* terrain, std::string file, int format, int mode) :
+	_file					( file ),
+	_format					( format ),
+	_mode					( mode ),
+	_journaled				( false ),
+	_replace				( false ),
+	_saved					( false ),
+	_terrain				( terrain ),
+	_done					( false ),
+	_written				( 0 ),
+	_total					( 0 )
+{
+	for (auto& entry : terrain->_pages) {
+		const auto page = entry.second.get();
+		if (mode != SAVE_COPY && !page->_dirty) {
+			continue;
+		}
+
+		auto snapshot = std::make_unique<TerrainPage>(terrain, page->_coord);
+		snapshot->_blend_map = page->_blend_map;
+		snapshot->_dirty = page->_dirty;
+		snapshot->_dirty_heights = page->_dirty_heights;
+		snapshot->_dirty_tiles = page->_dirty_tiles;
+
+		page->_snapshot = snapshot.get();
+		page->_saving = true;
+		page->clear_dirty();
+
+		_pages.push_back({ page, std::move(snapshot) });
+	}
+
+	_total = _pages.size();
+	_thread = std::thread(&TerrainSaveJob::run, this);
+}
+
+TerrainSaveJob::~TerrainSaveJob() {
+	wait();
+}
+
+void TerrainSaveJob::freeze(TerrainPage* page) {
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	if (page->_snapshot) {
+		page->_snapshot->_node._heights = page->_node._heights;
+		page->_snapshot = nullptr;
+	}
+}
+
+bool TerrainSaveJob::done() const {
+	return _done;
+}
+
+float TerrainSaveJob::progress() const {
+	const size_t total = _total;
+	return total ? std::min(static_cast<float>(_written) / total, 1.0f) : 0.0f;
+}
+
+void TerrainSaveJob::wait() {
+	if (_thread.joinable()) {
+		_thread.join();
+	}
+}
+
+// worker thread
+void TerrainSaveJob::run() {
+	if (_mode == SAVE_COPY) {
+		_replace = copy();
+		_saved = _replace;
+		_done = true;
+		return;
+	}
+
+	std::vector<const TerrainPage*> pages;
+	for (size_t i = 0; i < _pages.size(); ++i) {
+		pages.push_back(frozen(i));
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(_terrain->_source_mutex);
+		auto source = _terrain->_source.get();
+
+		// Terrain::save only journals sources that have one, the rest are copied
+		_journaled = source->has_journal() && source->journal_pages(pages);
+
+		std::error_code error;
+		const auto base_size = std::filesystem::file_size(_file, error);
+		_replace = _journaled && source->journal_bytes() > std::max<uint64_t>(_terrain->_page_settings._compact_bytes, error ? 0 : base_size);
+		_format = source->format();
+	}
+
+	_written = _pages.size();
+	_saved = _journaled;
+
+	// the journal now holds every edit in the snapshot, compaction copies the source into a new base file
+	if (_replace) {
+		_replace = copy();
+	}
+
+	_done = true;
+}
+
+// Writes every page of the world to _temp in batches of one page per core so packed targets encode them in parallel
+// Snapshot pages are written from the snapshot, the rest are read from the source, journal included
+bool TerrainSaveJob::copy() {
+	const bool directory = std::filesystem::is_directory(_file);
+	_temp = directory ? _file : _file + ".tmp";
+
+	const auto world = _terrain->_world;
+	auto target = create_page_source(_temp, _format, _terrain->_page_settings._blend_format);
+	bool written = target->write_world(_terrain->_width, _terrain->_length, world);
+
+	std::unordered_map<int, size_t> snapshot;
+	for (size_t i = 0; i < _pages.size(); ++i) {
+		const auto coord = _pages[i].second->_coord;
+		snapshot[coord.x + coord.y * world.x] = i;
+	}
+
+	_written = 0;
+	_total = static_cast<size_t>(world.x) * world.y;
+
+	const size_t batch_size = std::max(std::thread::hardware_concurrency(), 1u);
+	std::vector<const TerrainPage*> writes;
+	std::vector<std::unique_ptr<TerrainPage>> copies;
+
+	const auto flush = [&]() {
+		const size_t batch = writes.size() + copies.size();
+
+		std::vector<TerrainPage*> reads;
+		for (auto& copy : copies) {
+			reads.push_back(copy.get());
+		}
+
+		if (!reads.empty() && _terrain->_source) {
+			std::lock_guard<std::mutex> lock(_terrain->_source_mutex);
+			const auto found = _terrain->_source->read_pages(reads);
+			for (size_t i = 0; i < reads.size(); ++i) {
+				if (found[i]) {
+					writes.push_back(reads[i]);
+				}
+			}
+		}
+
+		written = target->write_pages(writes) && written;
+		_written += batch;
+		writes.clear();
+		copies.clear();
+	};
+
+	for (int z = 0; z < world.y; ++z) {
+		for (int x = 0; x < world.x; ++x) {
+			const auto it = snapshot.find(x + z * world.x);
+			if (it != snapshot.end()) {
+				writes.push_back(frozen(it->second));
+			}
+			else {
+				copies.push_back(std::make_unique<TerrainPage>(_terrain, glm::ivec2(x, z)));
+			}
+
+			if (writes.size() + copies.size() >= batch_size) {
+				flush();
+			}
+		}
+	}
+
+	flush();
+	target.reset();
+
+	// a partly written copy is never swapped in
+	if (!written && !directory) {
+		std::error_code error;
+		std::filesystem::remove(_temp, error);
+	}
+
+	return written && std::filesystem::exists(_temp);
+}
+
+// the heights of the snapshot page, copied from the live page unless the render thread already has
+TerrainPage* TerrainSaveJob::frozen(size_t index) {
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	auto& entry = _pages[index];
+	if (entry.first->_snapshot == entry.second.get()) {
+		entry.second->_node._heights = entry.first->_node._heights;
+		entry.first->_snapshot = nullptr;
+	}
+
+	return entry.second.get();
+}
@@ -0,0 +1,74 @@
+#ifndef TERRAIN_SAVE_H
+#define TERRAIN_SAVE_H
+
+#include <string>
+#include <memory>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+
+class Terrain;
+struct TerrainPage;
+
+#define SAVE_JOURNAL 0
+#define SAVE_COPY 1
+#define SAVE_EVICT 2
+
+/* Background save
+** The render thread snapshots the pages being saved and a worker thread writes the snapshot while editing continues
+
+** Snapshot pages share blend tiles with the live pages, a tile is copied by whichever side writes it first (see BlendMap)
+** Heights are copied lazily, by the worker when it reaches the page or by the render thread right before the page is first edited
+** Pages in the snapshot are never evicted while the save runs so a failed save can mark them dirty again
+
+** SAVE_JOURNAL	-> dirty regions are appended to the source's journal, then the journal is compacted if it has grown too large
+** SAVE_EVICT	-> a SAVE_JOURNAL started by Terrain::evict_pages so dirty pages can be evicted once it's done, it doesn't call _save_callback
+** SAVE_COPY		-> every page is written to "file.tmp", non resident pages are copied from the source
+**				   saves over a source without a journal copy too, a legacy file becomes a chunk file that later saves journal
+**				   directories are written in place, each page file is replaced by a rename
+** Copies and compactions are swapped in for the old file by Terrain::finish_save on the render thread
+*/
+
+class TerrainSaveJob {
+public:
+	TerrainSaveJob(Terrain* terrain, std::string file, int format, int mode);
+	~TerrainSaveJob();
+
+	TerrainSaveJob(const TerrainSaveJob&) = delete;
+	TerrainSaveJob& operator=(const TerrainSaveJob&) = delete;
+
+	// render thread, before the heights of a live page are written
+	void freeze(TerrainPage* page);
+
+	bool done() const;
+	float progress() const;
+	void wait();
+
+	// live page -> snapshot page
+	std::vector<std::pair<TerrainPage*, std::unique_ptr<TerrainPage>>> _pages;
+
+	std::string						_file;
+	std::string						_temp;
+	int								_format;
+	int								_mode;
+
+	// results, read once the job is done
+	bool							_journaled;
+	bool							_replace;
+	bool							_saved;
+private:
+	void run();
+	bool copy();
+	TerrainPage* frozen(size_t index);
+
+	Terrain*						_terrain;
+	std::mutex						_mutex;
+	std::thread						_thread;
+
+	std::atomic<bool>				_done;
+	std::atomic<size_t>				_written;
+	std::atomic<size_t>				_total;
+};
+
+#endif
@@ -0,0 +1,907 @@
+#include "TerrainSource.h"
+
+#include "Terrain.h"
+#include "TerrainCodec.h"
+#include "Parallel.h"
+
+#include <fstream>
+#include <filesystem>
+#include <iostream>
+#include <cstring>
+
+constexpr const char* WORLD_FILE = "world";
+
+// Page files use the legacy terrain layout -> width, length, heights, blend map
+// the blend map is dense or, after TERRAIN_PAGE_TILES, only the painted tiles
+// a page of another size or a file cut short reads as a page that was never written
+static bool read_page_file(const std::string& file, TerrainPage* page) {
+	std::ifstream page_file(file.c_str(), std::ios::binary);
+
+	if (!page_file.is_open()) {
+		return false;
+	}
+
+	int width = 0, length = 0;
+	page_file.read(reinterpret_cast<char*>(&width), 4);
+	page_file.read(reinterpret_cast<char*>(&length), 4);
+
+	const auto root = page->_node._root;
+	if (!page_file || width != root->_width || length != root->_length) {
+		std::cout << "PAGE FILE " << file << " IS " << width << 'x' << length << " NOT " << root->_width << 'x' << root->_length << '\n';
+		return false;
+	}
+
+	TerrainHeights heights((static_cast<size_t>(width) + 1) * (length + 1));
+	page_file.read(reinterpret_cast<char*>(&heights[0]), sizeof(float) * heights.size());
+
+	uint32_t marker = 0;
+	page_file.read(reinterpret_cast<char*>(&marker), sizeof(uint32_t));
+
+	BlendMap blend_map(page->_blend_map.format());
+	if (marker == TERRAIN_PAGE_TILES) {
+		std::array<uint32_t, BLEND_TILE_COUNT> painted;
+		page_file.read(reinterpret_cast<char*>(&painted[0]), sizeof(uint32_t) * painted.size());
+
+		std::vector<glm::vec4> tile(BLEND_TILE_TEXELS);
+		for (int i = 0; i < BLEND_TILE_COUNT && page_file; ++i) {
+			if (painted[i]) {
+				page_file.read(reinterpret_cast<char*>(&tile[0]), sizeof(glm::vec4) * tile.size());
+				blend_map.read_tile(i, reinterpret_cast<const uint8_t*>(&tile[0]), BLEND_FORMAT_FLOAT);
+			}
+		}
+	}
+	else {
+		page_file.seekg(-static_cast<std::streamoff>(sizeof(uint32_t)), std::ios::cur);
+
+		std::vector<glm::vec4> blend(BLEND_MAP_SIZE * BLEND_MAP_SIZE, glm::vec4(0, 0, 0, 0));
+		page_file.read(reinterpret_cast<char*>(&blend[0]), sizeof(glm::vec4) * blend.size());
+		blend_map.read_dense(&blend[0]);
+	}
+
+	if (!page_file) {
+		std::cout << "PAGE FILE " << file << " IS TRUNCATED\n";
+		return false;
+	}
+
+	page->_node._heights.swap(heights);
+	page->_blend_map = std::move(blend_map);
+
+	return true;
+}
+
+// Written next to the page file and renamed over it, a failed write leaves the previous file in place
+// tiles -> only the painted blend tiles, otherwise the dense blend map the legacy file is read with
+static bool write_page_file(const std::string& file, const TerrainPage* page, bool tiles) {
+	const std::string temp = file + ".tmp";
+	std::ofstream page_file(temp.c_str(), std::ios::trunc | std::ios::binary);
+
+	const auto& heights = page->_node._heights;
+	page_file.write(reinterpret_cast<const char*>(&page->_node._root->_width), 4);
+	page_file.write(reinterpret_cast<const char*>(&page->_node._root->_length), 4);
+	page_file.write(reinterpret_cast<const char*>(&heights[0]), sizeof(float) * heights.size());
+
+	const auto& blend_map = page->_blend_map;
+	if (tiles) {
+		const uint32_t marker = TERRAIN_PAGE_TILES;
+		page_file.write(reinterpret_cast<const char*>(&marker), sizeof(uint32_t));
+
+		std::array<uint32_t, BLEND_TILE_COUNT> painted;
+		for (int i = 0; i < BLEND_TILE_COUNT; ++i) {
+			painted[i] = blend_map.tile(i) ? 1 : 0;
+		}
+		page_file.write(reinterpret_cast<const char*>(&painted[0]), sizeof(uint32_t) * painted.size());
+
+		std::vector<glm::vec4> tile(BLEND_TILE_TEXELS);
+		for (int i = 0; i < BLEND_TILE_COUNT; ++i) {
+			if (painted[i]) {
+				blend_map.copy_tile(i, reinterpret_cast<uint8_t*>(&tile[0]), BLEND_FORMAT_FLOAT);
+				page_file.write(reinterpret_cast<const char*>(&tile[0]), sizeof(glm::vec4) * tile.size());
+			}
+		}
+	}
+	else {
+		std::vector<glm::vec4> blend(BLEND_MAP_SIZE * BLEND_MAP_SIZE);
+		blend_map.write_dense(&blend[0]);
+		page_file.write(reinterpret_cast<const char*>(&blend[0]), sizeof(glm::vec4) * blend.size());
+	}
+	page_file.close();
+
+	std::error_code error;
+	if (page_file) {
+		std::filesystem::rename(temp, file, error);
+	}
+
+	if (!page_file || error) {
+		std::filesystem::remove(temp, error);
+		return false;
+	}
+
+	return true;
+}
+
+std::vector<bool> TerrainPageSource::read_pages(const std::vector<TerrainPage*>& pages) {
+	std::vector<bool> found;
+	for (auto page : pages) {
+		found.push_back(read(page));
+	}
+
+	return found;
+}
+
+bool TerrainPageSource::write_pages(const std::vector<const TerrainPage*>& pages) {
+	bool written = true;
+	for (auto page : pages) {
+		written = write(page) && written;
+	}
+
+	return written;
+}
+
+/********************************************************************************************************************************************************/
+
+TerrainLegacyFile::TerrainLegacyFile(std::string path) :
+	TerrainPageSource	( path )
+{}
+
+bool TerrainLegacyFile::read_world(int* width, int* length, glm::ivec2* world) {
+	std::ifstream terrain_file(_path.c_str(), std::ios::binary);
+
+	*world = glm::ivec2(1, 1);
+	if (!terrain_file.is_open()) {
+		return false;
+	}
+
+	terrain_file.read(reinterpret_cast<char*>(width), 4);
+	terrain_file.read(reinterpret_cast<char*>(length), 4);
+
+	return true;
+}
+
+bool TerrainLegacyFile::write_world(int /*width*/, int /*length*/, glm::ivec2 world) {
+	return world == glm::ivec2(1, 1);
+}
+
+bool TerrainLegacyFile::read(TerrainPage* page) {
+	if (page->_coord != glm::ivec2(0, 0)) {
+		return false;
+	}
+
+	return read_page_file(_path, page);
+}
+
+bool TerrainLegacyFile::write(const TerrainPage* page) {
+	if (page->_coord != glm::ivec2(0, 0)) {
+		return false;
+	}
+
+	return write_page_file(_path, page, false);
+}
+
+/********************************************************************************************************************************************************/
+
+TerrainPageDirectory::TerrainPageDirectory(std::string path) :
+	TerrainPageSource	( path )
+{}
+
+bool TerrainPageDirectory::read_world(int* width, int* length, glm::ivec2* world) {
+	std::ifstream world_file((std::filesystem::path(_path) / WORLD_FILE).string().c_str(), std::ios::binary);
+
+	if (!world_file.is_open()) {
+		*world = glm::ivec2(1, 1);
+		return false;
+	}
+
+	world_file.read(reinterpret_cast<char*>(width), 4);
+	world_file.read(reinterpret_cast<char*>(length), 4);
+	world_file.read(reinterpret_cast<char*>(&world->x), 4);
+	world_file.read(reinterpret_cast<char*>(&world->y), 4);
+
+	return true;
+}
+
+bool TerrainPageDirectory::write_world(int width, int length, glm::ivec2 world) {
+	std::error_code error;
+	std::filesystem::create_directories(_path, error);
+
+	std::ofstream world_file((std::filesystem::path(_path) / WORLD_FILE).string().c_str(), std::ios::trunc | std::ios::binary);
+
+	world_file.write(reinterpret_cast<const char*>(&width), 4);
+	world_file.write(reinterpret_cast<const char*>(&length), 4);
+	world_file.write(reinterpret_cast<const char*>(&world.x), 4);
+	world_file.write(reinterpret_cast<const char*>(&world.y), 4);
+	world_file.close();
+
+	return static_cast<bool>(world_file);
+}
+
+bool TerrainPageDirectory::read(TerrainPage* page) {
+	return read_page_file(page_path(page->_coord), page);
+}
+
+bool TerrainPageDirectory::write(const TerrainPage* page) {
+	std::error_code error;
+	std::filesystem::create_directories(_path, error);
+	return write_page_file(page_path(page->_coord), page, true);
+}
+
+std::string TerrainPageDirectory::page_path(glm::ivec2 coord) const {
+	return (std::filesystem::path(_path) / (std::to_string(coord.x) + "_" + std::to_string(coord.y) + ".page")).string();
+}
+
+/********************************************************************************************************************************************************/
+
+static uint64_t align(uint64_t offset, uint64_t alignment) {
+	return (offset + alignment - 1) / alignment * alignment;
+}
+
+constexpr uint64_t BLEND_TABLE_SIZE = sizeof(uint32_t) * BLEND_TILE_COUNT;
+
+constexpr uint32_t JOURNAL_HEIGHTS = 1;
+constexpr uint32_t JOURNAL_BLEND = 2;
+constexpr uint32_t JOURNAL_COMMIT = 3;
+
+// fnv-1a, catches journal records that were only partly written
+static uint32_t checksum(const char* data, size_t size) {
+	uint32_t hash = 2166136261u;
+	for (size_t i = 0; i < size; ++i) {
+		hash = (hash ^ static_cast<uint8_t>(data[i])) * 16777619u;
+	}
+
+	return hash;
+}
+
+// Raw blend chunk -> tile table (slot + 1, 0 unpainted) padded to TERRAIN_FILE_ALIGNMENT, then the painted tiles in slot order
+// Tiles are stored in the file's blend format
+static std::vector<uint8_t> raw_blend_chunk(const BlendMap& blend_map, int format) {
+	const size_t tiles = blend_map.tile_count();
+	if (!tiles) {
+		return std::vector<uint8_t>();
+	}
+
+	const uint64_t data_offset = align(BLEND_TABLE_SIZE, TERRAIN_FILE_ALIGNMENT);
+	const uint64_t tile_size = BlendMap::texel_size(format) * BLEND_TILE_TEXELS;
+	std::vector<uint8_t> chunk(data_offset + tile_size * tiles, 0);
+
+	uint32_t slot = 0;
+	for (int i = 0; i < BLEND_TILE_COUNT; ++i) {
+		if (blend_map.tile(i)) {
+			blend_map.copy_tile(i, &chunk[data_offset + tile_size * slot], format);
+			++slot;
+			std::memcpy(&chunk[sizeof(uint32_t) * i], &slot, sizeof(uint32_t));
+		}
+	}
+
+	return chunk;
+}
+
+// Replaces every tile of the blend map with a view, tiles in a different format are converted instead
+// The map is left untouched if the chunk is invalid
+static bool view_blend_chunk(const char* data, uint64_t size, int format, BlendMap* blend_map) {
+	const uint64_t data_offset = align(BLEND_TABLE_SIZE, TERRAIN_FILE_ALIGNMENT);
+	const uint64_t tile_size = BlendMap::texel_size(format) * BLEND_TILE_TEXELS;
+	if (size < data_offset) {
+		return false;
+	}
+
+	std::array<uint32_t, BLEND_TILE_COUNT> slots;
+	std::memcpy(&slots[0], data, BLEND_TABLE_SIZE);
+
+	for (const auto slot : slots) {
+		if (slot != 0 && data_offset + tile_size * slot > size) {
+			return false;
+		}
+	}
+
+	for (int i = 0; i < BLEND_TILE_COUNT; ++i) {
+		if (slots[i] == 0) {
+			blend_map->release_tile(i);
+			continue;
+		}
+
+		const auto tile = reinterpret_cast<const uint8_t*>(data + data_offset + tile_size * (slots[i] - 1));
+		if (format == blend_map->format()) {
+			blend_map->view_tile(i, tile);
+		}
+		else {
+			blend_map->read_tile(i, tile, format);
+		}
+	}
+
+	return true;
+}
+
+// Packed blend chunk -> tile table (packed size, 0 unpainted), then each painted tile packed on its own
+// tiles keep the file's blend format, floats are quantized by pack_blend and 8/16 bit channels are packed exactly
+static std::vector<uint8_t> pack_blend_chunk(const BlendMap& blend_map, int format) {
+	if (!blend_map.tile_count()) {
+		return std::vector<uint8_t>();
+	}
+
+	std::vector<uint8_t> chunk(BLEND_TABLE_SIZE, 0);
+	std::array<glm::vec4, BLEND_TILE_TEXELS> weights;
+	const auto texels = reinterpret_cast<uint8_t*>(&weights[0]);
+	for (int i = 0; i < BLEND_TILE_COUNT; ++i) {
+		if (blend_map.tile(i)) {
+			blend_map.copy_tile(i, texels, format);
+
+			const auto packed = format == BLEND_FORMAT_FLOAT ? pack_blend(&weights[0], BLEND_TILE_SIZE, BLEND_TILE_SIZE)
+				: pack_texels(texels, BLEND_TILE_SIZE, BLEND_TILE_SIZE, static_cast<int>(BlendMap::texel_size(format) / 4));
+			const uint32_t size = static_cast<uint32_t>(packed.size());
+			std::memcpy(&chunk[sizeof(uint32_t) * i], &size, sizeof(uint32_t));
+			chunk.insert(chunk.end(), packed.begin(), packed.end());
+		}
+	}
+
+	return chunk;
+}
+
+static bool unpack_blend_chunk(const char* data, uint64_t size, int format, BlendMap* blend_map) {
+	if (size < BLEND_TABLE_SIZE) {
+		return false;
+	}
+
+	blend_map->clear();
+
+	std::array<glm::vec4, BLEND_TILE_TEXELS> weights;
+	const auto texels = reinterpret_cast<uint8_t*>(&weights[0]);
+	uint64_t offset = BLEND_TABLE_SIZE;
+	for (int i = 0; i < BLEND_TILE_COUNT; ++i) {
+		uint32_t tile_size;
+		std::memcpy(&tile_size, data + sizeof(uint32_t) * i, sizeof(uint32_t));
+		if (tile_size == 0) {
+			continue;
+		}
+
+		if (offset + tile_size > size) {
+			blend_map->clear();
+			return false;
+		}
+
+		const auto tile = reinterpret_cast<const uint8_t*>(data + offset);
+		const bool unpacked = format == BLEND_FORMAT_FLOAT ? unpack_blend(tile, tile_size, &weights[0], BLEND_TILE_SIZE, BLEND_TILE_SIZE)
+			: unpack_texels(tile, tile_size, texels, BLEND_TILE_SIZE, BLEND_TILE_SIZE, static_cast<int>(BlendMap::texel_size(format) / 4));
+		if (!unpacked) {
+			blend_map->clear();
+			return false;
+		}
+
+		blend_map->read_tile(i, texels, format);
+
+		offset += tile_size;
+	}
+
+	return true;
+}
+
+TerrainChunkFile::TerrainChunkFile(std::string path, bool packed, int blend_format) :
+	TerrainPageSource	( path ),
+	_packed				( packed ),
+	_blend_format		( blend_format ),
+	_header				( ),
+	_journal_end		( 0 )
+{}
+
+bool TerrainChunkFile::read_world(int* width, int* length, glm::ivec2* world) {
+	*world = glm::ivec2(1, 1);
+
+	const auto header = map(0, sizeof(Header));
+	if (!header) {
+		return false;
+	}
+
+	std::memcpy(&_header, header, sizeof(Header));
+	if (_header.magic != (_packed ? TERRAIN_PACKED_MAGIC : TERRAIN_FILE_MAGIC) || (_header.version != TERRAIN_FILE_VERSION && _header.version != TERRAIN_FILE_VERSION_FLOAT_BLEND) || _header.blend_size != BLEND_MAP_SIZE
+		|| _header.blend_format > BLEND_FORMAT_RGBA8) {
+		std::cout << "UNSUPPORTED TERRAIN FILE " << _path << " VERSION " << _header.version << '\n';
+		_header = Header();
+		return false;
+	}
+
+	const auto chunks = map(sizeof(Header), sizeof(Chunk) * _header.chunk_count);
+	if (!chunks) {
+		_header = Header();
+		return false;
+	}
+
+	_chunks.resize(_header.chunk_count);
+	std::memcpy(&_chunks[0], chunks, sizeof(Chunk) * _chunks.size());
+
+	*width = _header.width;
+	*length = _header.length;
+	*world = glm::ivec2(_header.world_x, _header.world_z);
+	_blend_format = _header.blend_format;
+
+	read_journal();
+
+	return true;
+}
+
+// Starts a new file with an empty chunk directory, saving over the open file keeps its chunks
+bool TerrainChunkFile::write_world(int width, int length, glm::ivec2 world) {
+	const uint32_t magic = _packed ? TERRAIN_PACKED_MAGIC : TERRAIN_FILE_MAGIC;
+	if (_header.magic == magic && _header.width == width && _header.length == length
+		&& _header.world_x == world.x && _header.world_z == world.y) {
+		return true;
+	}
+
+	_mappings.clear();
+
+	_header.magic = magic;
+	_header.version = TERRAIN_FILE_VERSION;
+	_header.width = width;
+	_header.length = length;
+	_header.world_x = world.x;
+	_header.world_z = world.y;
+	_header.blend_size = BLEND_MAP_SIZE;
+	_header.blend_format = _blend_format;
+	_header.chunk_count = world.x * world.y;
+
+	_chunks.clear();
+	_chunks.resize(_header.chunk_count, Chunk());
+
+	std::ofstream terrain_file(_path.c_str(), std::ios::trunc | std::ios::binary);
+	terrain_file.write(reinterpret_cast<const char*>(&_header), sizeof(Header));
+	terrain_file.write(reinterpret_cast<const char*>(&_chunks[0]), sizeof(Chunk) * _chunks.size());
+	terrain_file.close();
+
+	std::error_code error;
+	std::filesystem::remove(journal_path(), error);
+	_journal.assign(_chunks.size(), std::vector<JournalEntry>());
+	_journal_end = 0;
+
+	return static_cast<bool>(terrain_file);
+}
+
+bool TerrainChunkFile::read(TerrainPage* page) {
+	return read_pages({ page })[0];
+}
+
+bool TerrainChunkFile::write(const TerrainPage* page) {
+	return write_pages({ page });
+}
+
+// Chunks are located in the mapping on this thread, then copied or decoded in parallel
+std::vector<bool> TerrainChunkFile::read_pages(const std::vector<TerrainPage*>& pages) {
+	struct ChunkData {
+		const Chunk*	_chunk		= nullptr;
+		const char*		_heights	= nullptr;
+		const char*		_blend		= nullptr;
+	};
+
+	const int width = _header.width + 1;
+	const int length = _header.length + 1;
+	const size_t heights_size = sizeof(float) * width * length;
+
+	std::vector<ChunkData> chunks(pages.size());
+	for (size_t i = 0; i < pages.size(); ++i) {
+		const auto chunk = find_chunk(pages[i]->_coord);
+		if (!chunk || chunk->heights_offset == 0 || (!_packed && chunk->heights_size != heights_size)) {
+			continue;
+		}
+
+		chunks[i]._chunk = chunk;
+		chunks[i]._heights = map(chunk->heights_offset, chunk->heights_size);
+		chunks[i]._blend = chunk->blend_offset ? map(chunk->blend_offset, chunk->blend_size) : nullptr;
+	}
+
+	// std::vector<bool> can't be written from several threads
+	std::vector<char> found(pages.size(), 0);
+	parallel_for(pages.size(), [&](size_t i) {
+		const auto& data = chunks[i];
+		const auto page = pages[i];
+		if (!data._heights) {
+			return;
+		}
+
+		auto& heights = page->_node._heights;
+		heights.resize(static_cast<size_t>(width) * length);
+
+		if (!_packed) {
+			std::memcpy(&heights[0], data._heights, heights_size);
+		}
+		else if (!unpack_heights(reinterpret_cast<const uint8_t*>(data._heights), data._chunk->heights_size, &heights[0], width, length)) {
+			return;
+		}
+
+		if (data._blend) {
+			const auto read_blend = _packed ? unpack_blend_chunk : view_blend_chunk;
+			if (!read_blend(data._blend, data._chunk->blend_size, _packed ? packed_blend_format() : _header.blend_format, &page->_blend_map)) {
+				return;
+			}
+		}
+
+		found[i] = 1;
+	});
+
+	// journal records are replayed on this thread, pages that were only ever journaled start out flat
+	if (_journal_end) {
+		std::ifstream journal(journal_path().c_str(), std::ios::binary);
+		for (size_t i = 0; i < pages.size(); ++i) {
+			const auto chunk = find_chunk(pages[i]->_coord);
+			if (!chunk || _journal[chunk - &_chunks[0]].empty()) {
+				continue;
+			}
+
+			if (!found[i]) {
+				pages[i]->_node._heights.assign(static_cast<size_t>(width) * length, 0.0f);
+				pages[i]->_blend_map.clear();
+			}
+
+			apply_journal(pages[i], journal);
+			found[i] = 1;
+		}
+	}
+
+	return std::vector<bool>(found.begin(), found.end());
+}
+
+// Packed chunks are encoded in parallel, the file itself is written on this thread
+// Chunks that keep their size are overwritten in place, new chunks are appended
+// The directory entry is written last so a failed write leaves the previous chunk in place
+bool TerrainChunkFile::write_pages(const std::vector<const TerrainPage*>& pages) {
+	if (pages.empty()) {
+		return true;
+	}
+
+	std::vector<std::vector<uint8_t>> packed_heights(pages.size());
+	std::vector<std::vector<uint8_t>> blends(pages.size());
+	parallel_for(pages.size(), [&](size_t i) {
+		if (_packed) {
+			packed_heights[i] = pack_heights(&pages[i]->_node._heights[0], _header.width + 1, _header.length + 1);
+		}
+		const auto& blend_map = pages[i]->_blend_map;
+		blends[i] = _packed ? pack_blend_chunk(blend_map, packed_blend_format()) : raw_blend_chunk(blend_map, _header.blend_format);
+	});
+
+	std::fstream terrain_file(_path.c_str(), std::ios::in | std::ios::out | std::ios::binary);
+	if (!terrain_file.is_open()) {
+		return false;
+	}
+
+	bool written = true;
+	for (size_t i = 0; i < pages.size(); ++i) {
+		const auto page = pages[i];
+		const auto chunk = find_chunk(page->_coord);
+		if (!chunk) {
+			written = false;
+			continue;
+		}
+
+		const char* heights = reinterpret_cast<const char*>(&page->_node._heights[0]);
+		uint64_t heights_size = sizeof(float) * page->_node._heights.size();
+		if (_packed) {
+			heights = reinterpret_cast<const char*>(packed_heights[i].data());
+			heights_size = packed_heights[i].size();
+		}
+
+		// unpainted pages have no blend chunk
+		const char* blend = blends[i].empty() ? nullptr : reinterpret_cast<const char*>(blends[i].data());
+		const uint64_t blend_size = blends[i].size();
+
+		chunk->heights_offset = write_chunk(terrain_file, chunk->heights_offset, chunk->heights_size, heights, heights_size);
+		chunk->heights_size = heights_size;
+
+		if (blend) {
+			chunk->blend_offset = write_chunk(terrain_file, chunk->blend_offset, chunk->blend_size, blend, blend_size);
+			chunk->blend_size = blend_size;
+		}
+		else {
+			chunk->blend_offset = 0;
+			chunk->blend_size = 0;
+		}
+
+		terrain_file.seekp(sizeof(Header) + sizeof(Chunk) * (chunk - &_chunks[0]));
+		terrain_file.write(reinterpret_cast<const char*>(chunk), sizeof(Chunk));
+	}
+
+	terrain_file.close();
+	return written && terrain_file;
+}
+
+bool TerrainChunkFile::map_blend(TerrainPage* page) {
+	const auto chunk = find_chunk(page->_coord);
+	if (_packed || !chunk || chunk->blend_offset == 0 || _header.blend_format != static_cast<uint32_t>(page->_blend_map.format())) {
+		return false;
+	}
+
+	const auto data = map(chunk->blend_offset, chunk->blend_size);
+	if (!data) {
+		return false;
+	}
+
+	return view_blend_chunk(data, chunk->blend_size, _header.blend_format, &page->_blend_map);
+}
+
+bool TerrainChunkFile::has_journal() const {
+	return !_chunks.empty();
+}
+
+// Appends the dirty regions of each page followed by a commit record, the journal is only
+// updated in memory once the whole save has been written
+bool TerrainChunkFile::journal_pages(const std::vector<const TerrainPage*>& pages) {
+	std::error_code error;
+	if (_journal_end == 0) {
+		const JournalHeader header = { TERRAIN_JOURNAL_MAGIC, TERRAIN_JOURNAL_VERSION, std::filesystem::file_size(_path, error) };
+		std::ofstream journal(journal_path().c_str(), std::ios::trunc | std::ios::binary);
+		journal.write(reinterpret_cast<const char*>(&header), sizeof(JournalHeader));
+		if (error || !journal) {
+			return false;
+		}
+	}
+	else {
+		// drops a torn save left behind by a crash
+		std::filesystem::resize_file(journal_path(), _journal_end, error);
+	}
+
+	std::fstream journal(journal_path().c_str(), std::ios::in | std::ios::out | std::ios::binary);
+	if (error || !journal.is_open()) {
+		return false;
+	}
+
+	uint64_t offset = _journal_end ? _journal_end : sizeof(JournalHeader);
+	journal.seekp(offset);
+
+	std::vector<std::pair<int, JournalEntry>> pending;
+	const auto append = [&](JournalRecord record, const char* payload) {
+		record.checksum = checksum(payload, record.size);
+		journal.write(reinterpret_cast<const char*>(&record), sizeof(JournalRecord));
+		journal.write(payload, record.size);
+
+		offset += sizeof(JournalRecord);
+		if (record.type != JOURNAL_COMMIT) {
+			pending.push_back({ record.chunk, JournalEntry{ record, offset } });
+		}
+		offset += record.size;
+	};
+
+	const int row = _header.width + 1;
+	const auto tile_size = BlendMap::texel_size(_header.blend_format) * BLEND_TILE_TEXELS;
+	std::vector<char> payload;
+
+	for (const auto page : pages) {
+		const auto chunk = find_chunk(page->_coord);
+		if (!chunk) {
+			continue;
+		}
+
+		const int32_t index = static_cast<int32_t>(chunk - &_chunks[0]);
+
+		if (page->heights_dirty()) {
+			const auto rect = page->_dirty_heights;
+			const int width = rect.z - rect.x + 1;
+			const int length = rect.w - rect.y + 1;
+
+			payload.resize(sizeof(float) * width * length);
+			for (int z = 0; z < length; ++z) {
+				std::memcpy(&payload[sizeof(float) * width * z], &page->_node._heights[rect.x + (rect.y + z) * row], sizeof(float) * width);
+			}
+
+			append({ JOURNAL_HEIGHTS, index, rect.x, rect.y, width, length, static_cast<uint32_t>(payload.size()), 0 }, payload.data());
+		}
+
+		for (int i = 0; i < BLEND_TILE_COUNT; ++i) {
+			if (!page->_dirty_tiles[i]) {
+				continue;
+			}
+
+			payload.resize(page->_blend_map.tile(i) ? tile_size : 0);
+			if (!payload.empty()) {
+				page->_blend_map.copy_tile(i, reinterpret_cast<uint8_t*>(&payload[0]), _header.blend_format);
+			}
+
+			append({ JOURNAL_BLEND, index, i, 0, 0, 0, static_cast<uint32_t>(payload.size()), 0 }, payload.data());
+		}
+	}
+
+	append({ JOURNAL_COMMIT, 0, 0, 0, 0, 0, 0, 0 }, nullptr);
+
+	journal.flush();
+	if (!journal) {
+		return false;
+	}
+
+	for (auto& entry : pending) {
+		_journal[entry.first].push_back(entry.second);
+	}
+	_journal_end = offset;
+
+	return true;
+}
+
+uint64_t TerrainChunkFile::journal_bytes() const {
+	return _journal_end;
+}
+
+int TerrainChunkFile::format() const {
+	return _packed ? TERRAIN_FORMAT_PACKED : TERRAIN_FORMAT_RAW;
+}
+
+// Indexes the committed records, stops at the first record that is torn or doesn't match this file
+void TerrainChunkFile::read_journal() {
+	_journal.assign(_chunks.size(), std::vector<JournalEntry>());
+	_journal_end = 0;
+
+	std::ifstream journal(journal_path().c_str(), std::ios::binary);
+	if (!journal.is_open()) {
+		return;
+	}
+
+	std::error_code error;
+	JournalHeader header = {};
+	journal.read(reinterpret_cast<char*>(&header), sizeof(JournalHeader));
+	if (!journal || header.magic != TERRAIN_JOURNAL_MAGIC || header.version != TERRAIN_JOURNAL_VERSION
+		|| header.base_size != std::filesystem::file_size(_path, error)) {
+		return;
+	}
+
+	const int row = _header.width + 1;
+	const int column = _header.length + 1;
+	const auto tile_size = BlendMap::texel_size(_header.blend_format) * BLEND_TILE_TEXELS;
+
+	const auto valid = [&](const JournalRecord& record) {
+		if (record.chunk < 0 || record.chunk >= static_cast<int32_t>(_chunks.size())) {
+			return false;
+		}
+
+		if (record.type == JOURNAL_HEIGHTS) {
+			return record.x >= 0 && record.z >= 0 && record.width > 0 && record.length > 0
+				&& record.x + record.width <= row && record.z + record.length <= column
+				&& record.size == sizeof(float) * record.width * record.length;
+		}
+
+		return record.type == JOURNAL_BLEND && record.x >= 0 && record.x < BLEND_TILE_COUNT
+			&& (record.size == 0 || record.size == tile_size);
+	};
+
+	uint64_t offset = sizeof(JournalHeader);
+	_journal_end = offset;
+
+	std::vector<std::pair<int, JournalEntry>> pending;
+	std::vector<char> payload;
+	JournalRecord record;
+
+	while (journal.read(reinterpret_cast<char*>(&record), sizeof(JournalRecord))) {
+		offset += sizeof(JournalRecord);
+
+		if (record.type == JOURNAL_COMMIT) {
+			for (auto& entry : pending) {
+				_journal[entry.first].push_back(entry.second);
+			}
+			pending.clear();
+			_journal_end = offset;
+			continue;
+		}
+
+		if (!valid(record)) {
+			break;
+		}
+
+		payload.resize(record.size);
+		if (record.size && !journal.read(&payload[0], record.size)) {
+			break;
+		}
+
+		if (checksum(payload.data(), payload.size()) != record.checksum) {
+			break;
+		}
+
+		pending.push_back({ record.chunk, JournalEntry{ record, offset } });
+		offset += record.size;
+	}
+}
+
+void TerrainChunkFile::apply_journal(TerrainPage* page, std::ifstream& journal) {
+	const auto& entries = _journal[find_chunk(page->_coord) - &_chunks[0]];
+	const int row = _header.width + 1;
+
+	auto& heights = page->_node._heights;
+	std::vector<char> payload;
+
+	for (const auto& entry : entries) {
+		const auto& record = entry._record;
+
+		payload.resize(record.size);
+		journal.clear();
+		journal.seekg(entry._offset);
+		if (record.size && !journal.read(&payload[0], record.size)) {
+			std::cout << "FAILED TO READ TERRAIN JOURNAL " << journal_path() << '\n';
+			return;
+		}
+
+		if (record.type == JOURNAL_HEIGHTS) {
+			for (int z = 0; z < record.length; ++z) {
+				std::memcpy(&heights[record.x + (record.z + z) * row], &payload[sizeof(float) * record.width * z], sizeof(float) * record.width);
+			}
+		}
+		else if (record.size == 0) {
+			page->_blend_map.release_tile(record.x);
+		}
+		else {
+			page->_blend_map.read_tile(record.x, reinterpret_cast<const uint8_t*>(&payload[0]), _header.blend_format);
+		}
+	}
+}
+
+std::string TerrainChunkFile::journal_path() const {
+	return _path + TERRAIN_JOURNAL_EXTENSION;
+}
+
+uint32_t TerrainChunkFile::file_magic(const std::string& path) {
+	std::ifstream terrain_file(path.c_str(), std::ios::binary);
+
+	uint32_t magic = 0;
+	terrain_file.read(reinterpret_cast<char*>(&magic), 4);
+
+	return terrain_file ? magic : 0;
+}
+
+// files from before exact texel packing keep quantized float tiles until they are copied into a new file
+int TerrainChunkFile::packed_blend_format() const {
+	return _header.version == TERRAIN_FILE_VERSION_FLOAT_BLEND ? BLEND_FORMAT_FLOAT : static_cast<int>(_header.blend_format);
+}
+
+TerrainChunkFile::Chunk* TerrainChunkFile::find_chunk(glm::ivec2 coord) {
+	if (coord.x < 0 || coord.y < 0 || coord.x >= _header.world_x || coord.y >= _header.world_z) {
+		return nullptr;
+	}
+
+	return &_chunks[coord.x + coord.y * _header.world_x];
+}
+
+// Remaps the file once it has grown past the newest mapping
+const char* TerrainChunkFile::map(uint64_t offset, uint64_t size) {
+	if (_mappings.empty() || _mappings.back()->size() < offset + size) {
+		auto mapping = std::make_unique<MappedFile>(_path);
+		if (!mapping->is_open()) {
+			return nullptr;
+		}
+		_mappings.push_back(std::move(mapping));
+	}
+
+	if (_mappings.back()->size() < offset + size) {
+		return nullptr;
+	}
+
+	return _mappings.back()->data() + offset;
+}
+
+uint64_t TerrainChunkFile::write_chunk(std::fstream& file, uint64_t offset, uint64_t old_size, const char* data, uint64_t size) {
+	if (offset == 0 || old_size != size) {
+		file.seekp(0, std::ios::end);
+		const uint64_t end = static_cast<uint64_t>(file.tellp());
+		offset = align(end, _packed ? TERRAIN_PACKED_ALIGNMENT : TERRAIN_FILE_ALIGNMENT);
+
+		const std::vector<char> padding(offset - end, 0);
+		if (!padding.empty()) {
+			file.write(&padding[0], padding.size());
+		}
+	}
+
+	file.seekp(offset);
+	file.write(data, size);
+
+	return offset;
+}
+
+/********************************************************************************************************************************************************/
+
+std::unique_ptr<TerrainPageSource> open_page_source(const std::string& path) {
+	if (std::filesystem::is_directory(path)) {
+		return std::make_unique<TerrainPageDirectory>(path);
+	}
+
+	const auto magic = TerrainChunkFile::file_magic(path);
+	if (magic == TERRAIN_FILE_MAGIC || magic == TERRAIN_PACKED_MAGIC) {
+		return std::make_unique<TerrainChunkFile>(path, magic == TERRAIN_PACKED_MAGIC);
+	}
+
+	return std::make_unique<TerrainLegacyFile>(path);
+}
+
+std::unique_ptr<TerrainPageSource> create_page_source(const std::string& path, int format, int blend_format) {
+	if (std::filesystem::is_directory(path)) {
+		return std::make_unique<TerrainPageDirectory>(path);
+	}
+
+	return std::make_unique<TerrainChunkFile>(path, format == TERRAIN_FORMAT_PACKED, blend_format);
+}
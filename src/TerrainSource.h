@@ -0,0 +1,229 @@
+#ifndef TERRAIN_SOURCE_H
+#define TERRAIN_SOURCE_H
+
+#include <glm/glm.hpp>
+
+#include <string>
+#include <memory>
+#include <vector>
+#include <fstream>
+#include <cstdint>
+
+#include "MappedFile.h"
+#include "BlendMap.h"
+
+struct TerrainPage;
+
+/* Backing store for terrain pages
+** Pages that are not resident are read from the source when the camera gets close
+** Dirty pages are journaled when they are evicted and written when the terrain is saved, see TerrainSaveJob
+** sources without a journal keep their dirty pages resident until the save
+
+** Legacy file  -> a single page world, "Data\terrain.txt", heights + dense float blend map
+** Directory    -> "world" header + one file per page, "x_z.page", heights + painted blend tiles, see TERRAIN_PAGE_TILES
+** Chunk file   -> versioned header + chunk directory + page aligned chunks, opened with mmap
+** Packed file  -> chunk file layout with compressed chunks, see TerrainCodec.h
+*/
+
+#define TERRAIN_FORMAT_RAW 0
+#define TERRAIN_FORMAT_PACKED 1
+
+/********************************************************************************************************************************************************/
+
+class TerrainPageSource {
+public:
+	TerrainPageSource(std::string path) : _path ( path ) {}
+	virtual ~TerrainPageSource() = default;
+
+	// width and length are the tiles per page, world is the number of pages
+	// writes return false if anything failed to reach the file
+	virtual bool read_world(int* width, int* length, glm::ivec2* world) = 0;
+	virtual bool write_world(int width, int length, glm::ivec2 world) = 0;
+
+	// returns false if the page has never been written, the page is left flat
+	virtual bool read(TerrainPage* page) = 0;
+	virtual bool write(const TerrainPage* page) = 0;
+
+	// batches go one page at a time unless the source can decode or encode pages in parallel
+	virtual std::vector<bool> read_pages(const std::vector<TerrainPage*>& pages);
+	virtual bool write_pages(const std::vector<const TerrainPage*>& pages);
+
+	// points the blend tiles of a clean page at this source's data, false if the source can't be mapped
+	virtual bool map_blend(TerrainPage* /*page*/) { return false; }
+
+	// sources with a journal take saves as the dirty regions of each page, see TerrainChunkFile
+	virtual bool has_journal() const { return false; }
+	virtual bool journal_pages(const std::vector<const TerrainPage*>& /*pages*/) { return false; }
+	virtual uint64_t journal_bytes() const { return 0; }
+
+	virtual int format() const { return TERRAIN_FORMAT_RAW; }
+
+	const std::string& path() const { return _path; }
+protected:
+	std::string _path;
+};
+
+/********************************************************************************************************************************************************/
+
+class TerrainLegacyFile : public TerrainPageSource {
+public:
+	TerrainLegacyFile(std::string path);
+
+	bool read_world(int* width, int* length, glm::ivec2* world);
+	bool write_world(int width, int length, glm::ivec2 world);
+
+	bool read(TerrainPage* page);
+	bool write(const TerrainPage* page);
+};
+
+/********************************************************************************************************************************************************/
+
+// Page files written by a directory mark their blend map with this, then a tile table (1 painted, 0 unpainted) and the painted float tiles
+// files without it hold the legacy dense blend map, a float weight never has this bit pattern
+#define TERRAIN_PAGE_TILES 0x53544c42	// "BLTS"
+
+class TerrainPageDirectory : public TerrainPageSource {
+public:
+	TerrainPageDirectory(std::string path);
+
+	bool read_world(int* width, int* length, glm::ivec2* world);
+	bool write_world(int width, int length, glm::ivec2 world);
+
+	bool read(TerrainPage* page);
+	bool write(const TerrainPage* page);
+private:
+	std::string page_path(glm::ivec2 coord) const;
+};
+
+/********************************************************************************************************************************************************/
+
+#define TERRAIN_FILE_MAGIC 0x4e525254	// "TRRN"
+#define TERRAIN_PACKED_MAGIC 0x5a525254	// "TRRZ"
+#define TERRAIN_FILE_VERSION 4
+#define TERRAIN_FILE_VERSION_FLOAT_BLEND 3	// packed blend tiles are always quantized floats
+#define TERRAIN_FILE_ALIGNMENT 4096
+#define TERRAIN_PACKED_ALIGNMENT 16
+
+#define TERRAIN_JOURNAL_MAGIC 0x4c4a5254	// "TRJL"
+#define TERRAIN_JOURNAL_VERSION 1
+#define TERRAIN_JOURNAL_EXTENSION ".journal"
+
+/* Chunk file layout
+** Header
+** Chunk[world.x * world.y]		row major by page coordinate, offset 0 -> page was never written and is flat
+** chunk data					heights (float) and blend map of each page, aligned to TERRAIN_FILE_ALIGNMENT
+** blend chunk					uint32_t[BLEND_TILE_COUNT] slot + 1 of each tile, 0 -> unpainted, padded to TERRAIN_FILE_ALIGNMENT
+**								then the painted tiles in the header's blend format, pages that were never painted have no blend chunk
+** The blend format is chosen when the file is created, pages in another format are converted as they are read and written
+
+** Only the header and directory are read on open, chunks are paged in from the mapping when a page is read
+** Blend tiles are uploaded to the gpu straight from the mapping
+
+** Packed files store compressed chunks instead, they are decoded when read and can't be viewed
+** Packed blend chunks hold the packed size of each tile followed by the packed tiles
+** RGBA8 and RGBA16 tiles are packed exactly, float tiles are quantized to 8 bits per channel
+
+** Edit journal, "path.journal"
+** Saves over an open chunk file never touch it, the dirty regions of each page are appended to the journal instead
+** JournalHeader					size of the base file the journal was started against, a journal for another base is ignored
+** JournalRecord + payload			heights -> float rect of page vertices, blend -> one tile in the file's blend format, no payload if unpainted
+** JournalRecord commit				ends each save, records after the last commit are a torn save and are dropped
+** Records are replayed over the base chunks in order when a page is read, only compaction replaces the base file
+*/
+
+class TerrainChunkFile : public TerrainPageSource {
+public:
+	struct Header {
+		uint32_t magic;
+		uint32_t version;
+		int32_t  width;
+		int32_t  length;
+		int32_t  world_x;
+		int32_t  world_z;
+		uint32_t blend_size;
+		uint32_t blend_format;
+		uint32_t chunk_count;
+	};
+
+	struct Chunk {
+		uint64_t heights_offset;
+		uint64_t heights_size;
+		uint64_t blend_offset;
+		uint64_t blend_size;
+	};
+
+	struct JournalHeader {
+		uint32_t magic;
+		uint32_t version;
+		uint64_t base_size;
+	};
+
+	struct JournalRecord {
+		uint32_t type;
+		int32_t  chunk;
+		int32_t  x;			// heights -> first vertex, blend -> tile index
+		int32_t  z;
+		int32_t  width;
+		int32_t  length;
+		uint32_t size;
+		uint32_t checksum;
+	};
+
+	TerrainChunkFile(std::string path, bool packed = false, int blend_format = BLEND_FORMAT_FLOAT);
+
+	bool read_world(int* width, int* length, glm::ivec2* world);
+	bool write_world(int width, int length, glm::ivec2 world);
+
+	bool read(TerrainPage* page);
+	bool write(const TerrainPage* page);
+
+	std::vector<bool> read_pages(const std::vector<TerrainPage*>& pages);
+	bool write_pages(const std::vector<const TerrainPage*>& pages);
+
+	bool map_blend(TerrainPage* page);
+
+	bool has_journal() const;
+	bool journal_pages(const std::vector<const TerrainPage*>& pages);
+	uint64_t journal_bytes() const;
+
+	int format() const;
+
+	static uint32_t file_magic(const std::string& path);
+private:
+	struct JournalEntry {
+		JournalRecord	_record;
+		uint64_t		_offset;		// payload offset in the journal
+	};
+
+	void read_journal();
+	void apply_journal(TerrainPage* page, std::ifstream& journal);
+	std::string journal_path() const;
+
+	int packed_blend_format() const;
+	Chunk* find_chunk(glm::ivec2 coord);
+	const char* map(uint64_t offset, uint64_t size);
+	uint64_t write_chunk(std::fstream& file, uint64_t offset, uint64_t old_size, const char* data, uint64_t size);
+
+	bool								_packed;
+	int									_blend_format;
+	Header								_header;
+	std::vector<Chunk>					_chunks;
+
+	// committed journal records of each chunk in the order they were written, _journal_end is 0 without a journal
+	std::vector<std::vector<JournalEntry>> _journal;
+	uint64_t							_journal_end;
+
+	// older mappings stay open while pages still view them, the file only grows
+	std::vector<std::unique_ptr<MappedFile>> _mappings;
+};
+
+/********************************************************************************************************************************************************/
+
+// Opens an existing terrain for reading, unknown or missing files are treated as legacy
+std::unique_ptr<TerrainPageSource> open_page_source(const std::string& path);
+
+// Opens a save target, existing directories keep the directory layout and everything else is written as a chunk file
+// New chunk files store blend tiles in blend_format
+std::unique_ptr<TerrainPageSource> create_page_source(const std::string& path, int format = TERRAIN_FORMAT_RAW, int blend_format = BLEND_FORMAT_FLOAT);
+
+#endif
@@ -0,0 +1,469 @@
+#include "Terrain.h"
+#include "TerrainKernels.h"
+#include "Parallel.h"
+
+#include <algorithm>
+#include <limits>
+
+#if defined(TERRAIN_SIMD_AVX)
+#include <immintrin.h>
+#elif defined(TERRAIN_SIMD_SSE2)
+#include <emmintrin.h>
+#endif
+
+// without SIMD the lanes would run one after another, slower than the single ray walk, so every ray takes that
+#if defined(TERRAIN_SIMD_AVX) || defined(TERRAIN_SIMD_SSE2)
+#define TERRAIN_TRACE_PACKETS
+#endif
+
+/* Packet ray tracing against the page grids
+** Neighbouring rays are traced together, one per lane, down each page's min/max pyramid. A cell is opened when the segment of any lane
+** still without a nearer hit meets its height range, and the lanes that reach a tile are tested against its two triangles at once
+** Cells are opened front to back along the first ray, bundles that start close together and point the same way open the fewest
+*/
+
+// rays handed to one worker at a time
+constexpr size_t TRACE_JOB_RAYS = 256;
+
+// cell boxes are widened by this many tiles so rays along an edge or through a corner still open both sides
+constexpr float TRACE_PAD = 1e-3f;
+
+// direction components smaller than this are traced as parallel to the axis
+constexpr float TRACE_PARALLEL = 1e-30f;
+
+// packets whose rays start further apart than this many tiles or turn further than this from the first ray are traced one ray at a time,
+// scattered rays open the union of their cells from the top of the pyramid which costs more than walking each ray's own tiles
+constexpr float TRACE_SPREAD_ORIGIN = 16.0f;
+constexpr float TRACE_SPREAD_DIRECTION = 0.05f;
+constexpr float TRACE_TURN = 1.0f - TRACE_SPREAD_DIRECTION * TRACE_SPREAD_DIRECTION / 2.0f;
+
+// same widening as intersect_triangle in Terrain.cpp so both give the same hits
+constexpr float TRACE_EDGE = 1e-6f;
+
+#if defined(TERRAIN_TRACE_PACKETS)
+
+//-----------------------------------------------------------LANES---------------------------------------------------------------------------------------------------------
+
+// masks have all bits set in a lane for true
+#if defined(TERRAIN_SIMD_AVX)
+constexpr int LANES = 8;
+typedef __m256 Lanes;
+
+static Lanes splat(float v) { return _mm256_set1_ps(v); }
+static Lanes load_lanes(const float* v) { return _mm256_loadu_ps(v); }
+static void store_lanes(float* out, Lanes v) { _mm256_storeu_ps(out, v); }
+
+static Lanes add(Lanes a, Lanes b) { return _mm256_add_ps(a, b); }
+static Lanes sub(Lanes a, Lanes b) { return _mm256_sub_ps(a, b); }
+static Lanes mul(Lanes a, Lanes b) { return _mm256_mul_ps(a, b); }
+static Lanes divide(Lanes a, Lanes b) { return _mm256_div_ps(a, b); }
+static Lanes minimum(Lanes a, Lanes b) { return _mm256_min_ps(a, b); }
+static Lanes maximum(Lanes a, Lanes b) { return _mm256_max_ps(a, b); }
+
+static Lanes less(Lanes a, Lanes b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+static Lanes less_equal(Lanes a, Lanes b) { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+static Lanes equal(Lanes a, Lanes b) { return _mm256_cmp_ps(a, b, _CMP_EQ_OQ); }
+static Lanes both(Lanes a, Lanes b) { return _mm256_and_ps(a, b); }
+static Lanes either(Lanes a, Lanes b) { return _mm256_or_ps(a, b); }
+static Lanes except(Lanes a, Lanes b) { return _mm256_andnot_ps(b, a); }
+static Lanes select(Lanes mask, Lanes yes, Lanes no) { return _mm256_blendv_ps(no, yes, mask); }
+static int bits(Lanes mask) { return _mm256_movemask_ps(mask); }
+#elif defined(TERRAIN_SIMD_SSE2)
+constexpr int LANES = 4;
+typedef __m128 Lanes;
+
+static Lanes splat(float v) { return _mm_set1_ps(v); }
+static Lanes load_lanes(const float* v) { return _mm_loadu_ps(v); }
+static void store_lanes(float* out, Lanes v) { _mm_storeu_ps(out, v); }
+
+static Lanes add(Lanes a, Lanes b) { return _mm_add_ps(a, b); }
+static Lanes sub(Lanes a, Lanes b) { return _mm_sub_ps(a, b); }
+static Lanes mul(Lanes a, Lanes b) { return _mm_mul_ps(a, b); }
+static Lanes divide(Lanes a, Lanes b) { return _mm_div_ps(a, b); }
+static Lanes minimum(Lanes a, Lanes b) { return _mm_min_ps(a, b); }
+static Lanes maximum(Lanes a, Lanes b) { return _mm_max_ps(a, b); }
+
+static Lanes less(Lanes a, Lanes b) { return _mm_cmplt_ps(a, b); }
+static Lanes less_equal(Lanes a, Lanes b) { return _mm_cmple_ps(a, b); }
+static Lanes equal(Lanes a, Lanes b) { return _mm_cmpeq_ps(a, b); }
+static Lanes both(Lanes a, Lanes b) { return _mm_and_ps(a, b); }
+static Lanes either(Lanes a, Lanes b) { return _mm_or_ps(a, b); }
+static Lanes except(Lanes a, Lanes b) { return _mm_andnot_ps(b, a); }
+static Lanes select(Lanes mask, Lanes yes, Lanes no) { return _mm_or_ps(_mm_and_ps(mask, yes), _mm_andnot_ps(mask, no)); }
+static int bits(Lanes mask) { return _mm_movemask_ps(mask); }
+#endif
+
+//-----------------------------------------------------------PACKET---------------------------------------------------------------------------------------------------------
+
+// Rays in the grid's space, _origin is shifted to the page being traced
+// lanes past the end of the rays start with a best distance of -1 so they never open a cell
+struct TracePacket {
+	Lanes			_origin[3];
+	Lanes			_direction[3];
+	Lanes			_inverse[3];		// huge for directions parallel to an axis, slabs along them stay open
+	Lanes			_best;				// distance of the nearest hit so far
+
+	glm::vec3		_grid_origin[LANES];
+	TerrainPage*	_page[LANES];
+	glm::ivec2		_tile[LANES];
+	bool			_upper[LANES];
+};
+
+// intersect_triangle of Terrain.cpp across the lanes, the same operations in the same order give the same distances
+static Lanes intersect(const TracePacket& packet, glm::vec3 a, glm::vec3 b, glm::vec3 c, Lanes* t) {
+	const auto& o = packet._origin;
+	const auto& d = packet._direction;
+
+	const auto e1 = b - a;
+	const auto e2 = c - a;
+
+	const Lanes px = sub(mul(d[1], splat(e2.z)), mul(splat(e2.y), d[2]));
+	const Lanes py = sub(mul(d[2], splat(e2.x)), mul(splat(e2.z), d[0]));
+	const Lanes pz = sub(mul(d[0], splat(e2.y)), mul(splat(e2.x), d[1]));
+	const Lanes det = add(add(mul(splat(e1.x), px), mul(splat(e1.y), py)), mul(splat(e1.z), pz));
+	const Lanes inverse = divide(splat(1.0f), det);
+
+	const Lanes sx = sub(o[0], splat(a.x));
+	const Lanes sy = sub(o[1], splat(a.y));
+	const Lanes sz = sub(o[2], splat(a.z));
+	const Lanes u = mul(add(add(mul(sx, px), mul(sy, py)), mul(sz, pz)), inverse);
+
+	const Lanes qx = sub(mul(sy, splat(e1.z)), mul(splat(e1.y), sz));
+	const Lanes qy = sub(mul(sz, splat(e1.x)), mul(splat(e1.z), sx));
+	const Lanes qz = sub(mul(sx, splat(e1.y)), mul(splat(e1.x), sy));
+	const Lanes v = mul(add(add(mul(d[0], qx), mul(d[1], qy)), mul(d[2], qz)), inverse);
+	*t = mul(add(add(mul(splat(e2.x), qx), mul(splat(e2.y), qy)), mul(splat(e2.z), qz)), inverse);
+
+	const Lanes low = splat(-TRACE_EDGE);
+	const Lanes high = splat(1.0f + TRACE_EDGE);
+	Lanes miss = equal(det, splat(0.0f));
+	miss = either(miss, either(less(u, low), less(high, u)));
+	miss = either(miss, either(less(v, low), less(high, add(u, v))));
+	return except(less_equal(splat(0.0f), *t), miss);
+}
+
+// Both triangles of a tile for the open lanes, a lane keeps the hit when it is nearer than its best so far
+// within the tile the upper triangle wins ties like raycast_page
+static void intersect_tile(TracePacket& packet, Lanes open, TerrainPage* page, const float* heights, size_t row, int x, int z) {
+	const auto top = heights + x + z * row;
+	const auto v0 = glm::vec3(x, top[0], z);
+	const auto v1 = glm::vec3(x + 1, top[1], z);
+	const auto v2 = glm::vec3(x, top[row], z + 1);
+	const auto v3 = glm::vec3(x + 1, top[row + 1], z + 1);
+
+	Lanes first, second;
+	const Lanes upper = both(intersect(packet, v2, v0, v1, &first), open);
+	const Lanes lower = both(intersect(packet, v2, v3, v1, &second), open);
+
+	const Lanes use_upper = both(upper, either(except(open, lower), less_equal(first, second)));
+	const Lanes t = select(use_upper, first, second);
+	const Lanes nearer = both(either(upper, lower), less(t, packet._best));
+
+	const int mask = bits(nearer);
+	if (!mask) {
+		return;
+	}
+
+	packet._best = select(nearer, t, packet._best);
+
+	const int upper_bits = bits(use_upper);
+	for (int i = 0; i < LANES; ++i) {
+		if (mask & (1 << i)) {
+			packet._page[i] = page;
+			packet._tile[i] = glm::ivec2(x, z);
+			packet._upper[i] = (upper_bits & (1 << i)) != 0;
+		}
+	}
+}
+
+// Where each lane enters a cell whose slab distances are t_x, t_z, lanes that miss it or have a nearer hit get infinity, past any best distance
+static Lanes enter_cell(const TracePacket& packet, glm::vec2 range, Lanes x0, Lanes x1, Lanes z0, Lanes z1, Lanes enter, Lanes exit) {
+	const Lanes t0 = maximum(maximum(minimum(x0, x1), minimum(z0, z1)), enter);
+	const Lanes t1 = minimum(minimum(maximum(x0, x1), maximum(z0, z1)), exit);
+
+	const Lanes y0 = add(packet._origin[1], mul(packet._direction[1], t0));
+	const Lanes y1 = add(packet._origin[1], mul(packet._direction[1], t1));
+	const Lanes above = less_equal(splat(range.x - TRACE_PAD), maximum(y0, y1));
+	const Lanes below = less_equal(minimum(y0, y1), splat(range.y + TRACE_PAD));
+	const Lanes open = both(less_equal(t0, t1), both(above, below));
+	return select(open, t0, splat(std::numeric_limits<float>::infinity()));
+}
+
+// distance along each lane to the plane x = v, or z = v
+static Lanes slab(const TracePacket& packet, int axis, float v) {
+	return mul(sub(splat(v), packet._origin[axis]), packet._inverse[axis]);
+}
+
+// Depth first down the page's pyramid between enter and exit, the 4 children of an opened cell are tested together on the planes they share
+// and pushed so the one nearest along the first ray comes off first, cells behind every lane's hit by then are dropped
+static void trace_page(TracePacket& packet, TerrainPage* page, Lanes enter, Lanes exit) {
+	const auto& pyramid = page->_node._pyramid;
+	const auto tiles = pyramid.size(0);
+	const float* heights = page->_node._heights.data();
+	const size_t row = static_cast<size_t>(tiles.x) + 1;
+
+	float first_x[LANES], first_z[LANES];
+	store_lanes(first_x, packet._direction[0]);
+	store_lanes(first_z, packet._direction[2]);
+	const int flip_x = first_x[0] < 0.0f ? 1 : 0;
+	const int flip_z = first_z[0] < 0.0f ? 1 : 0;
+	const int order[4][2] = { { 1 - flip_x, 1 - flip_z }, { flip_x, 1 - flip_z }, { 1 - flip_x, flip_z }, { flip_x, flip_z } };
+
+	// each pop pushes at most 4 cells one level down
+	struct Cell {
+		Lanes	_enter;
+		int		_level;
+		int		_x;
+		int		_z;
+	};
+	Cell stack[4 * 32];
+	int count = 0;
+
+	const int top = pyramid.levels() - 1;
+	const Lanes root = enter_cell(packet, pyramid.cell(top, 0, 0), slab(packet, 0, -TRACE_PAD), slab(packet, 0, tiles.x + TRACE_PAD),
+								  slab(packet, 2, -TRACE_PAD), slab(packet, 2, tiles.y + TRACE_PAD), enter, minimum(exit, packet._best));
+	stack[count++] = { root, top, 0, 0 };
+
+	while (count > 0) {
+		const Cell cell = stack[--count];
+		const Lanes open = less_equal(cell._enter, packet._best);
+		if (!bits(open)) {
+			continue;
+		}
+
+		if (cell._level == 0) {
+			intersect_tile(packet, open, page, heights, row, cell._x, cell._z);
+			continue;
+		}
+
+		const int level = cell._level - 1;
+		const int parent_x = cell._x;
+		const int parent_z = cell._z;
+		const auto size = pyramid.size(level);
+		const Lanes limit = minimum(exit, packet._best);
+
+		// child i covers [i, i + 1) of the 3 edges, each padded outwards
+		const int edge_x[3] = { (2 * parent_x) << level, std::min((2 * parent_x + 1) << level, tiles.x), std::min((2 * parent_x + 2) << level, tiles.x) };
+		const int edge_z[3] = { (2 * parent_z) << level, std::min((2 * parent_z + 1) << level, tiles.y), std::min((2 * parent_z + 2) << level, tiles.y) };
+		const Lanes x[4] = { slab(packet, 0, edge_x[0] - TRACE_PAD), slab(packet, 0, edge_x[1] + TRACE_PAD), slab(packet, 0, edge_x[1] - TRACE_PAD), slab(packet, 0, edge_x[2] + TRACE_PAD) };
+		const Lanes z[4] = { slab(packet, 2, edge_z[0] - TRACE_PAD), slab(packet, 2, edge_z[1] + TRACE_PAD), slab(packet, 2, edge_z[1] - TRACE_PAD), slab(packet, 2, edge_z[2] + TRACE_PAD) };
+
+		for (const auto& child : order) {
+			const int child_x = 2 * parent_x + child[0];
+			const int child_z = 2 * parent_z + child[1];
+			if (child_x >= size.x || child_z >= size.y) {
+				continue;
+			}
+
+			const auto range = pyramid.cell(level, child_x, child_z);
+			const Lanes child_enter = enter_cell(packet, range, x[2 * child[0]], x[2 * child[0] + 1], z[2 * child[1]], z[2 * child[1] + 1], enter, limit);
+			if (bits(less_equal(child_enter, packet._best))) {
+				stack[count++] = { child_enter, level, child_x, child_z };
+			}
+		}
+	}
+}
+
+// A page box the packet enters, nearest is the first entry over the lanes
+struct TraceEntry {
+	float			_nearest;
+	TerrainPage*	_page;
+	Lanes			_enter;
+	Lanes			_exit;
+};
+
+// One packet through every page its box test lets in, nearest entry first, a page is skipped once every lane has a hit before it
+// entries is scratch space kept by the caller so packets don't allocate
+static void trace_packet(TracePacket& packet, const std::vector<std::pair<TerrainPage*, glm::vec4>>& pages, int width, int length, std::vector<TraceEntry>& entries) {
+	entries.clear();
+	for (const auto& page : pages) {
+		const auto& box = page.second;		// min, max height of the page and its origin
+
+		Lanes enter = splat(0.0f);
+		Lanes exit = splat(std::numeric_limits<float>::max());
+		const float low[3] = { box.z - TRACE_PAD, box.x - TRACE_PAD, box.w - TRACE_PAD };
+		const float high[3] = { box.z + width + TRACE_PAD, box.y + TRACE_PAD, box.w + length + TRACE_PAD };
+		for (int axis = 0; axis < 3; ++axis) {
+			const Lanes a = mul(sub(splat(low[axis]), packet._origin[axis]), packet._inverse[axis]);
+			const Lanes b = mul(sub(splat(high[axis]), packet._origin[axis]), packet._inverse[axis]);
+			enter = maximum(enter, minimum(a, b));
+			exit = minimum(exit, maximum(a, b));
+		}
+
+		const int mask = bits(both(less_equal(enter, exit), less_equal(enter, packet._best)));
+		if (!mask) {
+			continue;
+		}
+
+		float first[LANES];
+		store_lanes(first, enter);
+		float nearest = std::numeric_limits<float>::max();
+		for (int lane = 0; lane < LANES; ++lane) {
+			if (mask & (1 << lane)) {
+				nearest = std::min(nearest, first[lane]);
+			}
+		}
+
+		entries.push_back({ nearest, page.first, enter, exit });
+	}
+
+	std::sort(entries.begin(), entries.end(), [](const TraceEntry& a, const TraceEntry& b) {
+		return a._nearest < b._nearest;
+	});
+
+	const Lanes x = packet._origin[0];
+	const Lanes z = packet._origin[2];
+	for (const auto& entry : entries) {
+		if (!bits(less_equal(entry._enter, packet._best))) {
+			continue;
+		}
+
+		packet._origin[0] = sub(x, splat(static_cast<float>(entry._page->_origin.x)));
+		packet._origin[2] = sub(z, splat(static_cast<float>(entry._page->_origin.y)));
+		trace_page(packet, entry._page, entry._enter, entry._exit);
+	}
+
+	packet._origin[0] = x;
+	packet._origin[2] = z;
+}
+
+//-----------------------------------------------------------TERRAIN---------------------------------------------------------------------------------------------------------
+
+// Rays are cut into packets of neighbouring rays and the packets into jobs for the worker pool
+// hits come out the same as calling raycast for each ray, ties between tiles may go to either
+// pyramids are built up front, the single ray walk used for scattered packets then only reads the pages
+size_t Terrain::raycast(const glm::vec3* origins, const glm::vec3* directions, size_t count, TerrainHit* hits) {
+	const auto scale = _transform.get_scale();
+
+	std::vector<std::pair<TerrainPage*, glm::vec4>> pages;
+	for (auto& entry : _pages) {
+		const auto page = entry.second.get();
+		const auto& pyramid = page->_node.pyramid();
+		if (pyramid.empty()) {
+			continue;
+		}
+
+		const auto range = pyramid.cell(pyramid.levels() - 1, 0, 0);
+		pages.push_back({ page, glm::vec4(range.x, range.y, page->_origin.x, page->_origin.y) });
+	}
+
+	std::atomic<size_t> total(0);
+	const size_t jobs = (count + TRACE_JOB_RAYS - 1) / TRACE_JOB_RAYS;
+	parallel_for(jobs, [&](size_t job) {
+		const size_t end = std::min(count, (job + 1) * TRACE_JOB_RAYS);
+		size_t found = 0;
+		std::vector<TraceEntry> entries;
+
+		for (size_t begin = job * TRACE_JOB_RAYS; begin < end; begin += LANES) {
+			float lanes[9][LANES];
+			float best[LANES];
+			bool coherent = true;
+
+			TracePacket packet;
+			for (int lane = 0; lane < LANES; ++lane) {
+				const size_t ray = std::min(begin + lane, end - 1);
+				const auto origin = origins[ray] / scale;
+				const auto direction = directions[ray] / scale;
+
+				for (int axis = 0; axis < 3; ++axis) {
+					lanes[axis][lane] = origin[axis];
+					lanes[3 + axis][lane] = direction[axis];
+					lanes[6 + axis][lane] = std::abs(direction[axis]) > TRACE_PARALLEL ? 1.0f / direction[axis] : 1.0f / TRACE_PARALLEL;
+				}
+
+				best[lane] = begin + lane < end ? std::numeric_limits<float>::max() : -1.0f;
+				packet._grid_origin[lane] = origin;
+				packet._page[lane] = nullptr;
+
+				// squared, the angle test is |a - b| <= spread for the unit directions, dot(a, b) >= 1 - spread^2 / 2
+				const auto first = glm::vec3(lanes[3][0], lanes[4][0], lanes[5][0]);
+				const auto spread = origin - packet._grid_origin[0];
+				const float turn = glm::dot(direction, first);
+				coherent = coherent && glm::dot(spread, spread) <= TRACE_SPREAD_ORIGIN * TRACE_SPREAD_ORIGIN && turn > 0.0f &&
+							turn * turn >= TRACE_TURN * TRACE_TURN * glm::dot(direction, direction) * glm::dot(first, first);
+			}
+
+			if (!coherent) {
+				for (size_t ray = begin; ray < std::min(begin + LANES, end); ++ray) {
+					if (raycast(origins[ray], directions[ray], hits + ray)) {
+						++found;
+					}
+					else {
+						hits[ray]._distance = -1.0f;
+					}
+				}
+				continue;
+			}
+
+			for (int axis = 0; axis < 3; ++axis) {
+				packet._origin[axis] = load_lanes(lanes[axis]);
+				packet._direction[axis] = load_lanes(lanes[3 + axis]);
+				packet._inverse[axis] = load_lanes(lanes[6 + axis]);
+			}
+			packet._best = load_lanes(best);
+
+			trace_packet(packet, pages, _width, _length, entries);
+
+			// positions and normals as raycast gives them
+			store_lanes(best, packet._best);
+			for (int lane = 0; lane < LANES && begin + lane < end; ++lane) {
+				auto& hit = hits[begin + lane];
+				const auto page = packet._page[lane];
+				if (!page) {
+					hit._distance = -1.0f;
+					continue;
+				}
+
+				const auto offset = glm::vec3(page->_origin.x, 0.0f, page->_origin.y);
+				const auto o = packet._grid_origin[lane] - offset;
+				const auto d = glm::vec3(lanes[3][lane], lanes[4][lane], lanes[5][lane]);
+				const auto tile = packet._tile[lane];
+				const auto heights = page->_node.get_tile_height(tile.x + tile.y * _width);
+				const auto v0 = glm::vec3(tile.x, heights._v0, tile.y);
+				const auto v1 = glm::vec3(tile.x + 1, heights._v1, tile.y);
+				const auto v2 = glm::vec3(tile.x, heights._v2, tile.y + 1);
+				const auto v3 = glm::vec3(tile.x + 1, heights._v3, tile.y + 1);
+
+				hit._distance = best[lane];
+				hit._position = (o + d * hit._distance + offset) * scale;
+				hit._normal = glm::normalize((packet._upper[lane] ? glm::cross(v0 - v1, v2 - v1) : glm::cross(v3 - v2, v1 - v2)) / scale);
+				hit._tile = tile + page->_origin;
+				++found;
+			}
+		}
+
+		total += found;
+	});
+
+	return total;
+}
+
+#else
+
+size_t Terrain::raycast(const glm::vec3* origins, const glm::vec3* directions, size_t count, TerrainHit* hits) {
+	for (auto& entry : _pages) {
+		entry.second->_node.pyramid();
+	}
+
+	std::atomic<size_t> total(0);
+	const size_t jobs = (count + TRACE_JOB_RAYS - 1) / TRACE_JOB_RAYS;
+	parallel_for(jobs, [&](size_t job) {
+		const size_t end = std::min(count, (job + 1) * TRACE_JOB_RAYS);
+		size_t found = 0;
+
+		for (size_t ray = job * TRACE_JOB_RAYS; ray < end; ++ray) {
+			if (raycast(origins[ray], directions[ray], hits + ray)) {
+				++found;
+			}
+			else {
+				hits[ray]._distance = -1.0f;
+			}
+		}
+
+		total += found;
+	});
+
+	return total;
+}
+
+#endif
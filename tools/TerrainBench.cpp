@@ -0,0 +1,457 @@
+#include "Terrain.h"
+#include "FileReader.h"
+#include "PerlinNoise.hpp"
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <filesystem>
+#include <atomic>
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <random>
+#include <cstdlib>
+#include <new>
+
+/* Terrain microbenchmarks
+** Times the cpu hot paths of the terrain core at several grid sizes and brush radii
+** Each benchmark reports ns/op, heap bytes and allocations per op and items/s, results are also written as json to -out
+
+** terrain_bench [-sizes 100,256,1024,4096] [-radii 1,4,16,64] [-lines 1000,10000,100000] [-time S] [-blend float|rgba16|rgba8] [-filter name] [-out file]
+*/
+
+/********************************************************************************************************************************************************/
+
+// every heap allocation made by the process goes through here, benchmarks read the counters around their timed loop
+static std::atomic<uint64_t> allocated_bytes(0);
+static std::atomic<uint64_t> allocations(0);
+
+static void* counted_alloc(size_t size) {
+	allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+	allocations.fetch_add(1, std::memory_order_relaxed);
+
+	if (auto p = std::malloc(size ? size : 1)) {
+		return p;
+	}
+
+	throw std::bad_alloc();
+}
+
+void* operator new(size_t size)									{ return counted_alloc(size); }
+void* operator new[](size_t size)								{ return counted_alloc(size); }
+void operator delete(void* p) noexcept							{ std::free(p); }
+void operator delete[](void* p) noexcept						{ std::free(p); }
+void operator delete(void* p, size_t) noexcept					{ std::free(p); }
+void operator delete[](void* p, size_t) noexcept				{ std::free(p); }
+
+/********************************************************************************************************************************************************/
+
+struct Options {
+	std::vector<int>	_sizes = { 100, 256, 1024, 4096 };
+	std::vector<int>	_radii = { 1, 4, 16, 64 };
+	std::vector<int>	_lines = { 1000, 10000, 100000 };
+	double				_time = 0.2;
+	int					_blend_format = BLEND_FORMAT_FLOAT;
+	std::string			_filter;
+	std::string			_out = "terrain_bench.json";
+};
+
+struct Result {
+	std::string	_name;
+	int			_size;			// grid size, or lines for file_reader
+	int			_radius;		// brush radius, 0 when the benchmark has none
+	uint64_t	_ops;
+	double		_ns_per_op;
+	double		_bytes_per_op;
+	double		_allocs_per_op;
+	double		_items_per_second;
+	const char*	_unit;
+};
+
+static volatile float sink;
+
+static void usage() {
+	std::cout << "usage: terrain_bench [-sizes 100,256,1024,4096] [-radii 1,4,16,64] [-lines 1000,10000,100000] [-time S]\n"
+			  << "                     [-blend float|rgba16|rgba8] [-filter name] [-out file]\n";
+}
+
+static bool parse_list(const std::string& value, std::vector<int>* list) {
+	list->clear();
+
+	std::stringstream stream(value);
+	std::string item;
+	while (std::getline(stream, item, ',')) {
+		list->push_back(std::stoi(item));
+		if (list->back() <= 0) {
+			return false;
+		}
+	}
+
+	return !list->empty();
+}
+
+static bool parse_options(int argc, char** argv, Options* options) {
+	for (int i = 1; i < argc; ++i) {
+		const std::string arg = argv[i];
+		if (i + 1 >= argc) {
+			std::cout << "MISSING VALUE FOR " << arg << '\n';
+			return false;
+		}
+
+		const std::string value = argv[++i];
+		bool valid = true;
+		try {
+			if (arg == "-sizes")		valid = parse_list(value, &options->_sizes);
+			else if (arg == "-radii")	valid = parse_list(value, &options->_radii);
+			else if (arg == "-lines")	valid = parse_list(value, &options->_lines);
+			else if (arg == "-time")	valid = (options->_time = std::stod(value)) > 0.0;
+			else if (arg == "-filter")	options->_filter = value;
+			else if (arg == "-out")		options->_out = value;
+			else if (arg == "-blend") {
+				if (value == "float")		options->_blend_format = BLEND_FORMAT_FLOAT;
+				else if (value == "rgba16")	options->_blend_format = BLEND_FORMAT_RGBA16;
+				else if (value == "rgba8")	options->_blend_format = BLEND_FORMAT_RGBA8;
+				else valid = false;
+			}
+			else valid = false;
+		}
+		catch (const std::exception&) {
+			valid = false;
+		}
+
+		if (!valid) {
+			std::cout << "INVALID OPTION " << arg << ' ' << value << '\n';
+			return false;
+		}
+	}
+
+	for (const auto size : options->_sizes) {
+		if (size % 2) {
+			std::cout << "GRID SIZES MUST BE EVEN " << size << '\n';
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/********************************************************************************************************************************************************/
+
+// batch runs some ops and returns how many, batches repeat until _time seconds have passed
+// the first batch warms caches and allocations and is only reported when it already took longer than _time
+template <typename Func>
+static Result measure(const Options& options, const char* name, int size, int radius, double items_per_op, const char* unit, Func batch) {
+	using clock = std::chrono::steady_clock;
+
+	const auto run = [&](bool repeat) {
+		const auto bytes = allocated_bytes.load();
+		const auto count = allocations.load();
+		const auto start = clock::now();
+
+		uint64_t ops = 0;
+		double seconds = 0.0;
+		do {
+			ops += batch();
+			seconds = std::chrono::duration<double>(clock::now() - start).count();
+		} while (repeat && seconds < options._time);
+
+		Result result;
+		result._name = name;
+		result._size = size;
+		result._radius = radius;
+		result._ops = ops;
+		result._ns_per_op = seconds * 1e9 / ops;
+		result._bytes_per_op = static_cast<double>(allocated_bytes.load() - bytes) / ops;
+		result._allocs_per_op = static_cast<double>(allocations.load() - count) / ops;
+		result._items_per_second = items_per_op * ops / seconds;
+		result._unit = unit;
+		return result;
+	};
+
+	auto result = run(false);
+	if (result._ns_per_op * result._ops < options._time * 1e9) {
+		result = run(true);
+	}
+
+	std::cout << std::left << std::setw(22) << result._name << std::right
+			  << std::setw(8) << result._size << std::setw(8) << result._radius
+			  << std::setw(12) << result._ops
+			  << std::fixed << std::setprecision(1) << std::setw(16) << result._ns_per_op
+			  << std::setw(14) << result._bytes_per_op
+			  << std::setprecision(2) << std::setw(12) << result._allocs_per_op
+			  << std::scientific << std::setprecision(3) << std::setw(14) << result._items_per_second << ' ' << result._unit
+			  << std::defaultfloat << '\n';
+
+	return result;
+}
+
+static bool selected(const Options& options, const char* name) {
+	return options._filter.empty() || std::string(name).find(options._filter) != std::string::npos;
+}
+
+/********************************************************************************************************************************************************/
+
+// A single resident page of noise, built the same way as `terrain generate`
+struct BenchTerrain {
+	BenchTerrain(int size, int blend_format) :
+		_terrain	( size, size, 1, make_settings(blend_format) )
+	{
+		auto page = std::make_unique<TerrainPage>(&_terrain, glm::ivec2(0, 0));
+		_page = page.get();
+
+		const siv::PerlinNoise noise(1);
+		auto& heights = _page->_node._heights;
+		heights.resize(static_cast<size_t>(size + 1) * (size + 1));
+		for (int z = 0; z <= size; ++z) {
+			for (int x = 0; x <= size; ++x) {
+				heights[x + z * (size + 1)] = static_cast<float>(noise.accumulatedOctaveNoise2D_0_1(x / 64.0, z / 64.0, 4)) * 40.0f;
+			}
+		}
+
+		_page->_node.generate_normals();
+		_terrain._pages[page_key(_page->_coord)] = std::move(page);
+	}
+
+	static TerrainPageSettings make_settings(int blend_format) {
+		TerrainPageSettings settings;
+		settings._blend_format = blend_format;
+		return settings;
+	}
+
+	Terrain			_terrain;
+	TerrainPage*	_page;
+};
+
+static void grid_benchmarks(const Options& options, int size, std::vector<Result>* results) {
+	BenchTerrain bench(size, options._blend_format);
+	auto& terrain = bench._terrain;
+	auto& node = bench._page->_node;
+
+	const double vertices = static_cast<double>(size + 1) * (size + 1);
+	const size_t tiles = static_cast<size_t>(size) * size;
+
+	std::mt19937 random(size);
+	std::uniform_real_distribution<float> coord(0.0f, static_cast<float>(size) - 0.001f);
+
+	if (selected(options, "generate_heights")) {
+		TerrainNode child(&terrain, &node, node._space / 2.0f, glm::vec4(0, 0, size / 2, size / 2), 0);
+		results->push_back(measure(options, "generate_heights", size, 0, vertices, "vertices", [&]() {
+			child.generate_heights(terrain._sub_indices[0]);
+			sink = child._heights.back();
+			return 1;
+		}));
+	}
+
+	if (selected(options, "generate_normals")) {
+		results->push_back(measure(options, "generate_normals", size, 0, vertices, "vertices", [&]() {
+			node.generate_normals();
+			sink = node._normals.back().y;
+			return 1;
+		}));
+	}
+
+	if (selected(options, "calc_face_normal")) {
+		const size_t batch = std::min<size_t>(tiles, 1 << 16);
+		size_t next = 0;
+		results->push_back(measure(options, "calc_face_normal", size, 0, 1.0, "tiles", [&]() {
+			float sum = 0.0f;
+			for (size_t i = 0; i < batch; ++i, next = (next + 1) % tiles) {
+				sum += node.calc_face_normal(static_cast<int>(next))[0].y;
+			}
+			sink = sum;
+			return batch;
+		}));
+	}
+
+	if (selected(options, "exact_height")) {
+		std::vector<glm::vec2> points(1 << 14);
+		for (auto& point : points) {
+			point = glm::vec2(coord(random), coord(random));
+		}
+
+		results->push_back(measure(options, "exact_height", size, 0, 1.0, "queries", [&]() {
+			float sum = 0.0f;
+			for (const auto& point : points) {
+				sum += terrain.exact_height(point.x, point.y);
+			}
+			sink = sum;
+			return points.size();
+		}));
+	}
+
+	// the same queries through the batched kernel, with and without normals
+	if (selected(options, "exact_heights")) {
+		std::vector<glm::vec2> points(1 << 14);
+		for (auto& point : points) {
+			point = glm::vec2(coord(random), coord(random));
+		}
+
+		std::vector<float> heights(points.size());
+		std::vector<glm::vec3> normals(points.size());
+		results->push_back(measure(options, "exact_heights", size, 0, 1.0, "queries", [&]() {
+			terrain.exact_heights(points.data(), points.size(), heights.data());
+			sink = heights.back();
+			return points.size();
+		}));
+
+		results->push_back(measure(options, "exact_heights_normals", size, 0, 1.0, "queries", [&]() {
+			terrain.exact_heights(points.data(), points.size(), heights.data(), normals.data());
+			sink = normals.back().y;
+			return points.size();
+		}));
+	}
+
+	// mouse picking rays from above the terrain, steep enough to land inside the page
+	if (selected(options, "find_height")) {
+		std::uniform_real_distribution<float> inner(size * 0.25f, size * 0.75f);
+		std::uniform_real_distribution<float> slope(-0.1f, 0.1f);
+
+		std::vector<std::array<glm::vec3, 2>> rays(256);
+		for (auto& ray : rays) {
+			ray = { glm::vec3(slope(random), -1.0f, slope(random)), glm::vec3(inner(random), 80.0f, inner(random)) };
+		}
+
+		results->push_back(measure(options, "find_height", size, 0, 1.0, "rays", [&]() {
+			float sum = 0.0f;
+			for (const auto& ray : rays) {
+				sum += terrain.find_height(ray[0], ray[1]);
+			}
+			sink = sum;
+			return rays.size();
+		}));
+	}
+	// a 256 x 128 view from a camera at the edge of the page, rays row by row so neighbouring pixels share packets
+	if (selected(options, "raycast")) {
+		std::vector<glm::vec3> origins, directions;
+		for (int y = 0; y < 128; ++y) {
+			for (int x = 0; x < 256; ++x) {
+				origins.push_back(glm::vec3(size * 0.5f, 80.0f, 0.0f));
+				directions.push_back(glm::normalize(glm::vec3((x - 128) / 256.0f, -0.3f - y / 256.0f, 1.0f)));
+			}
+		}
+
+		std::vector<TerrainHit> hits(origins.size());
+		results->push_back(measure(options, "raycast", size, 0, 1.0, "rays", [&]() {
+			float sum = 0.0f;
+			for (size_t i = 0; i < origins.size(); ++i) {
+				sum += terrain.raycast(origins[i], directions[i], &hits[i]) ? hits[i]._distance : 0.0f;
+			}
+			sink = sum;
+			return origins.size();
+		}));
+
+		results->push_back(measure(options, "raycast_packets", size, 0, 1.0, "rays", [&]() {
+			sink = static_cast<float>(terrain.raycast(origins.data(), directions.data(), origins.size(), hits.data()));
+			return origins.size();
+		}));
+	}
+
+}
+
+static void brush_benchmarks(const Options& options, int size, int radius, std::vector<Result>* results) {
+	BenchTerrain bench(size, options._blend_format);
+	auto& brush = *bench._terrain._brush_mesh;
+	brush._position = glm::vec3(size * 0.5f + 0.3f, 0.0f, size * 0.5f + 0.7f);
+	brush._radius = static_cast<float>(radius);
+
+	if (selected(options, "tiles_within_radius")) {
+		const double tiles = static_cast<double>(brush.tiles_within_radius().size());
+		results->push_back(measure(options, "tiles_within_radius", size, radius, tiles, "tiles", [&]() {
+			sink = static_cast<float>(brush.tiles_within_radius().size());
+			return 1;
+		}));
+	}
+
+	if (selected(options, "paint_blend_map")) {
+		const int radius_texels = glm::mix(0, BLEND_MAP_SIZE - 1, brush._radius / size);
+		const double texels = std::pow(std::min(2 * radius_texels, BLEND_MAP_SIZE), 2);
+		int texture = 0;
+		results->push_back(measure(options, "paint_blend_map", size, radius, texels, "texels", [&]() {
+			brush.paint_blend_map(B_TEXTURE0 + (texture++ % 4), 0.05f);
+			return 1;
+		}));
+	}
+}
+
+// Sections of 100 keys in the FileReader format, the file is read back by the constructor each op
+static void file_reader_benchmark(const Options& options, int lines, std::vector<Result>* results) {
+	if (!selected(options, "file_reader")) {
+		return;
+	}
+
+	const auto file = (std::filesystem::temp_directory_path() / ("terrain_bench_" + std::to_string(lines) + ".txt")).string();
+	{
+		std::ofstream out(file);
+		for (int i = 0; i < lines; ++i) {
+			if (i % 100 == 0) {
+				out << "# section_" << i / 100 << '\n';
+			}
+			out << "i_value_" << i << ' ' << i * 7 << '\n';
+		}
+	}
+
+	const double bytes = static_cast<double>(std::filesystem::file_size(file));
+	results->push_back(measure(options, "file_reader", lines, 0, bytes, "bytes", [&]() {
+		FileReader reader(file.c_str());
+		sink = static_cast<float>(reader.is_read());
+		return 1;
+	}));
+
+	std::error_code error;
+	std::filesystem::remove(file, error);
+}
+
+static bool write_json(const std::string& file, const Options& options, const std::vector<Result>& results) {
+	std::ofstream out(file);
+	if (!out) {
+		std::cout << "FAILED TO WRITE RESULTS " << file << '\n';
+		return false;
+	}
+
+	out << "{\n  \"min_time\": " << options._time << ",\n  \"blend_format\": " << options._blend_format << ",\n  \"results\": [\n";
+	for (size_t i = 0; i < results.size(); ++i) {
+		const auto& r = results[i];
+		out << "    { \"name\": \"" << r._name << "\", \"size\": " << r._size << ", \"radius\": " << r._radius
+			<< ", \"ops\": " << r._ops << ", \"ns_per_op\": " << r._ns_per_op
+			<< ", \"bytes_per_op\": " << r._bytes_per_op << ", \"allocs_per_op\": " << r._allocs_per_op
+			<< ", \"items_per_second\": " << r._items_per_second << ", \"unit\": \"" << r._unit << "\" }"
+			<< (i + 1 < results.size() ? ",\n" : "\n");
+	}
+	out << "  ]\n}\n";
+
+	return true;
+}
+
+int main(int argc, char** argv) {
+	Options options;
+	if (!parse_options(argc, argv, &options)) {
+		usage();
+		return 1;
+	}
+
+	std::cout << std::left << std::setw(22) << "benchmark" << std::right << std::setw(8) << "size" << std::setw(8) << "radius"
+			  << std::setw(12) << "ops" << std::setw(16) << "ns/op" << std::setw(14) << "bytes/op" << std::setw(12) << "allocs/op"
+			  << std::setw(16) << "items/s" << '\n';
+
+	std::vector<Result> results;
+	for (const auto size : options._sizes) {
+		grid_benchmarks(options, size, &results);
+	}
+
+	// brush cost scales with the radius relative to the page, the radii run on the smallest page
+	const int brush_size = *std::min_element(options._sizes.begin(), options._sizes.end());
+	for (const auto radius : options._radii) {
+		brush_benchmarks(options, brush_size, radius, &results);
+	}
+
+	for (const auto lines : options._lines) {
+		file_reader_benchmark(options, lines, &results);
+	}
+
+	return write_json(options._out, options, results) ? 0 : 1;
+}
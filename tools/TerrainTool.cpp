@@ -0,0 +1,1158 @@
+#include "Terrain.h"
+#include "TerrainSource.h"
+#include "TerrainCodec.h"
+#include "TerrainKernels.h"
+#include "PerlinNoise.hpp"
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <filesystem>
+#include <algorithm>
+#include <limits>
+#include <functional>
+#include <thread>
+#include <random>
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+
+/* Headless terrain tool
+** Links the terrain data code without gl so map libraries can be processed on machines without a gpu
+
+** terrain generate <file> [-pages WxL] [-size N] [-height H] [-seed N] [-format raw|packed|directory] [-blend float|rgba16|rgba8]
+** terrain convert <in> <out> [-format raw|packed|directory] [-blend float|rgba16|rgba8]
+** terrain inspect <file>
+** terrain benchmark <file> [-iterations N] [-depth N]
+** terrain verify [codec|upsample|pyramid|raycast|heights|journal] [-seed N]
+*/
+
+#define FORMAT_DIRECTORY -1
+
+struct Options {
+	std::vector<std::string> _files;
+
+	glm::ivec2	_pages = glm::ivec2(4, 4);
+	int			_size = 100;
+	float		_height = 40.0f;
+	uint32_t	_seed = 1;
+	int			_format = TERRAIN_FORMAT_RAW;
+	int			_blend_format = BLEND_FORMAT_FLOAT;
+	int			_iterations = 5;
+	int			_depth = 3;
+};
+
+static void usage() {
+	std::cout << "usage: terrain <command> [options]\n"
+			  << "  generate <file> [-pages WxL] [-size N] [-height H] [-seed N] [-format raw|packed|directory] [-blend float|rgba16|rgba8]\n"
+			  << "  convert <in> <out> [-format raw|packed|directory] [-blend float|rgba16|rgba8]\n"
+			  << "  inspect <file>\n"
+			  << "  benchmark <file> [-iterations N] [-depth N]\n"
+			  << "  verify [codec|upsample|pyramid|raycast|heights|journal] [-seed N]\n";
+}
+
+static bool parse_format(const std::string& name, int* format) {
+	if (name == "raw")			*format = TERRAIN_FORMAT_RAW;
+	else if (name == "packed")	*format = TERRAIN_FORMAT_PACKED;
+	else if (name == "directory") *format = FORMAT_DIRECTORY;
+	else return false;
+	return true;
+}
+
+static bool parse_blend_format(const std::string& name, int* format) {
+	if (name == "float")		*format = BLEND_FORMAT_FLOAT;
+	else if (name == "rgba16")	*format = BLEND_FORMAT_RGBA16;
+	else if (name == "rgba8")	*format = BLEND_FORMAT_RGBA8;
+	else return false;
+	return true;
+}
+
+static bool parse_options(int argc, char** argv, Options* options) {
+	for (int i = 2; i < argc; ++i) {
+		const std::string arg = argv[i];
+		if (arg[0] != '-') {
+			options->_files.push_back(arg);
+			continue;
+		}
+
+		if (i + 1 >= argc) {
+			std::cout << "MISSING VALUE FOR " << arg << '\n';
+			return false;
+		}
+
+		const std::string value = argv[++i];
+		bool valid = true;
+		try {
+			if (arg == "-pages")			valid = sscanf(value.c_str(), "%dx%d", &options->_pages.x, &options->_pages.y) == 2;
+			else if (arg == "-size")		options->_size = std::stoi(value);
+			else if (arg == "-height")		options->_height = std::stof(value);
+			else if (arg == "-seed")		options->_seed = static_cast<uint32_t>(std::stoul(value));
+			else if (arg == "-format")		valid = parse_format(value, &options->_format);
+			else if (arg == "-blend")		valid = parse_blend_format(value, &options->_blend_format);
+			else if (arg == "-iterations")	options->_iterations = std::stoi(value);
+			else if (arg == "-depth")		options->_depth = std::stoi(value);
+			else valid = false;
+		}
+		catch (const std::exception&) {
+			valid = false;
+		}
+
+		if (!valid) {
+			std::cout << "INVALID OPTION " << arg << ' ' << value << '\n';
+			return false;
+		}
+	}
+
+	return true;
+}
+
+// directory targets are picked by create_page_source when the directory exists
+static int target_format(const std::string& file, int format) {
+	if (format == FORMAT_DIRECTORY) {
+		std::filesystem::create_directories(file);
+		return TERRAIN_FORMAT_RAW;
+	}
+
+	return format;
+}
+
+static const char* source_type(const std::string& file) {
+	if (std::filesystem::is_directory(file)) {
+		return "directory";
+	}
+
+	switch (TerrainChunkFile::file_magic(file)) {
+	case TERRAIN_FILE_MAGIC:	return "chunk file";
+	case TERRAIN_PACKED_MAGIC:	return "packed chunk file";
+	default:					return "legacy file";
+	}
+}
+
+static uint64_t file_bytes(const std::string& file) {
+	std::error_code error;
+	if (!std::filesystem::is_directory(file)) {
+		const auto size = std::filesystem::file_size(file, error);
+		return error ? 0 : size;
+	}
+
+	uint64_t bytes = 0;
+	for (const auto& entry : std::filesystem::directory_iterator(file, error)) {
+		bytes += entry.is_regular_file() ? entry.file_size() : 0;
+	}
+
+	return bytes;
+}
+
+// every page of the world in batches of one page per core, the batch is cleared before the next is read
+template <typename Func>
+static void for_each_page(Terrain* terrain, Func func) {
+	const size_t batch_size = std::max(std::thread::hardware_concurrency(), 1u);
+
+	std::vector<glm::ivec2> batch;
+	const auto flush = [&]() {
+		terrain->load_pages(batch);
+		for (const auto& coord : batch) {
+			func(terrain->find_page(coord));
+		}
+
+		terrain->clear_pages();
+		batch.clear();
+	};
+
+	for (int z = 0; z < terrain->_world.y; ++z) {
+		for (int x = 0; x < terrain->_world.x; ++x) {
+			batch.push_back(glm::ivec2(x, z));
+			if (batch.size() >= batch_size) {
+				flush();
+			}
+		}
+	}
+
+	flush();
+}
+
+static double elapsed_ms(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+static bool save(Terrain* terrain, const std::string& file, int format) {
+	bool saved = false;
+	terrain->_save_callback = [&](bool result) { saved = result; };
+	terrain->save(file, format);
+	terrain->wait_save();
+	terrain->_save_callback = nullptr;
+
+	return saved;
+}
+
+/********************************************************************************************************************************************************/
+
+// Fractal noise sampled in world vertex coordinates so neighbouring pages agree on their shared border
+static void noise_heights(TerrainPage* page, const siv::PerlinNoise& noise, float height) {
+	const auto terrain = page->_node._root;
+	const double frequency = 1.0 / 64.0;
+
+	auto& heights = page->_node._heights;
+	heights.resize(static_cast<size_t>(terrain->_width + 1) * (terrain->_length + 1));
+
+	for (int vz = 0; vz <= terrain->_length; ++vz) {
+		for (int vx = 0; vx <= terrain->_width; ++vx) {
+			const double wx = (page->_origin.x + vx) * frequency;
+			const double wz = (page->_origin.y + vz) * frequency;
+			heights[vx + vz * (terrain->_width + 1)] = static_cast<float>(noise.accumulatedOctaveNoise2D_0_1(wx, wz, 6) * height);
+		}
+	}
+}
+
+static int generate(const Options& options) {
+	if (options._files.size() != 1 || options._size <= 0 || options._size % 2 || options._pages.x <= 0 || options._pages.y <= 0) {
+		usage();
+		return 1;
+	}
+
+	const auto& file = options._files[0];
+	const int format = target_format(file, options._format);
+
+	TerrainPageSettings settings;
+	settings._blend_format = options._blend_format;
+	Terrain terrain(options._size, options._size, 0, settings);
+	terrain._world = options._pages;
+
+	auto target = create_page_source(file, format, options._blend_format);
+	bool written = target->write_world(terrain._width, terrain._length, terrain._world);
+
+	const siv::PerlinNoise noise(options._seed);
+	const size_t batch_size = std::max(std::thread::hardware_concurrency(), 1u);
+
+	const auto start = std::chrono::steady_clock::now();
+	std::vector<std::unique_ptr<TerrainPage>> pages;
+	const auto flush = [&]() {
+		std::vector<const TerrainPage*> writes;
+		for (const auto& page : pages) {
+			writes.push_back(page.get());
+		}
+
+		written = target->write_pages(writes) && written;
+		pages.clear();
+	};
+
+	for (int z = 0; z < terrain._world.y; ++z) {
+		for (int x = 0; x < terrain._world.x; ++x) {
+			auto page = std::make_unique<TerrainPage>(&terrain, glm::ivec2(x, z));
+			noise_heights(page.get(), noise, options._height);
+
+			pages.push_back(std::move(page));
+			if (pages.size() >= batch_size) {
+				flush();
+			}
+		}
+	}
+
+	flush();
+	target.reset();
+
+	if (!written) {
+		std::cout << "FAILED TO WRITE TERRAIN " << file << '\n';
+		return 1;
+	}
+
+	std::cout << "generated " << file << ' ' << terrain._world.x << 'x' << terrain._world.y << " pages of "
+			  << terrain._width << 'x' << terrain._length << " in " << std::fixed << std::setprecision(1) << elapsed_ms(start) << " ms, "
+			  << file_bytes(file) << " bytes\n";
+	return 0;
+}
+
+static int convert(const Options& options) {
+	if (options._files.size() != 2) {
+		usage();
+		return 1;
+	}
+
+	const auto& in = options._files[0];
+	const auto& out = options._files[1];
+	if (!std::filesystem::exists(in)) {
+		std::cout << "TERRAIN FILE NOT FOUND " << in << '\n';
+		return 1;
+	}
+
+	if (std::filesystem::exists(out) && std::filesystem::equivalent(in, out)) {
+		std::cout << "CONVERT TARGET IS THE SOURCE " << out << '\n';
+		return 1;
+	}
+
+	TerrainPageSettings settings;
+	settings._blend_format = options._blend_format;
+	Terrain terrain(0, 0, 0, settings);
+	terrain.load(in);
+
+	const auto start = std::chrono::steady_clock::now();
+	if (!save(&terrain, out, target_format(out, options._format))) {
+		return 1;
+	}
+
+	std::cout << "converted " << in << " (" << file_bytes(in) << " bytes) -> " << out << " (" << file_bytes(out) << " bytes) in "
+			  << std::fixed << std::setprecision(1) << elapsed_ms(start) << " ms\n";
+	return 0;
+}
+
+static int inspect(const Options& options) {
+	if (options._files.size() != 1) {
+		usage();
+		return 1;
+	}
+
+	const auto& file = options._files[0];
+	if (!std::filesystem::exists(file)) {
+		std::cout << "TERRAIN FILE NOT FOUND " << file << '\n';
+		return 1;
+	}
+
+	Terrain terrain(0, 0, 0);
+	terrain.load(file);
+
+	float min_height = std::numeric_limits<float>::max();
+	float max_height = std::numeric_limits<float>::lowest();
+	double sum = 0.0;
+	size_t vertices = 0;
+	size_t painted_pages = 0;
+	size_t painted_tiles = 0;
+	size_t resident = 0;
+
+	for_each_page(&terrain, [&](TerrainPage* page) {
+		for (const auto height : page->_node._heights) {
+			min_height = std::min(min_height, height);
+			max_height = std::max(max_height, height);
+			sum += height;
+		}
+
+		vertices += page->_node._heights.size();
+		painted_tiles += page->_blend_map.tile_count();
+		painted_pages += page->_blend_map.tile_count() ? 1 : 0;
+		resident += page->resident_bytes();
+	});
+
+	const size_t pages = static_cast<size_t>(terrain._world.x) * terrain._world.y;
+	std::cout << std::fixed << std::setprecision(3)
+			  << "file            " << file << '\n'
+			  << "type            " << source_type(file) << '\n'
+			  << "bytes           " << file_bytes(file) << '\n'
+			  << "journal bytes   " << terrain._source->journal_bytes() << '\n'
+			  << "page size       " << terrain._width << 'x' << terrain._length << '\n'
+			  << "world           " << terrain._world.x << 'x' << terrain._world.y << " pages\n"
+			  << "heights         " << (vertices ? min_height : 0.0f) << " .. " << (vertices ? max_height : 0.0f)
+			  << ", mean " << (vertices ? sum / vertices : 0.0) << '\n'
+			  << "painted pages   " << painted_pages << " / " << pages << '\n'
+			  << "painted tiles   " << painted_tiles << " / " << pages * BLEND_TILE_COUNT << '\n'
+			  << "resident bytes  " << resident << " with every page loaded at its root lod\n";
+	return 0;
+}
+
+// Times the data paths the renderer and the editor run per page, every page of the world is measured
+static int benchmark(const Options& options) {
+	if (options._files.size() != 1 || options._iterations <= 0) {
+		usage();
+		return 1;
+	}
+
+	const auto& file = options._files[0];
+	if (!std::filesystem::exists(file)) {
+		std::cout << "TERRAIN FILE NOT FOUND " << file << '\n';
+		return 1;
+	}
+
+	Terrain terrain(0, 0, options._depth);
+	terrain.load(file);
+
+	const size_t pages = static_cast<size_t>(terrain._world.x) * terrain._world.y;
+	const auto report = [&](const char* name, double ms, size_t count, uint64_t bytes = 0) {
+		std::cout << std::left << std::setw(24) << name << std::right << std::fixed << std::setprecision(3)
+				  << std::setw(12) << ms / count << " ms/page";
+		if (bytes) {
+			std::cout << std::setw(12) << std::setprecision(1) << bytes / (ms / 1000.0) / (1024.0 * 1024.0) << " MB/s";
+		}
+		std::cout << '\n';
+	};
+
+	std::cout << file << ", " << terrain._world.x << 'x' << terrain._world.y << " pages of " << terrain._width << 'x' << terrain._length
+			  << ", depth " << terrain._depth << ", " << options._iterations << " iterations\n";
+
+	double load_ms = 0.0;
+	for (int i = 0; i < options._iterations; ++i) {
+		const auto start = std::chrono::steady_clock::now();
+		for_each_page(&terrain, [](TerrainPage*) {});
+		load_ms += elapsed_ms(start);
+	}
+	report("load", load_ms, pages * options._iterations, file_bytes(file) * options._iterations);
+
+	double normals_ms = 0.0;
+	double subdivide_ms = 0.0;
+	double materialize_ms = 0.0;
+	for_each_page(&terrain, [&](TerrainPage* page) {
+		auto& node = page->_node;
+		for (int i = 0; i < options._iterations; ++i) {
+			auto start = std::chrono::steady_clock::now();
+			node.generate_normals();
+			normals_ms += elapsed_ms(start);
+
+			node._children = TerrainChildren();
+			start = std::chrono::steady_clock::now();
+			node.subdivide();
+			subdivide_ms += elapsed_ms(start);
+
+			// every child grid of the full tree, what drawing the page at its deepest lod builds
+			start = std::chrono::steady_clock::now();
+			std::vector<TerrainNode*> nodes;
+			std::vector<TerrainNode*> stack = { &node };
+			while (!stack.empty()) {
+				const auto current = stack.back();
+				stack.pop_back();
+
+				nodes.push_back(current);
+				if (current->has_children()) {
+					for (auto& child : current->_children) {
+						stack.push_back(child.get());
+					}
+				}
+			}
+			materialize_nodes(nodes);
+			materialize_ms += elapsed_ms(start);
+
+			node.release_children();
+		}
+	});
+	report("generate_normals", normals_ms, pages * options._iterations);
+	report("subdivide", subdivide_ms, pages * options._iterations);
+	report("subdivide + materialize", subdivide_ms + materialize_ms, pages * options._iterations);
+
+	// each save is loaded back from the file it wrote
+	const std::pair<const char*, int> formats[] = { { "raw", TERRAIN_FORMAT_RAW }, { "packed", TERRAIN_FORMAT_PACKED } };
+	for (const auto& format : formats) {
+		const auto temp = (std::filesystem::temp_directory_path() / ("terrain_benchmark_" + std::string(format.first) + ".terrain")).string();
+
+		double save_ms = 0.0;
+		for (int i = 0; i < options._iterations; ++i) {
+			Terrain copy(0, 0, options._depth);
+			copy.load(file);
+
+			const auto start = std::chrono::steady_clock::now();
+			if (!save(&copy, temp, format.second)) {
+				return 1;
+			}
+			save_ms += elapsed_ms(start);
+		}
+		report((std::string("save ") + format.first).c_str(), save_ms, pages * options._iterations, file_bytes(temp) * options._iterations);
+
+		{
+			Terrain saved(0, 0, options._depth);
+			saved.load(temp);
+
+			double load_saved_ms = 0.0;
+			for (int i = 0; i < options._iterations; ++i) {
+				const auto start = std::chrono::steady_clock::now();
+				for_each_page(&saved, [](TerrainPage*) {});
+				load_saved_ms += elapsed_ms(start);
+			}
+			report((std::string("load ") + format.first).c_str(), load_saved_ms, pages * options._iterations, file_bytes(temp) * options._iterations);
+		}
+
+		std::error_code error;
+		std::filesystem::remove(temp, error);
+		std::filesystem::remove(temp + TERRAIN_JOURNAL_EXTENSION, error);
+	}
+
+	return 0;
+}
+
+// Packed heights and blend tiles must come back within pack_*_tolerance of what was packed, rgba8/16 tiles exactly
+// every shorter prefix of a packed chunk must be rejected rather than decoded
+static int verify_codec(const Options& options) {
+	std::mt19937 random(options._seed);
+	const siv::PerlinNoise noise(options._seed);
+	int failures = 0;
+
+	const auto report = [&](const char* name, int width, int length, size_t bytes, float error, float tolerance) {
+		const bool passed = error <= tolerance;
+		std::cout << (passed ? "ok     " : "FAILED ") << std::left << std::setw(24) << name << std::right << std::setw(4) << width << 'x'
+				  << std::left << std::setw(4) << length << std::right << std::setw(10) << bytes << " bytes" << std::scientific << std::setprecision(3)
+				  << "   error " << error << "   tolerance " << tolerance << std::defaultfloat << '\n';
+		failures += passed ? 0 : 1;
+	};
+
+	// the larger chunks are cut at 256 points, the last byte is always dropped once
+	const auto check_truncated = [&](const char* name, const std::vector<uint8_t>& packed, auto unpack) {
+		std::vector<size_t> sizes = { packed.size() - 1 };
+		for (size_t size = 0; size + 1 < packed.size(); size += std::max<size_t>(packed.size() / 256, 1)) {
+			sizes.push_back(size);
+		}
+
+		for (const auto size : sizes) {
+			if (unpack(size)) {
+				std::cout << "VERIFY FAILED " << name << " DECODED A CHUNK TRUNCATED TO " << size << " OF " << packed.size() << " BYTES\n";
+				++failures;
+				return;
+			}
+		}
+	};
+
+	// flat, noisy, smooth and offset grids, sizes include a single vertex and odd rows
+	const glm::ivec2 height_sizes[] = { { 1, 1 }, { 2, 3 }, { 65, 65 }, { 257, 129 } };
+	const std::pair<const char*, std::function<float(int, int)>> height_cases[] = {
+		{ "heights flat zero",	[](int, int) { return 0.0f; } },
+		{ "heights flat",		[](int, int) { return 12.5f; } },
+		{ "heights noisy",		[&](int, int) { return std::uniform_real_distribution<float>(-500.0f, 500.0f)(random); } },
+		{ "heights smooth",		[&](int x, int z) { return static_cast<float>(noise.accumulatedOctaveNoise2D_0_1(x / 64.0, z / 64.0, 6) * 40.0); } },
+		{ "heights offset",		[](int x, int z) { return 10000.0f + x * 0.25f - z * 0.5f; } },
+	};
+
+	for (const auto& size : height_sizes) {
+		for (const auto& test : height_cases) {
+			std::vector<float> heights(static_cast<size_t>(size.x) * size.y);
+			for (int z = 0; z < size.y; ++z) {
+				for (int x = 0; x < size.x; ++x) {
+					heights[x + z * size.x] = test.second(x, z);
+				}
+			}
+
+			const auto packed = pack_heights(heights.data(), size.x, size.y);
+			std::vector<float> unpacked(heights.size());
+
+			float error = std::numeric_limits<float>::infinity();
+			if (unpack_heights(packed.data(), packed.size(), unpacked.data(), size.x, size.y)) {
+				error = 0.0f;
+				for (size_t i = 0; i < heights.size(); ++i) {
+					error = std::max(error, std::abs(unpacked[i] - heights[i]));
+				}
+			}
+			report(test.first, size.x, size.y, packed.size(), error, pack_heights_tolerance(packed.data(), packed.size()));
+
+			check_truncated(test.first, packed, [&](size_t bytes) {
+				return unpack_heights(packed.data(), bytes, unpacked.data(), size.x, size.y);
+			});
+		}
+	}
+
+	// blend tiles are weights in 0..1, unpainted channels stay flat
+	const std::pair<const char*, std::function<glm::vec4(int, int)>> blend_cases[] = {
+		{ "blend flat zero",	[](int, int) { return glm::vec4(0.0f); } },
+		{ "blend flat",			[](int, int) { return glm::vec4(1.0f, 0.0f, 0.0f, 0.0f); } },
+		{ "blend noisy",		[&](int, int) {
+			std::uniform_real_distribution<float> weight(0.0f, 1.0f);
+			return glm::vec4(weight(random), weight(random), weight(random), weight(random));
+		} },
+		{ "blend smooth",		[](int x, int z) {
+			const float t = static_cast<float>(x + z) / (2 * BLEND_TILE_SIZE);
+			return glm::vec4(1.0f - t, t, 0.0f, 0.0f);
+		} },
+	};
+
+	for (const auto& test : blend_cases) {
+		std::vector<glm::vec4> blend(BLEND_TILE_TEXELS);
+		for (int z = 0; z < BLEND_TILE_SIZE; ++z) {
+			for (int x = 0; x < BLEND_TILE_SIZE; ++x) {
+				blend[x + z * BLEND_TILE_SIZE] = test.second(x, z);
+			}
+		}
+
+		const auto packed = pack_blend(blend.data(), BLEND_TILE_SIZE, BLEND_TILE_SIZE);
+		std::vector<glm::vec4> unpacked(blend.size());
+
+		float error = std::numeric_limits<float>::infinity();
+		if (unpack_blend(packed.data(), packed.size(), unpacked.data(), BLEND_TILE_SIZE, BLEND_TILE_SIZE)) {
+			error = 0.0f;
+			for (size_t i = 0; i < blend.size(); ++i) {
+				const auto difference = glm::abs(unpacked[i] - blend[i]);
+				error = std::max(error, std::max(std::max(difference.x, difference.y), std::max(difference.z, difference.w)));
+			}
+		}
+		report(test.first, BLEND_TILE_SIZE, BLEND_TILE_SIZE, packed.size(), error, pack_blend_tolerance(packed.data(), packed.size()));
+
+		check_truncated(test.first, packed, [&](size_t bytes) {
+			return unpack_blend(packed.data(), bytes, unpacked.data(), BLEND_TILE_SIZE, BLEND_TILE_SIZE);
+		});
+
+		// rgba8 and rgba16 tiles are packed exactly
+		for (int channel_size = 1; channel_size <= 2; ++channel_size) {
+			const std::string name = test.first + std::string(channel_size == 1 ? " rgba8" : " rgba16");
+			const float scale = channel_size == 1 ? 255.0f : 65535.0f;
+
+			std::vector<uint8_t> texels(blend.size() * 4 * channel_size);
+			for (size_t i = 0; i < texels.size() / channel_size; ++i) {
+				const auto value = static_cast<uint16_t>(std::round(blend[i / 4][static_cast<int>(i % 4)] * scale));
+				std::memcpy(&texels[i * channel_size], &value, channel_size);
+			}
+
+			const auto packed_texels = pack_texels(texels.data(), BLEND_TILE_SIZE, BLEND_TILE_SIZE, channel_size);
+			std::vector<uint8_t> unpacked_texels(texels.size());
+
+			float texel_error = std::numeric_limits<float>::infinity();
+			if (unpack_texels(packed_texels.data(), packed_texels.size(), unpacked_texels.data(), BLEND_TILE_SIZE, BLEND_TILE_SIZE, channel_size)) {
+				texel_error = unpacked_texels == texels ? 0.0f : 1.0f;
+			}
+			report(name.c_str(), BLEND_TILE_SIZE, BLEND_TILE_SIZE, packed_texels.size(), texel_error, 0.0f);
+
+			check_truncated(name.c_str(), packed_texels, [&](size_t bytes) {
+				return unpack_texels(packed_texels.data(), bytes, unpacked_texels.data(), BLEND_TILE_SIZE, BLEND_TILE_SIZE, channel_size);
+			});
+		}
+	}
+
+	return failures;
+}
+
+static bool check(bool passed, const std::string& name) {
+	std::cout << (passed ? "ok     " : "FAILED ") << name << '\n';
+	return passed;
+}
+
+// Old TerrainNode::generate_heights, upsample_heights must match it bit for bit
+static void reference_upsample(const std::vector<float>& parent, size_t index, int width, std::vector<float>* heights) {
+	auto& out = *heights;
+	out.assign(parent.size(), 0.0f);
+
+	auto valid = [&](size_t i) {
+		return i <= parent.size() - 1;
+	};
+
+	auto avg = [&](size_t i, size_t i2) {
+		int divisor = 0;
+		float value = 0.0f;
+		for (const auto j : { i, i2 }) {
+			if (valid(j)) {
+				value += parent[j];
+				++divisor;
+			}
+		}
+
+		return value / (float)divisor;
+	};
+
+	auto avg2 = [&](int i, int i2, int i3, int i4) {
+		int divisor = 0;
+		float value = 0.0f;
+		for (const auto j : { i, i2, i3, i4 }) {
+			if (valid(static_cast<size_t>(j))) {
+				value += parent[j];
+				++divisor;
+			}
+		}
+
+		return value / (float)divisor;
+	};
+
+	size_t in_i = index;
+	size_t out_i = 0;
+	int count = 0;
+
+	bool even = true;
+	while (out_i < out.size()) {
+		if (even) {
+			out[out_i] = parent[in_i];
+			++count;
+
+			while (count < width) {
+				++out_i;
+				++in_i;
+				out[out_i] = avg(in_i - 1, in_i);
+				++count;
+
+				++out_i;
+				out[out_i] = parent[in_i];
+				++count;
+			}
+
+			++in_i;
+			in_i += width / 2;
+		}
+		else {
+			out[out_i] = avg(in_i - width - 1, in_i);
+			++count;
+
+			while (count < width) {
+				++out_i;
+				++in_i;
+				out[out_i] = avg2(static_cast<int>(in_i), static_cast<int>(in_i - width - 1), static_cast<int>(in_i - 1), static_cast<int>(in_i - width - 2));
+				++count;
+
+				++out_i;
+				out[out_i] = avg(in_i - width - 1, in_i);
+				++count;
+			}
+
+			in_i -= width / 2;
+		}
+
+		++out_i;
+		count = 0;
+		even = !even;
+	}
+}
+
+// Every quadrant of noisy grids and of their children, compared bitwise since the kernel keeps the old sums and their order
+static int verify_upsample(const Options& options) {
+	std::mt19937 random(options._seed);
+	std::uniform_real_distribution<float> height(-300.0f, 300.0f);
+	int failures = 0;
+
+	for (const int size : { 2, 4, 16, 64, 100 }) {
+		const size_t vertices = static_cast<size_t>(size + 1) * (size + 1);
+		const size_t quadrants[4] = { 0, static_cast<size_t>(size / 2), static_cast<size_t>(size * size / 2 + size / 2), static_cast<size_t>(size * size / 2 + size) };
+
+		std::vector<float> root(vertices);
+		for (auto& h : root) {
+			h = height(random);
+		}
+
+		std::vector<float> expected, actual(vertices), grandchild(vertices);
+		for (int q = 0; q < 4; ++q) {
+			reference_upsample(root, quadrants[q], size, &expected);
+			upsample_heights(root.data(), quadrants[q], size, size, actual.data());
+			bool passed = std::memcmp(expected.data(), actual.data(), sizeof(float) * vertices) == 0;
+
+			// children of the child, whose heights are already averages
+			const auto child = expected;
+			for (int g = 0; g < 4 && passed; ++g) {
+				reference_upsample(child, quadrants[g], size, &expected);
+				upsample_heights(child.data(), quadrants[g], size, size, grandchild.data());
+				passed = std::memcmp(expected.data(), grandchild.data(), sizeof(float) * vertices) == 0;
+			}
+
+			failures += check(passed, "upsample " + std::to_string(size) + "x" + std::to_string(size) + " quadrant " + std::to_string(q)) ? 0 : 1;
+		}
+	}
+
+	return failures;
+}
+
+// A resident world of noise pages with no source, for the checks that query a terrain
+static void noise_terrain(Terrain* terrain, glm::ivec2 world, uint32_t seed, float height) {
+	const siv::PerlinNoise noise(seed);
+
+	std::vector<glm::ivec2> coords;
+	for (int z = 0; z < world.y; ++z) {
+		for (int x = 0; x < world.x; ++x) {
+			coords.push_back(glm::ivec2(x, z));
+		}
+	}
+
+	terrain->_world = world;
+	terrain->load_pages(coords);
+
+	for (const auto& coord : coords) {
+		const auto page = terrain->find_page(coord);
+		noise_heights(page, noise, height);
+		page->_node._pyramid.build(page->_node._heights.data(), terrain->_width, terrain->_length);
+	}
+
+	for (const auto& coord : coords) {
+		terrain->find_page(coord)->_node.generate_normals();
+	}
+}
+
+// Brush edits update the pyramid in place, it must stay what a rebuild from the edited heights gives
+// and every tile cell must hold the lowest and highest corner of its tile
+static int verify_pyramid(const Options& options) {
+	Terrain terrain(64, 64, 0);
+	noise_terrain(&terrain, glm::ivec2(2, 2), options._seed, 40.0f);
+
+	std::mt19937 random(options._seed);
+	std::uniform_real_distribution<float> position(0.0f, 128.0f);
+	std::uniform_real_distribution<float> amount(-20.0f, 20.0f);
+
+	// a dab on every page border and corner, then anywhere
+	std::vector<glm::vec2> dabs = { { 64.0f, 20.0f }, { 30.0f, 64.0f }, { 64.0f, 64.0f }, { 0.0f, 0.0f }, { 128.0f, 128.0f } };
+	for (int i = 0; i < 40; ++i) {
+		dabs.push_back(glm::vec2(position(random), position(random)));
+	}
+
+	auto& brush = *terrain._brush_mesh;
+	for (size_t i = 0; i < dabs.size(); ++i) {
+		brush._position = glm::vec3(dabs[i].x, 0.0f, dabs[i].y);
+		brush._radius = 1.0f + static_cast<float>(i % 8);
+		brush.raise_height(amount(random), F_RAISE);
+	}
+
+	int failures = 0;
+	for (int z = 0; z < terrain._world.y; ++z) {
+		for (int x = 0; x < terrain._world.x; ++x) {
+			const auto& node = terrain.find_page(glm::ivec2(x, z))->_node;
+			const auto& pyramid = node._pyramid;
+
+			TerrainPyramid rebuilt;
+			rebuilt.build(node._heights.data(), terrain._width, terrain._length);
+
+			bool passed = rebuilt.levels() == pyramid.levels();
+			for (int level = 0; passed && level < pyramid.levels(); ++level) {
+				const auto size = pyramid.size(level);
+				for (int cz = 0; passed && cz < size.y; ++cz) {
+					for (int cx = 0; passed && cx < size.x; ++cx) {
+						passed = pyramid.cell(level, cx, cz) == rebuilt.cell(level, cx, cz);
+					}
+				}
+			}
+
+			for (int tz = 0; passed && tz < terrain._length; ++tz) {
+				for (int tx = 0; passed && tx < terrain._width; ++tx) {
+					const auto tile = node.get_tile_height(tx + tz * terrain._width);
+					const auto cell = pyramid.cell(0, tx, tz);
+					passed = cell.x == std::min(std::min(tile._v0, tile._v1), std::min(tile._v2, tile._v3))
+						&& cell.y == std::max(std::max(tile._v0, tile._v1), std::max(tile._v2, tile._v3));
+				}
+			}
+
+			failures += check(passed, "pyramid page " + std::to_string(x) + "_" + std::to_string(z) + " after " + std::to_string(dabs.size()) + " dabs") ? 0 : 1;
+		}
+	}
+
+	return failures;
+}
+
+// Hits must lie on exact_height in the tile they report, and a march along the ray must not find the terrain before the hit
+// rays that miss must not find it anywhere, the march steps 0.02 world units and allows the height error a step can hide
+static int verify_raycast(const Options& options) {
+	Terrain terrain(64, 64, 0);
+	noise_terrain(&terrain, glm::ivec2(3, 2), options._seed, 40.0f);
+	terrain.get_transform().set_scale(glm::vec3(3.0f, 2.0f, 3.0f));
+
+	const auto scale = terrain.get_transform().get_scale();
+	const auto extent = glm::vec2(terrain._world.x * terrain._width, terrain._world.y * terrain._length) * glm::vec2(scale.x, scale.z);
+
+	std::mt19937 random(options._seed);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+	// steep rays from above, then grazing rays starting just over the ground
+	std::vector<std::pair<glm::vec3, glm::vec3>> rays;
+	for (int i = 0; i < 300; ++i) {
+		const auto origin = glm::vec3(unit(random) * extent.x, 100.0f + unit(random) * 200.0f, unit(random) * extent.y);
+		rays.push_back({ origin, glm::normalize(glm::vec3(unit(random) - 0.5f, -unit(random), unit(random) - 0.5f)) });
+	}
+	for (int i = 0; i < 300; ++i) {
+		auto origin = glm::vec3(unit(random) * extent.x, 0.0f, unit(random) * extent.y);
+		origin.y = terrain.exact_height(origin.x / scale.x, origin.z / scale.z) + 1.0f + 20.0f * unit(random);
+		rays.push_back({ origin, glm::normalize(glm::vec3(unit(random) - 0.5f, -0.05f * unit(random), unit(random) - 0.5f)) });
+	}
+
+	const float step = 0.02f;
+	const auto below = [&](glm::vec3 point, float tolerance) {
+		const float x = point.x / scale.x;
+		const float z = point.z / scale.z;
+		return x >= 0.0f && z >= 0.0f && x < extent.x / scale.x && z < extent.y / scale.z && point.y < terrain.exact_height(x, z) - tolerance;
+	};
+
+	int failures = 0, hits = 0, misses = 0;
+	for (const auto& ray : rays) {
+		TerrainHit hit;
+		const bool found = terrain.raycast(ray.first, ray.second, &hit);
+
+		bool passed = true;
+		float end = 2.0f * (extent.x + extent.y + 300.0f);
+		if (found) {
+			++hits;
+			const auto grid = glm::vec2(hit._position.x / scale.x, hit._position.z / scale.z);
+			const auto expected = ray.first + ray.second * hit._distance;
+
+			passed = std::abs(hit._position.y - terrain.exact_height(grid.x, grid.y)) <= 1e-3f * std::max(1.0f, std::abs(hit._position.y))
+				&& glm::length(expected - hit._position) <= 1e-3f * std::max(1.0f, hit._distance)
+				&& std::abs(grid.x - (hit._tile.x + 0.5f)) <= 0.5f + 1e-3f && std::abs(grid.y - (hit._tile.y + 0.5f)) <= 0.5f + 1e-3f;
+			end = hit._distance - step;
+		}
+		else {
+			++misses;
+		}
+
+		// a step of 0.02 along a slope of at most a few units per unit hides that much height
+		for (float t = 0.0f; passed && t < end; t += step) {
+			passed = !below(ray.first + ray.second * t, 0.05f);
+		}
+
+		if (!passed) {
+			std::cout << "FAILED raycast from " << ray.first.x << ' ' << ray.first.y << ' ' << ray.first.z
+					  << (found ? " hit at " + std::to_string(hit._distance) : std::string(" missed")) << '\n';
+			++failures;
+		}
+	}
+
+	check(failures == 0, "raycast " + std::to_string(hits) + " hits and " + std::to_string(misses) + " misses agree with exact_height");
+	return failures;
+}
+
+// Old Terrain::exact_height, exact_heights must match it bit for bit, normal is the up facing unit world normal of the triangle
+static float reference_height(Terrain& terrain, float x, float z, glm::vec3* normal) {
+	*normal = glm::vec3(0, 1, 0);
+
+	int x_index = static_cast<int>(x);
+	int z_index = static_cast<int>(z);
+	if (x_index < 0 || z_index < 0) {
+		return 0.0f;
+	}
+
+	auto page = terrain.page_at(x_index, z_index);
+	if (!page) {
+		return 0.0f;
+	}
+
+	x -= page->_origin.x;
+	z -= page->_origin.y;
+	x_index -= page->_origin.x;
+	z_index -= page->_origin.y;
+
+	const auto tile = page->_node.get_tile_height(x_index + z_index * terrain._width);
+
+	glm::vec3 a, b, c;
+	float dx = x - floor(x);
+	float dz = z - floor(z);
+
+	if (dx + dz > 1.0f) {
+		a = glm::vec3(0, tile._v2, 1);
+		b = glm::vec3(1, tile._v3, 1);
+		c = glm::vec3(1, tile._v1, 0);
+	}
+	else {
+		a = glm::vec3(0, tile._v2, 1);
+		b = glm::vec3(0, tile._v0, 0);
+		c = glm::vec3(1, tile._v1, 0);
+	}
+
+	auto n = glm::cross(a - c, b - c);
+
+	float h = a.y - ((dx - a.x) * n.x + (dz - a.z) * n.z) / n.y;
+
+	*normal = glm::normalize(n / terrain.get_transform().get_scale() * (n.y < 0.0f ? -1.0f : 1.0f));
+	return h * terrain.get_transform().get_scale().y;
+}
+
+// Random points, tile corners and edges, diagonals, page borders and points off the world, in batches of every size around the kernel's lanes
+static int verify_heights(const Options& options) {
+	Terrain terrain(64, 64, 0);
+	noise_terrain(&terrain, glm::ivec2(3, 2), options._seed, 40.0f);
+	terrain.get_transform().set_scale(glm::vec3(3.0f, 2.0f, 3.0f));
+
+	const auto extent = glm::vec2(terrain._world.x * terrain._width, terrain._world.y * terrain._length);
+
+	std::mt19937 random(options._seed);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+	std::vector<glm::vec2> points;
+	for (int i = 0; i < 4000; ++i) {
+		points.push_back(glm::vec2(unit(random) * extent.x, unit(random) * extent.y));
+	}
+	for (int i = 0; i < 500; ++i) {
+		const auto tile = glm::floor(glm::vec2(unit(random) * extent.x, unit(random) * extent.y));
+		const float t = unit(random);
+		points.push_back(tile);
+		points.push_back(tile + glm::vec2(t, 0.0f));
+		points.push_back(tile + glm::vec2(0.0f, t));
+		points.push_back(tile + glm::vec2(t, 1.0f - t));
+	}
+	for (int i = 0; i < 500; ++i) {
+		points.push_back(glm::vec2(64.0f, unit(random) * extent.y));
+		points.push_back(glm::vec2(unit(random) * extent.x, 64.0f));
+		points.push_back(glm::vec2(-unit(random), unit(random) * extent.y));
+		points.push_back(glm::vec2(extent.x + 1.0f + unit(random) * 10.0f, unit(random) * extent.y));
+		points.push_back(glm::vec2(unit(random) * extent.x, -2.0f - unit(random)));
+	}
+
+	std::vector<float> expected(points.size());
+	std::vector<glm::vec3> expected_normals(points.size());
+	for (size_t i = 0; i < points.size(); ++i) {
+		expected[i] = reference_height(terrain, points[i].x, points[i].y, &expected_normals[i]);
+	}
+
+	int failures = 0;
+	for (const size_t batch : { size_t(1), size_t(3), size_t(7), size_t(8), size_t(13), size_t(256), size_t(1000), points.size() }) {
+		std::vector<float> heights(points.size());
+		std::vector<glm::vec3> normals(points.size());
+		for (size_t begin = 0; begin < points.size(); begin += batch) {
+			const size_t count = std::min(batch, points.size() - begin);
+			terrain.exact_heights(points.data() + begin, count, heights.data() + begin, normals.data() + begin);
+		}
+
+		bool passed = std::memcmp(heights.data(), expected.data(), sizeof(float) * heights.size()) == 0;
+		for (size_t i = 0; passed && i < points.size(); ++i) {
+			passed = glm::length(normals[i] - expected_normals[i]) <= 1e-5f;
+		}
+
+		failures += check(passed, "exact_heights in batches of " + std::to_string(batch) + " match exact_height") ? 0 : 1;
+	}
+
+	bool passed = true;
+	for (size_t i = 0; passed && i < points.size(); ++i) {
+		const float height = terrain.exact_height(points[i].x, points[i].y);
+		passed = std::memcmp(&height, &expected[i], sizeof(float)) == 0;
+	}
+	failures += check(passed, "exact_height matches the old exact_height") ? 0 : 1;
+
+	return failures;
+}
+
+// every page resident, for checks that compare whole worlds
+static std::vector<glm::ivec2> load_world(Terrain* terrain) {
+	std::vector<glm::ivec2> coords;
+	for (int z = 0; z < terrain->_world.y; ++z) {
+		for (int x = 0; x < terrain->_world.x; ++x) {
+			coords.push_back(glm::ivec2(x, z));
+		}
+	}
+
+	terrain->load_pages(coords);
+	return coords;
+}
+
+// heights and blend tiles of every page, the same tiles must be painted
+static bool same_world(Terrain* a, Terrain* b) {
+	if (a->_world != b->_world || a->_width != b->_width || a->_length != b->_length) {
+		return false;
+	}
+
+	for (const auto& coord : load_world(b)) {
+		const auto page_a = a->find_page(coord);
+		const auto page_b = b->find_page(coord);
+		if (!page_a || !page_b || page_a->_node._heights.size() != page_b->_node._heights.size()
+			|| std::memcmp(page_a->_node._heights.data(), page_b->_node._heights.data(), sizeof(float) * page_a->_node._heights.size())) {
+			return false;
+		}
+
+		const auto& blend_a = page_a->_blend_map;
+		const auto& blend_b = page_b->_blend_map;
+		for (size_t i = 0; i < blend_a.tile_count(); ++i) {
+			const auto tile_a = blend_a.tile(static_cast<int>(i));
+			const auto tile_b = blend_b.tile(static_cast<int>(i));
+			if (!tile_a != !tile_b || (tile_a && std::memcmp(tile_a, tile_b, blend_a.tile_bytes()))) {
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+static std::string file_contents(const std::string& file) {
+	std::ifstream stream(file, std::ios::binary);
+	return std::string(std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>());
+}
+
+// Saving over a chunk file journals the edits and leaves the base file alone, a reload must give back the edited world
+// a journal past _compact_bytes and the base file's size is compacted into a new base file holding the same world
+static int verify_journal(const Options& options) {
+	const auto directory = std::filesystem::temp_directory_path() / ("terrain_verify_" + std::to_string(options._seed));
+	const auto file = (directory / "world.terrain").string();
+	const auto journal = file + TERRAIN_JOURNAL_EXTENSION;
+
+	std::error_code error;
+	std::filesystem::remove_all(directory, error);
+	std::filesystem::create_directories(directory, error);
+
+	std::mt19937 random(options._seed);
+	std::uniform_real_distribution<float> position(0.0f, 128.0f);
+	std::uniform_real_distribution<float> amount(-20.0f, 20.0f);
+
+	// brush dabs and blend strokes over the whole world
+	const auto edit = [&](Terrain* terrain, int strokes, float radius) {
+		load_world(terrain);
+
+		auto& brush = *terrain->_brush_mesh;
+		for (int i = 0; i < strokes; ++i) {
+			brush._position = glm::vec3(position(random), 0.0f, position(random));
+			brush._radius = radius;
+			brush.raise_height(amount(random), F_RAISE);
+			brush.paint_blend_map(B_TEXTURE0 + i % 4, 0.5f, BLEND_ADD);
+		}
+	};
+
+	int failures = 0;
+	{
+		Terrain terrain(64, 64, 0);
+		noise_terrain(&terrain, glm::ivec2(2, 2), options._seed, 40.0f);
+		failures += check(save(&terrain, file, TERRAIN_FORMAT_RAW) && !std::filesystem::exists(journal), "journal save to a new chunk file") ? 0 : 1;
+	}
+
+	const auto base = file_contents(file);
+	{
+		Terrain terrain(0, 0, 0);
+		terrain.load(file);
+		edit(&terrain, 6, 3.0f);
+
+		const bool saved = save(&terrain, file, TERRAIN_FORMAT_RAW);
+		failures += check(saved && std::filesystem::exists(journal) && file_contents(file) == base, "journal save keeps the base file") ? 0 : 1;
+
+		Terrain reloaded(0, 0, 0);
+		reloaded.load(file);
+		failures += check(same_world(&terrain, &reloaded), "journal reload matches the edited world") ? 0 : 1;
+	}
+	{
+		TerrainPageSettings settings;
+		settings._compact_bytes = 1;
+		Terrain terrain(0, 0, 0, settings);
+		terrain.load(file);
+		edit(&terrain, 12, 12.0f);
+
+		const bool saved = save(&terrain, file, TERRAIN_FORMAT_RAW);
+		failures += check(saved && !std::filesystem::exists(journal) && file_contents(file) != base, "journal compacts past _compact_bytes and the base file") ? 0 : 1;
+
+		Terrain reloaded(0, 0, 0);
+		reloaded.load(file);
+		failures += check(same_world(&terrain, &reloaded), "compacted reload matches the edited world") ? 0 : 1;
+	}
+
+	std::filesystem::remove_all(directory, error);
+	return failures;
+}
+
+// terrain verify <group> runs one group of checks, every group without one
+static int verify(const Options& options) {
+	const std::pair<const char*, std::function<int(const Options&)>> groups[] = {
+		{ "codec",		verify_codec },
+		{ "upsample",	verify_upsample },
+		{ "pyramid",	verify_pyramid },
+		{ "raycast",	verify_raycast },
+		{ "heights",	verify_heights },
+		{ "journal",	verify_journal },
+	};
+
+	if (options._files.size() > 1) {
+		usage();
+		return 1;
+	}
+
+	int failures = 0;
+	bool found = false;
+	for (const auto& group : groups) {
+		if (options._files.empty() || options._files[0] == group.first) {
+			failures += group.second(options);
+			found = true;
+		}
+	}
+
+	if (!found) {
+		usage();
+		return 1;
+	}
+
+	if (failures) {
+		std::cout << "VERIFY FAILED " << failures << " CHECKS\n";
+		return 1;
+	}
+
+	std::cout << "all checks passed\n";
+	return 0;
+}
+
+int main(int argc, char** argv) {
+	Options options;
+	if (argc < 2 || !parse_options(argc, argv, &options)) {
+		usage();
+		return 1;
+	}
+
+	const std::string command = argv[1];
+	if (command == "generate")	return generate(options);
+	if (command == "convert")	return convert(options);
+	if (command == "inspect")	return inspect(options);
+	if (command == "benchmark")	return benchmark(options);
+	if (command == "verify")	return verify(options);
+
+	usage();
+	return 1;
+}